@@ -0,0 +1,52 @@
+red = gr.material({0.8, 0.1, 0.1}, {0.5, 0.5, 0.5}, 25)
+blue = gr.material({0.0, 0.1, 1}, {0.5, 0.5, 0.5}, 25)
+fwhite = gr.material({1.0, 1.0, 1.0}, {1.0, 1.0, 1.0}, 50, 1, 200, 10000)
+
+root = gr.node('root')
+
+-- floor
+wall1 = gr.cube('wall1')
+root:add_child(wall1)
+wall1:set_material(fwhite)
+wall1:translate(-15, -1, -15)
+wall1:scale(30,1,30)
+
+-- a still cloud of small drops, packed as x, y, z, radius
+math.randomseed(488)
+drops = {}
+for i = 1, 20000 do
+  drops[#drops + 1] = 12 * math.random() - 6
+  drops[#drops + 1] = 4 + 8 * math.random()
+  drops[#drops + 1] = 6 * math.random() - 10
+  drops[#drops + 1] = 0.05 + 0.05 * math.random()
+end
+CLOUD = gr.particles('CLOUD', drops)
+CLOUD:set_material(blue)
+root:add_child(CLOUD)
+
+-- a spray blurred along each particle's velocity, x, y, z per particle
+spray = {}
+velocities = {}
+for i = 1, 5000 do
+  spray[#spray + 1] = math.random() - 0.5
+  spray[#spray + 1] = 2 * math.random()
+  spray[#spray + 1] = math.random() + 2
+  spray[#spray + 1] = 0.1
+  velocities[#velocities + 1] = 2 * math.random() - 1
+  velocities[#velocities + 1] = 3 * math.random()
+  velocities[#velocities + 1] = 2 * math.random() - 1
+end
+SPRAY = gr.particles('SPRAY', spray, velocities)
+SPRAY:set_material(red)
+root:add_child(SPRAY)
+
+-- simulation output is read from a binary file instead (see particles.h)
+-- SIM = gr.particles('SIM', 'frame0001.rtps')
+
+white_light = gr.light(12000, {0.0, 29.0, 0.0}, {1, 1, 1}, {1, 0, 0})
+
+camera = gr.pcamera({0, 15, 40}, {0, -0.3, -1}, {0, 1, 0}, 50, 0.1, 40)
+
+gr.render(root, './img/particles.png', 1024, 1024,
+	  camera,
+	  {0.3, 0.3, 0.3}, {white_light}, {}, 0, 1, 8)
@@ -0,0 +1,58 @@
+red = gr.material({0.8, 0.1, 0.1}, {0.5, 0.5, 0.5}, 25)
+blue = gr.material({0.0, 0.1, 1}, {0.5, 0.5, 0.5}, 25)
+green = gr.material({0.0, 1.0, 0.0}, {0.5, 0.5, 0.5}, 25)
+gold = gr.material({0.8, 0.6, 0.1}, {0.8, 0.8, 0.8}, 50)
+fwhite = gr.material({1.0, 1.0, 1.0}, {1.0, 1.0, 1.0}, 50, 1, 200, 10000)
+
+root = gr.node('root')
+
+-- floor
+wall1 = gr.cube('wall1')
+root:add_child(wall1)
+wall1:set_material(fwhite)
+wall1:translate(-15, -1, -15)
+wall1:scale(30,1,30)
+
+-- lying flat, the ring is in the xy plane so turn it onto xz
+RING = gr.torus('RING', 0.3)
+RING:translate(-6, 1.2, -4)
+RING:rotate('x', 90)
+RING:scale(4, 4, 4)
+RING:set_material(red)
+root:add_child(RING)
+
+-- standing up
+RING = gr.torus('RING', 0.2)
+RING:translate(5, 5, -6)
+RING:rotate('y', 30)
+RING:scale(4, 4, 4)
+RING:set_material(blue)
+root:add_child(RING)
+
+-- a chain of links through each other
+for i = 0, 3 do
+  LINK = gr.torus('LINK' .. i, 0.15)
+  LINK:translate(-4.5 + 3 * i, 12, 0)
+  if i % 2 == 1 then
+    LINK:rotate('x', 90)
+  end
+  LINK:scale(2, 2, 2)
+  LINK:set_material(gold)
+  root:add_child(LINK)
+end
+
+-- a thin hoop
+RING = gr.torus('RING', 0.05)
+RING:translate(2, 1, 6)
+RING:rotate('x', 70)
+RING:scale(3, 3, 3)
+RING:set_material(green)
+root:add_child(RING)
+
+white_light = gr.light(12000, {0.0, 29.0, 0.0}, {1, 1, 1}, {1, 0, 0})
+
+camera = gr.pcamera({0, 15, 40}, {0, -0.3, -1}, {0, 1, 0}, 50, 0.1, 40)
+
+gr.render(root, './img/torus.png', 1024, 1024,
+	  camera,
+	  {0.3, 0.3, 0.3}, {white_light}, {}, 0, 0, 1)
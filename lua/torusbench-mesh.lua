@@ -0,0 +1,74 @@
+-- The 16 tori of torusbench.lua as flat shaded triangle meshes, for comparing
+-- against the torus primitive. -m double prints each mesh's memory use:
+--   ./rt lua/torusbench-mesh.lua -o -m double
+-- Set U and V to the tessellation to compare, e.g. 24x12, 48x24, 96x48 or 192x96.
+U = 48
+V = 24
+
+-- A ring like gr.torus(name, minor): major radius 1 around the z axis, u segments
+-- around the ring and v around its tube, each quad split into 2 triangles
+function torusmesh(name, minor, u, v)
+  local verts = {}
+  local faces = {}
+  for i = 0, u - 1 do
+    local a = 2 * math.pi * i / u
+    for j = 0, v - 1 do
+      local b = 2 * math.pi * j / v
+      local r = 1 + minor * math.cos(b)
+      table.insert(verts, {r * math.cos(a), r * math.sin(a), minor * math.sin(b)})
+    end
+  end
+  for i = 0, u - 1 do
+    local i1 = (i + 1) % u
+    for j = 0, v - 1 do
+      local j1 = (j + 1) % v
+      table.insert(faces, {i * v + j, i1 * v + j, i1 * v + j1})
+      table.insert(faces, {i * v + j, i1 * v + j1, i * v + j1})
+    end
+  end
+  return gr.mesh(name, verts, faces)
+end
+
+red = gr.material({0.8, 0.1, 0.1}, {0.5, 0.5, 0.5}, 25)
+blue = gr.material({0.1, 0.1, 0.9}, {0.5, 0.5, 0.5}, 25)
+white = gr.material({0.9, 0.9, 0.9}, {0.5, 0.5, 0.5}, 25)
+
+root = gr.node('root')
+
+-- one ring of each colour, placed by the nodes below
+RED_RING = torusmesh('RED_RING', 0.3, U, V)
+RED_RING:set_material(red)
+BLUE_RING = torusmesh('BLUE_RING', 0.3, U, V)
+BLUE_RING:set_material(blue)
+
+-- a 4x4 grid, each ring tipped a little further than the last
+for i = 0, 3 do
+  for j = 0, 3 do
+    RING = gr.node('RING' .. i .. j)
+    RING:translate(-3 + 2 * i, -3 + 2 * j, -8)
+    RING:rotate('x', 20 + 15 * i)
+    RING:rotate('y', 10 * j)
+    RING:scale(0.8, 0.8, 0.8)
+    if (i + j) % 2 == 1 then
+      RING:add_child(RED_RING)
+    else
+      RING:add_child(BLUE_RING)
+    end
+    root:add_child(RING)
+  end
+end
+
+-- floor
+FLOOR = gr.cube('FLOOR')
+FLOOR:translate(-10, -5, -20)
+FLOOR:scale(20, 0.5, 22)
+FLOOR:set_material(white)
+root:add_child(FLOOR)
+
+white_light = gr.light(1, {-3, 6, 4}, {0.9, 0.9, 0.9}, {1, 0, 0})
+
+camera = gr.pcamera({0, 0, 3}, {0, 0, -1}, {0, 1, 0}, 50)
+
+gr.render(root, './img/torusbench-mesh.png', 320, 320,
+	  camera,
+	  {0.2, 0.2, 0.2}, {white_light}, {}, 0, 0, 1)
@@ -0,0 +1,48 @@
+-- 16 tori as torus primitives. torusbench-mesh.lua renders the same rings as
+-- triangle meshes, render both with the octree to compare time and memory:
+--   ./rt lua/torusbench.lua -o
+--   ./rt lua/torusbench-mesh.lua -o -m double
+
+red = gr.material({0.8, 0.1, 0.1}, {0.5, 0.5, 0.5}, 25)
+blue = gr.material({0.1, 0.1, 0.9}, {0.5, 0.5, 0.5}, 25)
+white = gr.material({0.9, 0.9, 0.9}, {0.5, 0.5, 0.5}, 25)
+
+root = gr.node('root')
+
+-- one ring of each colour, placed by the nodes below
+RED_RING = gr.torus('RED_RING', 0.3)
+RED_RING:set_material(red)
+BLUE_RING = gr.torus('BLUE_RING', 0.3)
+BLUE_RING:set_material(blue)
+
+-- a 4x4 grid, each ring tipped a little further than the last
+for i = 0, 3 do
+  for j = 0, 3 do
+    RING = gr.node('RING' .. i .. j)
+    RING:translate(-3 + 2 * i, -3 + 2 * j, -8)
+    RING:rotate('x', 20 + 15 * i)
+    RING:rotate('y', 10 * j)
+    RING:scale(0.8, 0.8, 0.8)
+    if (i + j) % 2 == 1 then
+      RING:add_child(RED_RING)
+    else
+      RING:add_child(BLUE_RING)
+    end
+    root:add_child(RING)
+  end
+end
+
+-- floor
+FLOOR = gr.cube('FLOOR')
+FLOOR:translate(-10, -5, -20)
+FLOOR:scale(20, 0.5, 22)
+FLOOR:set_material(white)
+root:add_child(FLOOR)
+
+white_light = gr.light(1, {-3, 6, 4}, {0.9, 0.9, 0.9}, {1, 0, 0})
+
+camera = gr.pcamera({0, 0, 3}, {0, 0, -1}, {0, 1, 0}, 50)
+
+gr.render(root, './img/torusbench.png', 320, 320,
+	  camera,
+	  {0.2, 0.2, 0.2}, {white_light}, {}, 0, 0, 1)
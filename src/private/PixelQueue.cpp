@@ -1,12 +1,108 @@
 #include "PixelQueue.h"
+#include <algorithm>
+#include <cmath>
 
-PixelQueue::PixelQueue(DimensionType maxX, DimensionType maxY) :
-    m_currentX(0),
-    m_currentY(0),
+TileSettings TileMode = { 16, TileOrder::Hilbert, false };
+
+// Spread the low 16 bits of v one apart
+static uint32_t SpreadBits(uint32_t v)
+{
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Distance along the Hilbert curve filling an n by n grid, n a power of two
+static uint64_t HilbertIndex(uint32_t n, uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2)
+    {
+        const uint32_t rx = (x & s) ? 1 : 0;
+        const uint32_t ry = (y & s) ? 1 : 0;
+        d += uint64_t(s) * s * ((3 * rx) ^ ry);
+
+        // Turn the quadrant so the curve inside it starts where the last one ended
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+PixelQueue::PixelQueue(DimensionType maxX, DimensionType maxY, const TileSettings& settings) :
     m_maxX(maxX),
-    m_maxY(maxY)
+    m_maxY(maxY),
+    m_tileSize(static_cast<DimensionType>(std::max(1u, settings.Size))),
+    m_nextSlot(0)
 {
+    const uint32_t tilesX = static_cast<uint32_t>(maxX / m_tileSize + 1);
+    const uint32_t tilesY = static_cast<uint32_t>(maxY / m_tileSize + 1);
+    uint32_t gridSize = 1;
+    while (gridSize < tilesX || gridSize < tilesY)
+    {
+        gridSize *= 2;
+    }
 
+    // Each tile's place in the order above its index, which keeps ties in scanline order
+    std::vector<std::pair<uint64_t, uint32_t>> keys;
+    keys.reserve(size_t(tilesX) * tilesY);
+    for (uint32_t ty = 0; ty < tilesY; ++ty)
+    {
+        for (uint32_t tx = 0; tx < tilesX; ++tx)
+        {
+            uint64_t key = 0;
+            switch (settings.Order)
+            {
+            case TileOrder::Scanline:
+                key = uint64_t(ty) * tilesX + tx;
+                break;
+            case TileOrder::Morton:
+                key = SpreadBits(tx) | (SpreadBits(ty) << 1);
+                break;
+            case TileOrder::Hilbert:
+                key = HilbertIndex(gridSize, tx, ty);
+                break;
+            }
+
+            if (settings.bCentreFirst)
+            {
+                // The ring is how many tiles the tile's centre is from the image's
+                const double dx = std::fabs((tx + 0.5) * m_tileSize - (maxX + 1) * 0.5);
+                const double dy = std::fabs((ty + 0.5) * m_tileSize - (maxY + 1) * 0.5);
+                const uint64_t ring = static_cast<uint64_t>(std::max(dx, dy) / m_tileSize);
+                key |= ring << 40;
+            }
+            keys.emplace_back(key, ty * tilesX + tx);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    m_tiles.reserve(keys.size());
+    for (const auto& key : keys)
+    {
+        m_tiles.emplace_back(static_cast<DimensionType>(key.second % tilesX) * m_tileSize,
+                             static_cast<DimensionType>(key.second / tilesX) * m_tileSize);
+    }
+    m_tileArea = size_t(m_tileSize) * m_tileSize;
+    m_numSlots = m_tiles.size() * m_tileArea;
+}
+
+bool PixelQueue::GetSlotPixel(size_t Slot, DimensionType& x, DimensionType& y) const
+{
+    const Pixel& Tile = m_tiles[Slot / m_tileArea];
+    const size_t Offset = Slot % m_tileArea;
+    x = Tile.GetX() + static_cast<DimensionType>(Offset % m_tileSize);
+    y = Tile.GetY() + static_cast<DimensionType>(Offset / m_tileSize);
+    return x <= m_maxX && y <= m_maxY;
 }
 
 /**
@@ -15,18 +111,44 @@ PixelQueue::PixelQueue(DimensionType maxX, DimensionType maxY) :
  */
 Pixel PixelQueue::GetNextPixel()
 {
-    ScopeLock lock(m_mutex);
-
-    if (m_currentX > m_maxX)
+    // The image is written after the threads are joined, so the claims need no ordering
+    for (;;)
     {
-        m_currentX = 0;
-        ++m_currentY;
+        const size_t Slot = m_nextSlot.fetch_add(1, std::memory_order_relaxed);
+        if (Slot >= m_numSlots)
+        {
+            return Pixel::NullPixel;
+        }
+
+        DimensionType x, y;
+        if (GetSlotPixel(Slot, x, y))
+        {
+            return Pixel(x, y);
+        }
     }
-    if (m_currentY > m_maxY)
+}
+
+size_t PixelQueue::GetNextPixels(std::vector<Pixel>& Out, size_t Max)
+{
+    size_t Num = 0;
+    while (Num == 0 && Max > 0)
     {
-        return Pixel::NullPixel;
-    }
+        const size_t First = m_nextSlot.fetch_add(Max, std::memory_order_relaxed);
+        if (First >= m_numSlots)
+        {
+            break;
+        }
 
-    // return the current pixel and progress to the next
-    return Pixel(m_currentX++, m_currentY);
-}
\ No newline at end of file
+        const size_t Last = std::min(First + Max, m_numSlots);
+        for (size_t Slot = First; Slot < Last; ++Slot)
+        {
+            DimensionType x, y;
+            if (GetSlotPixel(Slot, x, y))
+            {
+                Out.emplace_back(x, y);
+                Num++;
+            }
+        }
+    }
+    return Num;
+}
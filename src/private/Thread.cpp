@@ -9,7 +9,7 @@ void Thread::Yield( unsigned int TimesToYield )
 	}
 }
 
-Thread::Thread()
+Thread::Thread() : ActualThread(nullptr)
 {
 }
 
@@ -26,7 +26,7 @@ void Thread::Start()
 
 void Thread::Join()
 {
-	if ( ActualThread->joinable() )
+	if ( ActualThread && ActualThread->joinable() )
 	{
 		ActualThread->join();
 	}
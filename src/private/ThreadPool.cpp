@@ -0,0 +1,153 @@
+#include "ThreadPool.h"
+#include "affinity.h"
+
+// The pool and queue of the worker running on this thread, if it is one
+static thread_local ThreadPool* CurrentPool = nullptr;
+static thread_local size_t CurrentQueue = 0;
+
+class ThreadPool::Worker : public Thread
+{
+	ThreadPool& Pool;
+	size_t Index;
+
+public:
+	Worker( ThreadPool& Pool, size_t Index ) : Pool(Pool), Index(Index) {}
+
+	virtual void Main() override
+	{
+		Pool.WorkerMain(Index);
+	}
+};
+
+ThreadPool::TaskGroup::TaskGroup( ThreadPool& Pool ) : Pool(Pool), Pending(0)
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	Wait();
+}
+
+void ThreadPool::TaskGroup::Run( Task T )
+{
+	Pending++;
+	Pool.Push([this, T]
+	{
+		T();
+		Pending--;
+	});
+}
+
+void ThreadPool::TaskGroup::Wait()
+{
+	// Tasks this one waits on may be queued behind others, so help rather than block
+	while (Pending > 0)
+	{
+		if (!Pool.RunOne())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+ThreadPool::ThreadPool( unsigned int NumWorkers ) : NumQueued(0), NextQueue(0), bStopping(false)
+{
+	NumWorkers = std::max(NumWorkers, 1u);
+	for (unsigned int i = 0; i < NumWorkers; ++i)
+	{
+		Queues.emplace_back(std::make_unique<TaskQueue>());
+	}
+	for (unsigned int i = 0; i < NumWorkers; ++i)
+	{
+		Workers.emplace_back(CreateThread<Worker>(*this, i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<Mutex> Lock(SleepLock);
+		bStopping = true;
+	}
+	Wake.notify_all();
+
+	// Joined before the workers are destroyed, which would leave them running
+	for (auto& W : Workers)
+	{
+		W->Join();
+	}
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	static ThreadPool Pool(GetNumCores());
+	return Pool;
+}
+
+void ThreadPool::Push( Task T )
+{
+	const size_t Index = CurrentPool == this ? CurrentQueue : NextQueue++ % Queues.size();
+	{
+		ScopeLock Lock(Queues[Index]->Lock);
+		Queues[Index]->Tasks.push_back(std::move(T));
+		NumQueued++;
+	}
+
+	// Taking the lock orders this after any worker's check of NumQueued under it, so none
+	// goes to sleep having missed the task
+	{
+		std::unique_lock<Mutex> Lock(SleepLock);
+	}
+	Wake.notify_one();
+}
+
+bool ThreadPool::RunOne()
+{
+	const size_t Home = CurrentPool == this ? CurrentQueue : 0;
+	Task T;
+	for (size_t i = 0; i < Queues.size() && !T; ++i)
+	{
+		TaskQueue& Queue = *Queues[(Home + i) % Queues.size()];
+		ScopeLock Lock(Queue.Lock);
+		if (Queue.Tasks.empty())
+		{
+			continue;
+		}
+
+		// The newest of its own tasks is the likeliest to still be cached, the oldest of
+		// another's is the likeliest to be a large piece of work
+		if (i == 0 && CurrentPool == this)
+		{
+			T = std::move(Queue.Tasks.back());
+			Queue.Tasks.pop_back();
+		}
+		else
+		{
+			T = std::move(Queue.Tasks.front());
+			Queue.Tasks.pop_front();
+		}
+	}
+
+	if (!T)
+	{
+		return false;
+	}
+	NumQueued--;
+	T();
+	return true;
+}
+
+void ThreadPool::WorkerMain( size_t Index )
+{
+	CurrentPool = this;
+	CurrentQueue = Index;
+	PinThread(AffinityMode.Placement, Index);
+	while (!bStopping)
+	{
+		if (!RunOne())
+		{
+			std::unique_lock<Mutex> Lock(SleepLock);
+			Wake.wait(Lock, [this] { return NumQueued > 0 || bStopping; });
+		}
+	}
+}
@@ -0,0 +1,210 @@
+#include "affinity.h"
+#include "Thread.h"
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+AffinitySettings AffinityMode = { ThreadPlacement::None, false };
+
+namespace
+{
+// Highest node number looked for, nodes can be numbered with gaps
+constexpr unsigned int MaxNumaNodes = 256;
+
+thread_local unsigned int ThreadNumaNode = 0;
+
+// CPUs in a list like "0-3,8,10-11"
+std::vector<unsigned int> ParseCpuList(const std::string& list)
+{
+    std::vector<unsigned int> cpus;
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        unsigned int first, last;
+        const int read = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+        if (read < 1)
+        {
+            continue;
+        }
+        for (unsigned int cpu = first; cpu <= (read == 2 ? last : first); ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::vector<std::vector<unsigned int>> ReadNumaNodes()
+{
+    std::vector<std::vector<unsigned int>> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    const bool bHaveMask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    for (unsigned int node = 0; node < MaxNumaNodes; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list))
+        {
+            continue;
+        }
+
+        std::vector<unsigned int> cpus;
+        for (unsigned int cpu : ParseCpuList(list))
+        {
+            if (cpu < CPU_SETSIZE && (!bHaveMask || CPU_ISSET(cpu, &allowed)))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+
+        // Nodes of memory alone, or of CPUs taken away by taskset, have no threads to place
+        if (!cpus.empty())
+        {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+
+    if (nodes.empty() && bHaveMask)
+    {
+        nodes.emplace_back();
+        for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                nodes.back().push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+        for (unsigned int cpu = 0; cpu < GetNumCores(); ++cpu)
+        {
+            nodes.back().push_back(cpu);
+        }
+    }
+    return nodes;
+}
+
+bool PinToCpus(const std::vector<unsigned int>& cpus)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned int cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+// Pins itself to a node and runs a function there
+class NodeThread : public Thread
+{
+    const std::function<void(unsigned int)>& Fn;
+    unsigned int Node;
+
+public:
+    NodeThread(const std::function<void(unsigned int)>& Fn, unsigned int Node) : Fn(Fn), Node(Node) {}
+
+    virtual void Main() override
+    {
+        if (PinToCpus(GetNumaNodes()[Node]))
+        {
+            ThreadNumaNode = Node;
+        }
+        Fn(Node);
+    }
+};
+} // namespace
+
+const std::vector<std::vector<unsigned int>>& GetNumaNodes()
+{
+    static const std::vector<std::vector<unsigned int>> Nodes = ReadNumaNodes();
+    return Nodes;
+}
+
+bool PinThread(ThreadPlacement Placement, size_t Index)
+{
+    const std::vector<std::vector<unsigned int>>& Nodes = GetNumaNodes();
+    size_t NumCpus = 0;
+    for (const auto& Cpus : Nodes)
+    {
+        NumCpus += Cpus.size();
+    }
+    if (Placement == ThreadPlacement::None || NumCpus == 0)
+    {
+        return false;
+    }
+
+    // More threads than CPUs share them from the start again
+    Index %= NumCpus;
+    unsigned int Node = 0;
+    size_t Cpu = 0;
+    if (Placement == ThreadPlacement::Compact)
+    {
+        while (Index >= Nodes[Node].size())
+        {
+            Index -= Nodes[Node++].size();
+        }
+        Cpu = Index;
+    }
+    else
+    {
+        // Deal the threads out a node at a time, skipping nodes that have run out of CPUs
+        std::vector<size_t> Taken(Nodes.size(), 0);
+        for (size_t i = 0;; Node = (Node + 1) % Nodes.size())
+        {
+            if (Taken[Node] == Nodes[Node].size())
+            {
+                continue;
+            }
+            if (i++ == Index)
+            {
+                break;
+            }
+            Taken[Node]++;
+        }
+        Cpu = Taken[Node];
+    }
+
+    if (!PinToCpus({ Nodes[Node][Cpu] }))
+    {
+        return false;
+    }
+    ThreadNumaNode = Node;
+    return true;
+}
+
+unsigned int GetThreadNumaNode()
+{
+    return ThreadNumaNode;
+}
+
+void RunOnEachNumaNode(const std::function<void(unsigned int Node)>& Fn)
+{
+    std::vector<std::unique_ptr<NodeThread>> Threads;
+    for (unsigned int Node = 0; Node < GetNumaNodes().size(); ++Node)
+    {
+        Threads.push_back(CreateThread<NodeThread>(Fn, Node));
+    }
+    for (auto& T : Threads)
+    {
+        T->Join();
+    }
+}
@@ -105,3 +105,58 @@ Matrix4x4 Matrix4x4::invert() const
 
     return ret;
 }
+
+AffineTransform AffineTransform::invert() const
+{
+    const AffineTransform& a = *this;
+    AffineTransform ret;
+
+    // Adjugate of the 3x3 part
+    ret[0][0] = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+    ret[0][1] = a[0][2] * a[2][1] - a[0][1] * a[2][2];
+    ret[0][2] = a[0][1] * a[1][2] - a[0][2] * a[1][1];
+    ret[1][0] = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+    ret[1][1] = a[0][0] * a[2][2] - a[0][2] * a[2][0];
+    ret[1][2] = a[0][2] * a[1][0] - a[0][0] * a[1][2];
+    ret[2][0] = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+    ret[2][1] = a[0][1] * a[2][0] - a[0][0] * a[2][1];
+    ret[2][2] = a[0][0] * a[1][1] - a[0][1] * a[1][0];
+
+    const double det = a[0][0] * ret[0][0] + a[0][1] * ret[1][0] + a[0][2] * ret[2][0];
+    if (det == 0.0)
+    {
+        // Theoretically throw an exception.
+        return AffineTransform();
+    }
+
+    const double invDet = 1.0 / det;
+    for (size_t row = 0; row < 3; ++row)
+    {
+        for (size_t col = 0; col < 3; ++col)
+        {
+            ret[row][col] *= invDet;
+        }
+    }
+
+    // Undo the translation after the 3x3 part
+    for (size_t row = 0; row < 3; ++row)
+    {
+        ret[row][3] = -(ret[row][0] * a[0][3] + ret[row][1] * a[1][3] + ret[row][2] * a[2][3]);
+    }
+    return ret;
+}
+
+AffineTransform AffineTransform::normalMatrix() const
+{
+    const AffineTransform inv = invert();
+    AffineTransform ret;
+    for (size_t row = 0; row < 3; ++row)
+    {
+        for (size_t col = 0; col < 3; ++col)
+        {
+            ret[row][col] = inv[col][row];
+        }
+        ret[row][3] = 0.0;
+    }
+    return ret;
+}
@@ -0,0 +1,3 @@
+#include "approxmath.h"
+
+bool bUseApproxMath = false;
@@ -0,0 +1,50 @@
+#include "cpudispatch.h"
+
+namespace
+{
+const char* const LevelNames[] = { "generic", "sse4.2", "avx2", "avx512" };
+}
+
+// Chosen before any kernel runs
+CpuLevel ActiveCpuLevel = DetectCpuLevel();
+
+CpuLevel DetectCpuLevel()
+{
+#ifdef RT_CPU_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+    {
+        return CpuLevel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+    {
+        return CpuLevel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+    {
+        return CpuLevel::SSE42;
+    }
+#endif
+    return CpuLevel::Generic;
+}
+
+bool SetCpuLevel(const std::string& name)
+{
+    for (size_t i = 0; i < sizeof(LevelNames) / sizeof(LevelNames[0]); ++i)
+    {
+        const CpuLevel level = static_cast<CpuLevel>(i);
+        if (name == LevelNames[i] && level <= DetectCpuLevel())
+        {
+            ActiveCpuLevel = level;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetCpuLevelName(CpuLevel level)
+{
+    return LevelNames[static_cast<size_t>(level)];
+}
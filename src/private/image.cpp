@@ -1,10 +1,12 @@
 #include "image.hpp"
+#include "ThreadPool.h"
 #include <string>
 #include <cstring>
 #include <cstdio>
 #include <cmath>
 #include <png.h>
 #include <sstream>
+#include <vector>
 
 Image::Image()
   : m_width(0), m_height(0), m_elements(0), m_data(0)
@@ -123,10 +125,13 @@ bool Image::savePng(const std::string& filename)
                PNG_FILTER_TYPE_DEFAULT);
   png_write_info(png_ptr, info_ptr);
 
-  // Actual writing
-  png_byte* tempLine = new png_byte[m_width * m_elements];
+  // Actual writing. The rows are converted by the thread pool, libpng
+  // compresses them in order.
+  const size_t lineSize = static_cast<size_t>(m_width) * m_elements;
+  std::vector<png_byte> lines(lineSize * m_height);
 
-  for (int i = 0; i < m_height; i++) {
+  ThreadPool::Get().ParallelFor(0, m_height, 16, [&](size_t i) {
+    png_byte* tempLine = &lines[lineSize * i];
     for (int j = 0; j < m_width; j++) {
       for (int k = 0; k < m_elements; k++) {
         // Clamp the value
@@ -136,10 +141,11 @@ bool Image::savePng(const std::string& filename)
         tempLine[m_elements * j + k] = static_cast<png_byte>(value * 255.0);
       }
     }
-    png_write_row(png_ptr, tempLine);
-  }
+  });
 
-  delete [] tempLine;
+  for (int i = 0; i < m_height; i++) {
+    png_write_row(png_ptr, &lines[lineSize * i]);
+  }
 
   // closing and freeing the structs
   png_write_end(png_ptr, info_ptr);
@@ -1,4 +1,6 @@
 #include "light.hpp"
+#include "approxmath.h"
+#include "scene.hpp"
 #include "scenecontainer.h"
 #include "ray.h"
 #include <iostream>
@@ -14,15 +16,21 @@ Light::Light()
     falloff[2] = 0.0;
 }
 
-bool Light::IsVisibleFrom(const SceneContainer* Scene, const Point3D& LightLoc, const Point3D& TestLoc, const double& Time)
+bool Light::IsVisibleFrom(const SceneContainer* Scene, const Point3D& LightLoc, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source)
 {
     Vector3D PtToLight = LightLoc - TestLoc;
-    const double LightDist = PtToLight.length2();
-    double dist = std::numeric_limits<double>::max();
+    const double LightDist = PtToLight.length();
     PtToLight.normalize();
-    
-    bool bHit = Scene->TimeDepthTrace(Ray(TestLoc, PtToLight), dist, Time);
-    if (bHit && dist < LightDist)
+
+    // Only hits before the light matter, and any one of them will do
+    Ray ShadowRay(TestLoc, PtToLight);
+    ShadowRay.SetTMax(LightDist);
+    ShadowRay.SetFootprint(Footprint, 0.0);
+    if (Source.Node)
+    {
+        ShadowRay.PinLevel(Source.Node->GetPrimitive(), Source.Level);
+    }
+    if (Scene->TimeAnyHit(ShadowRay, Time))
     {
         // Hit object between testloc and the light
         return false;
@@ -31,16 +39,16 @@ bool Light::IsVisibleFrom(const SceneContainer* Scene, const Point3D& LightLoc,
     return true;
 }
 
-double Light::GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time)
+double Light::GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source)
 {
-    if (IsVisibleFrom(Scene, position, TestLoc, Time))
+    if (IsVisibleFrom(Scene, position, TestLoc, Time, Footprint, Source))
     {
         return 1.f;
     }
     return 0.f;
 }
 
-double SphereLight::GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time)
+double SphereLight::GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source)
 {
     Vector3D Normal = TestLoc - position;
     Normal.normalize();
@@ -64,7 +72,9 @@ double SphereLight::GetIntensity(const SceneContainer* Scene, const Point3D& Tes
     {
         for (int j = 0; j < 4; j++)
         {
-            if (IsVisibleFrom(Scene, position + i * sin(theta)*u + i * cos(theta)*v, TestLoc, Time))
+            double sinTheta, cosTheta;
+            FastMath::SinCos(theta, sinTheta, cosTheta);
+            if (IsVisibleFrom(Scene, position + i * sinTheta*u + i * cosTheta*v, TestLoc, Time, Footprint, Source))
             {
                 NumVisiblePoints++;
             }
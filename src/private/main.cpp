@@ -1,7 +1,14 @@
+#include <algorithm>
 #include <iostream>
+#include <cstring>
 #include <unistd.h>
 #include "scene_lua.hpp"
 #include "render.hpp"
+#include "mesh.hpp"
+#include "cpudispatch.h"
+#include "approxmath.h"
+#include "PixelQueue.h"
+#include "affinity.h"
 
 int main(int argc, char** argv)
 {
@@ -11,7 +18,7 @@ int main(int argc, char** argv)
   }
 
   int c;
-  while ((c = getopt(argc, argv, ":t:s:oa")) != -1) {
+  while ((c = getopt(argc, argv, ":t:s:oaqp:m:wl:c:fg:r:ek:n")) != -1) {
     switch (c) {
     case 't': // number of render threads
       numThreads = atoi(optarg);
@@ -34,6 +41,89 @@ int main(int argc, char** argv)
         std::cerr << "Can only use one type of anti-aliasing" << std::endl;
         return 1;
       }
+      if (bUseWavefront)
+      {
+        std::cerr << "Adaptive anti-aliasing can't trace a bounce at a time" << std::endl;
+        return 1;
+      }
+      break;
+    case 'q': // trace rays in queues, a bounce at a time
+      bUseWavefront = true;
+      if (bUseAdaptive)
+      {
+        std::cerr << "Adaptive anti-aliasing can't trace a bounce at a time" << std::endl;
+        return 1;
+      }
+      break;
+    case 'p': // trace primary rays in packets
+      PacketSize = atoi(optarg);
+      if (PacketSize != 1 && PacketSize != 4 && PacketSize != 8 && PacketSize != 16) {
+        std::cerr << "Packets must hold 4, 8 or 16 rays, or 1 to trace rays alone" << std::endl;
+        return 1;
+      }
+      break;
+    case 'm': // mesh vertex storage
+      MeshStorageMode.bReport = true;
+      if (strcmp(optarg, "double") == 0) {
+        MeshStorageMode.Format = VertexFormat::Double;
+      } else if (strcmp(optarg, "float") == 0) {
+        MeshStorageMode.Format = VertexFormat::Float;
+      } else if (strcmp(optarg, "q16") == 0) {
+        MeshStorageMode.Format = VertexFormat::Quantized16;
+      } else {
+        std::cerr << "Mesh storage must be one of double, float or q16" << std::endl;
+        return 1;
+      }
+      break;
+    case 'w': // weld mesh vertices
+      MeshStorageMode.bWeld = true;
+      MeshStorageMode.bReport = true;
+      break;
+    case 'l': // mesh detail levels
+      MeshStorageMode.LODLevels = std::max(1, atoi(optarg));
+      MeshStorageMode.bReport = true;
+      break;
+    case 'f': // approximate math in sampling and shading
+      bUseApproxMath = true;
+      break;
+    case 'c': // kernel instruction set
+      if (!SetCpuLevel(optarg)) {
+        std::cerr << "Kernels must be one of generic, sse4.2, avx2 or avx512, and supported by this CPU" << std::endl;
+        return 1;
+      }
+      break;
+    case 'g': // pixel tile size
+      TileMode.Size = std::max(1, atoi(optarg));
+      break;
+    case 'r': // pixel tile order
+      if (strcmp(optarg, "scanline") == 0) {
+        TileMode.Order = TileOrder::Scanline;
+      } else if (strcmp(optarg, "morton") == 0) {
+        TileMode.Order = TileOrder::Morton;
+      } else if (strcmp(optarg, "hilbert") == 0) {
+        TileMode.Order = TileOrder::Hilbert;
+      } else {
+        std::cerr << "Tile order must be one of scanline, morton or hilbert" << std::endl;
+        return 1;
+      }
+      break;
+    case 'e': // render the tiles from the centre out
+      TileMode.bCentreFirst = true;
+      break;
+    case 'k': // pin the worker threads to cores
+      if (strcmp(optarg, "compact") == 0) {
+        AffinityMode.Placement = ThreadPlacement::Compact;
+      } else if (strcmp(optarg, "scatter") == 0) {
+        AffinityMode.Placement = ThreadPlacement::Scatter;
+      } else if (strcmp(optarg, "none") == 0) {
+        AffinityMode.Placement = ThreadPlacement::None;
+      } else {
+        std::cerr << "Thread placement must be one of none, compact or scatter" << std::endl;
+        return 1;
+      }
+      break;
+    case 'n': // copy large meshes to every NUMA node
+      AffinityMode.bReplicate = true;
       break;
     case ':':
       fprintf(stderr,
@@ -45,6 +135,8 @@ int main(int argc, char** argv)
     }
   }
 
+  std::cout << "Using " << GetCpuLevelName(GetCpuLevel()) << " kernels" << std::endl;
+
   if (!run_lua(filename)) {
     std::cerr << "Could not open " << filename << std::endl;
     return 1;
@@ -1,5 +1,7 @@
 #include "material.hpp"
 
+#include "approxmath.h"
+#include "cpudispatch.h"
 #include "light.hpp"
 #include "photonmap.hpp"
 #include "scenecontainer.h"
@@ -22,11 +24,12 @@ PhongMaterial::~PhongMaterial()
 {
 }
 
-Colour PhongMaterial::DoLighting( const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time )
+RT_KERNEL_INLINE Colour PhongMaterial::Shade( const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time ) const
 {
     // Lighting
     // Ambient
     Colour OutCol = ambient * m_kd;
+    const double Footprint = R.HasFootprint() ? R.GetFootprint( ( Hit.Location - R.GetOrigin() ).length() ) : 0.0;
     for ( auto& light : *lights )
     {
         // Caustics
@@ -36,15 +39,16 @@ Colour PhongMaterial::DoLighting( const SceneContainer* Scene, const Ray& R, con
         Colour CausticTotal;
         for ( Photon* P : Photons )
         {
-            CausticTotal = CausticTotal + ( -P->IncidentDir ).dot( Hit.Normal ) * m_kd * P->Power;
+            CausticTotal += ( -P->IncidentDir ).dot( Hit.Normal ) * m_kd * P->Power;
         }
         if ( MaxDist2 > 0 )
         {
-            OutCol = OutCol + CausticTotal / ( M_PI * MaxDist2 );
+            OutCol += CausticTotal / ( M_PI * MaxDist2 );
         }
 
-        // Shadows
-        double LightIntensity = light->GetIntensity( Scene, Hit.Location, Time );
+        // Shadows, traced from off the side of the surface the light is on
+        const Point3D ShadowOrigin = OffsetRayOrigin( Hit.Location, Hit.Normal, light->position - Hit.Location );
+        double LightIntensity = light->GetIntensity( Scene, ShadowOrigin, Time, Footprint, Hit );
         if ( FastMath::IsNearly( LightIntensity, 0.0 ) )
         {
             continue;
@@ -52,7 +56,7 @@ Colour PhongMaterial::DoLighting( const SceneContainer* Scene, const Ray& R, con
 
         // Diffuse
         Vector3D LightDir = light->position - Hit.Location;
-        LightDir.normalize();
+        FastMath::Normalize( LightDir );
         double LdotN = LightDir.dot( Hit.Normal );
         if ( m_kd != Colour( 0, 0, 0 ) )
         {
@@ -61,22 +65,39 @@ Colour PhongMaterial::DoLighting( const SceneContainer* Scene, const Ray& R, con
                 LdotN = 0;
             }
             Colour Diffuse = m_kd * light->colour * LdotN;
-            OutCol = OutCol + LightIntensity * Diffuse;
+            OutCol += LightIntensity * Diffuse;
         }
 
         // Specular
         if ( m_ks != Colour( 0, 0, 0 ) )
         {
             Vector3D TempEye = R.GetOrigin() - Hit.Location;
-            TempEye.normalize();
+            FastMath::Normalize( TempEye );
             Vector3D Reflection = ( ( 2 * LdotN ) * Hit.Normal ) - LightDir;
-            Reflection.normalize();
+            FastMath::Normalize( Reflection );
             double RdotE = Reflection.dot( TempEye );
             if ( RdotE > 0 )
             {
-                OutCol = OutCol + ( light->colour * m_ks * pow( RdotE, m_shininess ) );
+                OutCol += light->colour * m_ks * FastMath::Pow( RdotE, m_shininess );
             }
         }
     }
     return OutCol;
-}
\ No newline at end of file
+}
+
+// A build of the shading per CpuLevel
+#define SHADE_AT( Level, Target ) \
+    template<> Target Colour PhongMaterial::ShadeAt<Level>( const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time ) const \
+    { \
+        return Shade( Scene, R, lights, Hit, ambient, Time ); \
+    }
+RT_FOR_EACH_CPU_LEVEL( SHADE_AT )
+#undef SHADE_AT
+
+Colour PhongMaterial::DoLighting( const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time )
+{
+    return DispatchCpu( [&]( auto Level )
+    {
+        return ShadeAt<decltype( Level )::value>( Scene, R, lights, Hit, ambient, Time );
+    } );
+}
@@ -1,11 +1,409 @@
 #include "mesh.hpp"
+#include "meshcache.h"
+#include "affinity.h"
+#include "bvhinterleave.h"
+#include "cpudispatch.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <iterator>
 #include <limits>
+#include <unordered_map>
 
-Mesh::Mesh(const std::vector<Point3D>& verts, const std::vector<std::vector<int>>& faces) :
-    m_verts(verts),
-    m_faces(faces)
+MeshStorage MeshStorageMode = { VertexFormat::Double, false, 1, false };
+
+namespace
+{
+// Most faces stored in a single BVH leaf
+constexpr uint32_t MaxLeafFaces = 4;
+
+// Nodes over at least this many faces build their halves at the same time
+constexpr uint32_t MinParallelBuildFaces = 1 << 16;
+
+// Meshes with fewer faces than this aren't simplified any further
+constexpr size_t MinLODFaces = 256;
+
+// Most times the grid is doubled looking for each detail level
+constexpr unsigned int MaxLODDoublingsPerLevel = 8;
+
+// A level is used once its error is at most this many ray footprints wide
+constexpr double LODTolerance = 0.5;
+
+// Per face data used while building the BVH
+struct FaceRef
+{
+    BoxF Bounds;
+    Point3D Centroid;
+    uint32_t Face;
+};
+
+BoxF Union(const BoxF& a, const BoxF& b)
+{
+    return BoxF(std::max(a.GetRight(), b.GetRight()), std::min(a.GetLeft(), b.GetLeft()),
+                std::max(a.GetTop(), b.GetTop()), std::min(a.GetBottom(), b.GetBottom()),
+                std::max(a.GetFront(), b.GetFront()), std::min(a.GetBack(), b.GetBack()));
+}
+
+// Recursively split refs[begin, end) on the median centroid of the widest axis
+void BuildNode(std::vector<FaceRef>& refs, uint32_t begin, uint32_t end, std::vector<MeshBVHNode>& nodes)
+{
+    const size_t nodeIndex = nodes.size();
+    nodes.emplace_back();
+
+    BoxF bounds = refs[begin].Bounds;
+    Point3D minCentroid = refs[begin].Centroid;
+    Point3D maxCentroid = refs[begin].Centroid;
+    for (uint32_t i = begin + 1; i < end; ++i)
+    {
+        bounds = Union(bounds, refs[i].Bounds);
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            minCentroid[axis] = std::min(minCentroid[axis], refs[i].Centroid[axis]);
+            maxCentroid[axis] = std::max(maxCentroid[axis], refs[i].Centroid[axis]);
+        }
+    }
+    nodes[nodeIndex].Bounds = bounds;
+
+    if (end - begin <= MaxLeafFaces)
+    {
+        nodes[nodeIndex].Start = begin;
+        nodes[nodeIndex].Count = end - begin;
+        return;
+    }
+
+    const Vector3D extent = maxCentroid - minCentroid;
+    int axis = 0;
+    if (extent[1] > extent[axis])
+    {
+        axis = 1;
+    }
+    if (extent[2] > extent[axis])
+    {
+        axis = 2;
+    }
+
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(refs.begin() + begin, refs.begin() + mid, refs.begin() + end,
+                     [axis](const FaceRef & a, const FaceRef & b)
+    {
+        return a.Centroid[axis] < b.Centroid[axis];
+    });
+
+    if (end - begin < MinParallelBuildFaces)
+    {
+        BuildNode(refs, begin, mid, nodes);
+        nodes[nodeIndex].Start = static_cast<uint32_t>(nodes.size());
+        nodes[nodeIndex].Count = 0;
+        BuildNode(refs, mid, end, nodes);
+        return;
+    }
+
+    // The right half is built into nodes of its own by another task, then moved after the
+    // left's with its children's indices shifted, laying the tree out as a serial build would
+    std::vector<MeshBVHNode> rightNodes;
+    {
+        ThreadPool::TaskGroup rightTask;
+        rightTask.Run([&refs, mid, end, &rightNodes]
+        {
+            BuildNode(refs, mid, end, rightNodes);
+        });
+        BuildNode(refs, begin, mid, nodes);
+        rightTask.Wait();
+    }
+
+    const uint32_t offset = static_cast<uint32_t>(nodes.size());
+    nodes[nodeIndex].Start = offset;
+    nodes[nodeIndex].Count = 0;
+    for (MeshBVHNode& node : rightNodes)
+    {
+        if (node.Count == 0)
+        {
+            node.Start += offset;
+        }
+        nodes.push_back(node);
+    }
+}
+
+size_t GetVertexSize(VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::Double:
+        return 3 * sizeof(double);
+    case VertexFormat::Float:
+        return 3 * sizeof(float);
+    case VertexFormat::Quantized16:
+        return 3 * sizeof(uint16_t);
+    }
+    return 0;
+}
+
+// Vertex fetches for each VertexFormat, so the trace loop is compiled once per format
+struct DoubleVertexReader
+{
+    explicit DoubleVertexReader(const MeshBuffers& Buffers) :
+        P(static_cast<const double*>(Buffers.Positions))
+    {}
+
+    Point3D operator()(uint32_t index) const
+    {
+        const double* V = P + 3 * index;
+        return Point3D(V[0], V[1], V[2]);
+    }
+
+    const double* P;
+};
+
+struct FloatVertexReader
+{
+    explicit FloatVertexReader(const MeshBuffers& Buffers) :
+        P(static_cast<const float*>(Buffers.Positions))
+    {}
+
+    Point3D operator()(uint32_t index) const
+    {
+        const float* V = P + 3 * index;
+        return Point3D(V[0], V[1], V[2]);
+    }
+
+    const float* P;
+};
+
+struct Quantized16VertexReader
+{
+    explicit Quantized16VertexReader(const MeshBuffers& Buffers) :
+        P(static_cast<const uint16_t*>(Buffers.Positions))
+    {
+        std::copy(Buffers.QuantScale, Buffers.QuantScale + 3, Scale);
+        std::copy(Buffers.QuantOffset, Buffers.QuantOffset + 3, Offset);
+    }
+
+    Point3D operator()(uint32_t index) const
+    {
+        const uint16_t* V = P + 3 * index;
+        return Point3D(Offset[0] + V[0] * Scale[0], Offset[1] + V[1] * Scale[1], Offset[2] + V[2] * Scale[2]);
+    }
+
+    const uint16_t* P;
+    double Scale[3];
+    double Offset[3];
+};
+
+// Write P into the 3 components at Out, stored as format
+void EncodeVertex(const Point3D& P, const MeshBuffers& Buffers, unsigned char* Out)
+{
+    switch (Buffers.PositionFormat)
+    {
+    case VertexFormat::Double:
+    {
+        const double V[3] = { P[0], P[1], P[2] };
+        std::memcpy(Out, V, sizeof(V));
+        break;
+    }
+    case VertexFormat::Float:
+    {
+        const float V[3] = { static_cast<float>(P[0]), static_cast<float>(P[1]), static_cast<float>(P[2]) };
+        std::memcpy(Out, V, sizeof(V));
+        break;
+    }
+    case VertexFormat::Quantized16:
+    {
+        uint16_t V[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double q = Buffers.QuantScale[axis] > 0.0 ? (P[axis] - Buffers.QuantOffset[axis]) / Buffers.QuantScale[axis] : 0.0;
+            V[axis] = static_cast<uint16_t>(std::min(65535.0, std::max(0.0, std::round(q))));
+        }
+        std::memcpy(Out, V, sizeof(V));
+        break;
+    }
+    }
+}
+
+template<typename VertexReader, typename IndexType>
+RT_KERNEL_INLINE bool TraceFace(const VertexReader& Verts, const IndexType* F, uint32_t numIndices, const Ray& R, const Point3D& rayOrigin, const Vector3D& rayDir, Scalar& t)
+{
+    if (numIndices <= 2)
+    {
+        return false;
+    }
+
+    const Point3D V0 = Verts(F[0]);
+    Vector3D Norm = cross((Verts(F[1]) - V0), Verts(F[2]) - V0);
+    Norm.normalize();
+    Scalar D = SolveForD(V0, Norm);
+    Scalar S = -(D + (-SolveForD(rayOrigin, Norm))) / (Norm.dot(rayDir));
+    if (!R.InRange(S))
+    {
+        return false;
+    }
+    Vector3D rayAdd = S * rayDir;
+    Point3D rayInt = rayOrigin + rayAdd;
+
+    // Flatten all vectors based on largest normal component
+    int IgnoreIdx = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        if (std::abs(Norm[i]) > std::abs(Norm[(i + 1) % 3]) && std::abs(Norm[i]) > std::abs(Norm[(i + 2) % 3]))
+        {
+            IgnoreIdx = i;
+            break;
+        }
+    }
+
+    // Get projected hit point
+    Point3D ProjHit = rayInt;
+    ProjHit[IgnoreIdx] = 0;
+    for (uint32_t it = 0; it < numIndices; it++)
+    {
+        Point3D L1 = Verts(F[it]);
+        L1[IgnoreIdx] = 0;
+        Point3D L2 = Verts(F[(it + 1) % numIndices]);
+        L2[IgnoreIdx] = 0;
+        Vector3D LDir = L2 - L1;
+        Vector3D Cross = cross(Norm, LDir);
+
+        if ((ProjHit - L1).dot(Cross) <= 0)
+        {
+            return false;
+        }
+    }
+
+    // On the same side of every line
+    t = S;
+    return true;
+}
+
+// Merge the vertices in each cellSize grid cell into their average and drop
+// the triangles that collapse. Faces are fan triangulated.
+void SimplifyMesh(const std::vector<Point3D>& verts, const std::vector<Mesh::Face>& faces, double cellSize,
+                  std::vector<Point3D>& outVerts, std::vector<Mesh::Face>& outFaces)
+{
+    Point3D Min = verts.empty() ? Point3D() : verts[0];
+    for (const Point3D& P : verts)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            Min[axis] = std::min(Min[axis], P[axis]);
+        }
+    }
+
+    // 21 bits per axis
+    const double invCellSize = 1.0 / cellSize;
+    std::unordered_map<uint64_t, uint32_t> Cells;
+    std::vector<uint32_t> cluster(verts.size());
+    std::vector<Vector3D> sums;
+    std::vector<uint32_t> counts;
+    for (size_t i = 0; i < verts.size(); ++i)
+    {
+        uint64_t key = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const uint64_t cell = std::min<uint64_t>(static_cast<uint64_t>((verts[i][axis] - Min[axis]) * invCellSize), (1u << 21) - 1);
+            key = (key << 21) | cell;
+        }
+
+        auto Result = Cells.emplace(key, static_cast<uint32_t>(sums.size()));
+        if (Result.second)
+        {
+            sums.emplace_back();
+            counts.push_back(0);
+        }
+        cluster[i] = Result.first->second;
+        sums[cluster[i]] = sums[cluster[i]] + (verts[i] - Point3D());
+        ++counts[cluster[i]];
+    }
+
+    outVerts.resize(sums.size());
+    for (size_t c = 0; c < sums.size(); ++c)
+    {
+        outVerts[c] = Point3D() + (1.0 / counts[c]) * sums[c];
+    }
+
+    outFaces.clear();
+    for (const Mesh::Face& F : faces)
+    {
+        for (size_t i = 1; i + 1 < F.size(); ++i)
+        {
+            const int a = cluster[F[0]];
+            const int b = cluster[F[i]];
+            const int c = cluster[F[i + 1]];
+            if (a != b && b != c && c != a)
+            {
+                outFaces.push_back(Mesh::Face{ a, b, c });
+            }
+        }
+    }
+}
+
+double GetAverageEdgeLength(const std::vector<Point3D>& verts, const std::vector<Mesh::Face>& faces)
 {
+    double total = 0.0;
+    size_t count = 0;
+    for (const Mesh::Face& F : faces)
+    {
+        for (size_t i = 0; i < F.size(); ++i)
+        {
+            total += (verts[F[(i + 1) % F.size()]] - verts[F[i]]).length();
+        }
+        count += F.size();
+    }
+    return count > 0 ? total / count : 0.0;
+}
+
+// Whether F is a polygon over vertices that exist
+bool IsValidFace(const Mesh::Face& F, size_t numVerts)
+{
+    if (F.size() < 3)
+    {
+        return false;
+    }
+    for (int index : F)
+    {
+        if (index < 0 || static_cast<size_t>(index) >= numVerts)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// faces, or if some aren't valid the rest of them copied into valid
+const std::vector<Mesh::Face>& GetValidFaces(const std::vector<Mesh::Face>& faces, size_t numVerts, std::vector<Mesh::Face>& valid)
+{
+    auto IsBadFace = [numVerts](const Mesh::Face & F)
+    {
+        return !IsValidFace(F, numVerts);
+    };
+    if (std::none_of(faces.begin(), faces.end(), IsBadFace))
+    {
+        return faces;
+    }
+
+    std::remove_copy_if(faces.begin(), faces.end(), std::back_inserter(valid), IsBadFace);
+    std::cerr << "Dropped " << faces.size() - valid.size() << " mesh faces with fewer than 3 vertices or missing ones" << std::endl;
+    return valid;
+}
+
+// Bytes used by one level's buffers
+size_t GetMemoryUsage(const MeshBuffers& Buffers, bool bWithTree)
+{
+    return Buffers.NumVerts * GetVertexSize(Buffers.PositionFormat) +
+           (Buffers.FaceStarts ? (Buffers.NumFaces + 1) * sizeof(uint32_t) : 0) +
+           Buffers.NumIndices * Buffers.IndexSize +
+           (bWithTree ? Buffers.NumNodes * sizeof(MeshBVHNode) : 0);
+}
+} // namespace
+
+Mesh::Mesh(const std::vector<Point3D>& verts, const std::vector<std::vector<int>>& sourceFaces, const MeshStorage& storage)
+{
+    // Faces with no area would give the BVH build nothing, or too little, to bound
+    std::vector<Face> validFaces;
+    const std::vector<Face>& faces = GetValidFaces(sourceFaces, verts.size(), validFaces);
+
     double MaxX, MaxY, MaxZ, MinX, MinY, MinZ;
     MaxX = MaxY = MaxZ = -1000000.0;
     MinX = MinY = MinZ =  1000000.0;
@@ -24,110 +422,626 @@ Mesh::Mesh(const std::vector<Point3D>& verts, const std::vector<std::vector<int>
                                    std::max(std::abs(center[1] - MaxY), std::max(std::abs(center[1] - MinY),
                                             std::max(std::abs(center[2] - MaxZ), std::abs(center[2] - MinZ))))));
     Bounds = BoxF(center[0] + radius, center[0] - radius, center[1] + radius, center[1] - radius, center[2] + radius, center[2] - radius);
+
+    m_uncompactedBytes = verts.size() * sizeof(Point3D) + sourceFaces.size() * sizeof(Face);
+    for (const Face& F : sourceFaces)
+    {
+        m_uncompactedBytes += F.size() * sizeof(int);
+    }
+
+    m_storage.reserve(std::max(1u, storage.LODLevels));
+    m_levels.reserve(std::max(1u, storage.LODLevels));
+    BuildLevel(verts, faces, storage, 0.0);
+
+    // Each level clusters vertices on a grid twice as coarse as the last, no coarser than the
+    // mesh's bounds and with a bounded number of tries at each level
+    double cellSize = GetAverageEdgeLength(verts, faces);
+    const double maxCellSize = 2.0 * radius * std::sqrt(3.0);
+    const unsigned int maxDoublings = storage.LODLevels * MaxLODDoublingsPerLevel;
+    std::vector<Point3D> levelVerts;
+    std::vector<Face> levelFaces;
+    size_t numFaces = faces.size();
+    for (unsigned int doublings = 0; doublings < maxDoublings && m_levels.size() < storage.LODLevels &&
+            numFaces >= MinLODFaces && cellSize > 0.0 && cellSize <= maxCellSize; ++doublings)
+    {
+        cellSize *= 2.0;
+        SimplifyMesh(verts, faces, cellSize, levelVerts, levelFaces);
+
+        // Coarser grids can only collapse more of the faces
+        if (levelFaces.empty())
+        {
+            break;
+        }
+
+        // Not worth a level unless it drops a good share of the faces
+        if (levelFaces.size() > numFaces * 3 / 4)
+        {
+            continue;
+        }
+        BuildLevel(levelVerts, levelFaces, storage, cellSize * std::sqrt(3.0));
+        numFaces = levelFaces.size();
+    }
+    Replicate();
 }
 
-bool Mesh::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+Mesh::Mesh(std::shared_ptr<MeshCache> cache) :
+    m_uncompactedBytes(cache->GetUncompactedMemoryUsage()),
+    m_cache(cache),
+    m_levels(cache->GetLevels())
 {
-    bool ret = false;
-    R.Normalize();
-    Point3D rayOrigin = R.GetOrigin();
-    Vector3D rayDir = R.GetDirection();
+    Bounds = cache->GetBounds();
+    Replicate();
+}
+
+void Mesh::Replicate()
+{
+    const size_t numNodes = GetNumaNodes().size();
+    if (!AffinityMode.bReplicate || numNodes < 2 || GetMemoryUsage() < MinInterleavedBytes)
+    {
+        return;
+    }
 
-    if (CheckIntersection(R, Bounds))
+    // Each copy is written by a thread on its node, which puts its pages there
+    m_replicas.resize(numNodes);
+    RunOnEachNumaNode([this](unsigned int node)
     {
-        for (std::vector<Face>::iterator iter = m_faces.begin(); iter != m_faces.end(); ++iter)
+        Replica& Copy = m_replicas[node];
+        Copy.Storage.resize(m_levels.size());
+        Copy.Levels = m_levels;
+        for (size_t level = 0; level < m_levels.size(); ++level)
         {
-            Face F = *iter;
-            if (F.size() > 2)
+            const MeshBuffers& Source = m_levels[level];
+            LevelStorage& Storage = Copy.Storage[level];
+            MeshBuffers& Buffers = Copy.Levels[level];
+
+            const unsigned char* positions = static_cast<const unsigned char*>(Source.Positions);
+            Storage.Positions.assign(positions, positions + Source.NumVerts * GetVertexSize(Source.PositionFormat));
+            Buffers.Positions = Storage.Positions.data();
+            if (Source.FaceStarts)
             {
-                Vector3D Norm = cross((m_verts[F[1]] - m_verts[F[0]]), m_verts[F[2]] - m_verts[F[0]]);
-                Norm.normalize();
-                double D = SolveForD(m_verts[F[0]], Norm);
-                double S = -(D + (-SolveForD(rayOrigin, Norm))) / (Norm.dot(rayDir));
-                if (S <= 0)
-                {
-                    continue;
-                }
-                Vector3D rayAdd = S * rayDir;
-                Point3D rayInt = rayOrigin + rayAdd;
+                Storage.FaceStarts.assign(Source.FaceStarts, Source.FaceStarts + Source.NumFaces + 1);
+                Buffers.FaceStarts = Storage.FaceStarts.data();
+            }
+            const unsigned char* indices = static_cast<const unsigned char*>(Source.Indices);
+            Storage.Indices.assign(indices, indices + Source.NumIndices * Source.IndexSize);
+            Buffers.Indices = Storage.Indices.data();
+            Storage.Nodes.assign(Source.Nodes, Source.Nodes + Source.NumNodes);
+            Buffers.Nodes = Storage.Nodes.data();
+        }
+    });
+}
 
-                // Flatten all vectors based on largest normal component
-                int IgnoreIdx = 0;
-                for (int i = 0; i < 3; i++)
-                {
-                    if (std::abs(Norm[i]) > std::abs(Norm[(i + 1) % 3]) && std::abs(Norm[i]) > std::abs(Norm[(i + 2) % 3]))
-                    {
-                        IgnoreIdx = i;
-                        break;
-                    }
-                }
+const MeshBuffers& Mesh::GetLocalBuffers(size_t level) const
+{
+    return m_replicas.empty() ? m_levels[level] : m_replicas[GetThreadNumaNode()].Levels[level];
+}
 
-                // Get projected hit point
-                Point3D ProjHit = rayInt;
-                ProjHit[IgnoreIdx] = 0;
-                unsigned int count = 0;
-                for (unsigned int it = 0; it < F.size(); it++)
-                {
-                    Point3D L1 = m_verts[F[it]];
-                    L1[IgnoreIdx] = 0;
-                    Point3D L2 = m_verts[F[(it + 1) % F.size()]];
-                    L2[IgnoreIdx] = 0;
-                    Vector3D LDir = L2 - L1;
-                    Vector3D Cross = cross(Norm, LDir);
-
-                    if ((ProjHit - L1).dot(Cross) > 0)
-                    {
-                        count++;
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
+void Mesh::BuildLevel(const std::vector<Point3D>& verts, const std::vector<Face>& faces, const MeshStorage& storage, double featureSize)
+{
+    m_storage.emplace_back();
+    m_levels.emplace_back();
+    LevelStorage& Storage = m_storage.back();
+    MeshBuffers& Buffers = m_levels.back();
+    Buffers.FeatureSize = featureSize;
+
+    // Encode the positions
+    Buffers.PositionFormat = storage.Format;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double Min = verts.empty() ? 0.0 : verts[0][axis];
+        double Max = Min;
+        for (const Point3D& P : verts)
+        {
+            Min = std::min<double>(Min, P[axis]);
+            Max = std::max<double>(Max, P[axis]);
+        }
+        Buffers.QuantOffset[axis] = Min;
+        Buffers.QuantScale[axis] = (Max - Min) / 65535.0;
+    }
+
+    const size_t vertexSize = GetVertexSize(storage.Format);
+    std::vector<uint32_t> remap(verts.size());
+    Storage.Positions.resize(verts.size() * vertexSize);
+    uint32_t numVerts = 0;
+    if (storage.bWeld)
+    {
+        // Share one copy of every distinct encoded position
+        std::unordered_multimap<uint64_t, uint32_t> Seen;
+        Seen.reserve(verts.size());
+        for (size_t i = 0; i < verts.size(); ++i)
+        {
+            unsigned char* Encoded = Storage.Positions.data() + numVerts * vertexSize;
+            EncodeVertex(verts[i], Buffers, Encoded);
 
-                // On the same side of every line?
-                if (count == F.size())
+            // FNV-1a
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t b = 0; b < vertexSize; ++b)
+            {
+                hash = (hash ^ Encoded[b]) * 1099511628211ull;
+            }
+
+            uint32_t shared = numVerts;
+            auto Range = Seen.equal_range(hash);
+            for (auto Iter = Range.first; Iter != Range.second; ++Iter)
+            {
+                if (std::memcmp(Storage.Positions.data() + Iter->second * vertexSize, Encoded, vertexSize) == 0)
                 {
-                    Point3D WorldRay = M * rayOrigin;
-                    Point3D WorldHit = M * rayInt;
-                    if (clampDist(closestDist, WorldRay, WorldHit, Norm, Hit, M))
-                    {
-                        ret = true;
-                    }
+                    shared = Iter->second;
+                    break;
                 }
             }
+
+            if (shared == numVerts)
+            {
+                Seen.emplace(hash, numVerts++);
+            }
+            remap[i] = shared;
+        }
+        Storage.Positions.resize(numVerts * vertexSize);
+        Storage.Positions.shrink_to_fit();
+    }
+    else
+    {
+        for (size_t i = 0; i < verts.size(); ++i)
+        {
+            EncodeVertex(verts[i], Buffers, Storage.Positions.data() + i * vertexSize);
+            remap[i] = static_cast<uint32_t>(i);
+        }
+        numVerts = static_cast<uint32_t>(verts.size());
+    }
+    Buffers.Positions = Storage.Positions.data();
+    Buffers.NumVerts = numVerts;
+
+    // Flatten the faces
+    std::vector<uint32_t> faceStarts;
+    std::vector<uint32_t> indices;
+    faceStarts.reserve(faces.size() + 1);
+    for (const Face& F : faces)
+    {
+        faceStarts.push_back(static_cast<uint32_t>(indices.size()));
+        for (int index : F)
+        {
+            indices.push_back(remap[index]);
+        }
+    }
+    faceStarts.push_back(static_cast<uint32_t>(indices.size()));
+
+    BuildTree(m_levels.size() - 1, faceStarts, indices);
+
+    // Triangle meshes don't need the face offsets
+    bool bAllTriangles = true;
+    for (size_t face = 0; face + 1 < faceStarts.size(); ++face)
+    {
+        if (faceStarts[face + 1] - faceStarts[face] != 3)
+        {
+            bAllTriangles = false;
+            break;
+        }
+    }
+    if (!bAllTriangles || !storage.IsCompact())
+    {
+        Storage.FaceStarts.swap(faceStarts);
+    }
+
+    // 16-bit indices whenever every vertex can be addressed with them
+    Buffers.IndexSize = (storage.IsCompact() && numVerts <= 65536) ? sizeof(uint16_t) : sizeof(uint32_t);
+    Storage.Indices.resize(indices.size() * Buffers.IndexSize);
+    if (Buffers.IndexSize == sizeof(uint16_t))
+    {
+        uint16_t* Out = reinterpret_cast<uint16_t*>(Storage.Indices.data());
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            Out[i] = static_cast<uint16_t>(indices[i]);
+        }
+    }
+    else
+    {
+        std::memcpy(Storage.Indices.data(), indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    Buffers.FaceStarts = Storage.FaceStarts.empty() ? nullptr : Storage.FaceStarts.data();
+    Buffers.NumFaces = static_cast<uint32_t>(faces.size());
+    Buffers.Indices = Storage.Indices.data();
+    Buffers.NumIndices = static_cast<uint32_t>(indices.size());
+    Buffers.Nodes = Storage.Nodes.data();
+    Buffers.NumNodes = static_cast<uint32_t>(Storage.Nodes.size());
+}
+
+void Mesh::BuildTree(size_t level, std::vector<uint32_t>& faceStarts, std::vector<uint32_t>& indices)
+{
+    const uint32_t numFaces = static_cast<uint32_t>(faceStarts.size() - 1);
+
+    // Faces are bound by their stored positions so quantized meshes stay inside their nodes
+    std::vector<FaceRef> refs(numFaces);
+    for (uint32_t face = 0; face < numFaces; ++face)
+    {
+        FaceRef& Ref = refs[face];
+        Ref.Face = face;
+
+        const Point3D First = GetVert(indices[faceStarts[face]], level);
+        Ref.Bounds = BoxF(First[0], First[0], First[1], First[1], First[2], First[2]);
+        Vector3D Sum;
+        for (uint32_t i = faceStarts[face]; i < faceStarts[face + 1]; ++i)
+        {
+            const Point3D P = GetVert(indices[i], level);
+            Ref.Bounds = Union(Ref.Bounds, BoxF(P[0], P[0], P[1], P[1], P[2], P[2]));
+            Sum += P - Point3D();
+        }
+        const double invCount = 1.0 / (faceStarts[face + 1] - faceStarts[face]);
+        Ref.Centroid = Point3D() + invCount * Sum;
+    }
+
+    std::vector<MeshBVHNode>& Nodes = m_storage[level].Nodes;
+    Nodes.clear();
+    if (numFaces > 0)
+    {
+        Nodes.reserve(2 * (numFaces / MaxLeafFaces + 1));
+        BuildNode(refs, 0, numFaces, Nodes);
+    }
+
+    // Store the faces in leaf order so every leaf is a contiguous range
+    std::vector<uint32_t> orderedStarts;
+    std::vector<uint32_t> orderedIndices;
+    orderedStarts.reserve(faceStarts.size());
+    orderedIndices.reserve(indices.size());
+    for (const FaceRef& Ref : refs)
+    {
+        orderedStarts.push_back(static_cast<uint32_t>(orderedIndices.size()));
+        orderedIndices.insert(orderedIndices.end(), indices.begin() + faceStarts[Ref.Face], indices.begin() + faceStarts[Ref.Face + 1]);
+    }
+    orderedStarts.push_back(static_cast<uint32_t>(orderedIndices.size()));
+    faceStarts.swap(orderedStarts);
+    indices.swap(orderedIndices);
+}
+
+Point3D Mesh::GetVert(uint32_t index, size_t level) const
+{
+    const MeshBuffers& Buffers = m_levels[level];
+    switch (Buffers.PositionFormat)
+    {
+    case VertexFormat::Double:
+        return DoubleVertexReader(Buffers)(index);
+    case VertexFormat::Float:
+        return FloatVertexReader(Buffers)(index);
+    case VertexFormat::Quantized16:
+        return Quantized16VertexReader(Buffers)(index);
+    }
+    return Point3D();
+}
+
+uint32_t Mesh::GetIndex(uint32_t index, size_t level) const
+{
+    const MeshBuffers& Buffers = m_levels[level];
+    if (Buffers.IndexSize == sizeof(uint16_t))
+    {
+        return static_cast<const uint16_t*>(Buffers.Indices)[index];
+    }
+    return static_cast<const uint32_t*>(Buffers.Indices)[index];
+}
+
+size_t Mesh::GetMemoryUsage() const
+{
+    size_t bytes = 0;
+    for (const MeshBuffers& Buffers : m_levels)
+    {
+        bytes += ::GetMemoryUsage(Buffers, true);
+    }
+    return bytes;
+}
+
+void Mesh::PrintMemoryReport(std::ostream& out, const std::string& name) const
+{
+    // The BVH and coarser levels are reported separately, the uncompacted layout has neither
+    const double before = m_uncompactedBytes;
+    const double after = ::GetMemoryUsage(m_levels[0], false);
+    out << "Mesh " << name << ": " << m_levels[0].NumVerts << " verts, " << m_levels[0].NumFaces << " faces, "
+        << before / 1024.0 << " KB -> " << after / 1024.0 << " KB";
+    if (before > 0)
+    {
+        out << " (" << 100.0 * (before - after) / before << "% saved)";
+    }
+    out << " + " << (GetMemoryUsage() - after) / 1024.0 << (m_levels.size() > 1 ? " KB BVH and detail levels of " : " KB BVH");
+    for (size_t level = 1; level < m_levels.size(); ++level)
+    {
+        out << (level == 1 ? "" : ", ") << m_levels[level].NumFaces;
+    }
+    if (m_levels.size() > 1)
+    {
+        out << " faces";
+    }
+    out << std::endl;
+}
+
+size_t Mesh::SelectLevel(const Ray& R) const
+{
+    if (R.GetPinnedPrimitive() == static_cast<const Primitive*>(this))
+    {
+        return std::min<size_t>(R.GetPinnedLevel(), m_levels.size() - 1);
+    }
+    if (m_levels.size() == 1 || !R.HasFootprint())
+    {
+        return 0;
+    }
+
+    // Measure the footprint where the ray reaches the full mesh
+    AABIntersectData<Scalar> data;
+    DoIntersect(R, m_levels[0].Nodes[0].Bounds, data);
+    const Scalar footprint = R.GetFootprint(std::max(Scalar(0), data.tMin)) * LODTolerance;
+
+    size_t level = 0;
+    while (level + 1 < m_levels.size() && m_levels[level + 1].FeatureSize <= footprint)
+    {
+        ++level;
+    }
+    return level;
+}
+
+RT_KERNEL_INLINE bool Mesh::TraceLevel(Ray& R, HitInfo& Hit) const
+{
+    R.Normalize();
+
+    if (m_levels[0].NumNodes == 0 || !CheckIntersection(R, Bounds))
+    {
+        return false;
+    }
+
+    const size_t level = SelectLevel(R);
+    const MeshBuffers& Buffers = GetLocalBuffers(level);
+    const bool bShortIndices = Buffers.IndexSize == sizeof(uint16_t);
+    const uint16_t* ShortIndices = static_cast<const uint16_t*>(Buffers.Indices);
+    const uint32_t* LongIndices = static_cast<const uint32_t*>(Buffers.Indices);
+    bool bHit = false;
+    switch (Buffers.PositionFormat)
+    {
+    case VertexFormat::Double:
+        bHit = bShortIndices ? TraceTree(Buffers, DoubleVertexReader(Buffers), ShortIndices, R, Hit)
+               : TraceTree(Buffers, DoubleVertexReader(Buffers), LongIndices, R, Hit);
+        break;
+    case VertexFormat::Float:
+        bHit = bShortIndices ? TraceTree(Buffers, FloatVertexReader(Buffers), ShortIndices, R, Hit)
+               : TraceTree(Buffers, FloatVertexReader(Buffers), LongIndices, R, Hit);
+        break;
+    case VertexFormat::Quantized16:
+        bHit = bShortIndices ? TraceTree(Buffers, Quantized16VertexReader(Buffers), ShortIndices, R, Hit)
+               : TraceTree(Buffers, Quantized16VertexReader(Buffers), LongIndices, R, Hit);
+        break;
+    }
+
+    if (bHit)
+    {
+        Hit.Level = static_cast<uint32_t>(level);
+    }
+    return bHit;
+}
+
+RT_KERNEL_INLINE void Mesh::TraceLevelsInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const
+{
+    if (::GetMemoryUsage(m_levels[0], true) < MinInterleavedBytes)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            bHits[i] = TraceLevel(Rays[i], *Hits[i]);
+        }
+        return;
+    }
+
+    // Each ray is traced along with the others that picked the same detail level
+    size_t Levels[MaxInterleavedRays];
+    for (size_t i = 0; i < Count; ++i)
+    {
+        bHits[i] = false;
+        Rays[i].Normalize();
+        const bool bMiss = m_levels[0].NumNodes == 0 || !CheckIntersection(Rays[i], Bounds);
+        Levels[i] = bMiss ? m_levels.size() : SelectLevel(Rays[i]);
+    }
+
+    for (size_t level = 0; level < m_levels.size(); ++level)
+    {
+        Ray* LevelRays[MaxInterleavedRays];
+        HitInfo* LevelHits[MaxInterleavedRays];
+        bool bLevelHits[MaxInterleavedRays];
+        size_t Slots[MaxInterleavedRays];
+        size_t num = 0;
+        for (size_t i = 0; i < Count; ++i)
+        {
+            if (Levels[i] == level)
+            {
+                LevelRays[num] = &Rays[i];
+                LevelHits[num] = Hits[i];
+                Slots[num++] = i;
+            }
+        }
+        if (num == 0)
+        {
+            continue;
+        }
+
+        const MeshBuffers& Buffers = GetLocalBuffers(level);
+        const bool bShortIndices = Buffers.IndexSize == sizeof(uint16_t);
+        const uint16_t* ShortIndices = static_cast<const uint16_t*>(Buffers.Indices);
+        const uint32_t* LongIndices = static_cast<const uint32_t*>(Buffers.Indices);
+        bool bHit = false;
+        switch (Buffers.PositionFormat)
+        {
+        case VertexFormat::Double:
+            bHit = bShortIndices ? TraceTreeInterleaved(Buffers, DoubleVertexReader(Buffers), ShortIndices, LevelRays, LevelHits, bLevelHits, num)
+                   : TraceTreeInterleaved(Buffers, DoubleVertexReader(Buffers), LongIndices, LevelRays, LevelHits, bLevelHits, num);
+            break;
+        case VertexFormat::Float:
+            bHit = bShortIndices ? TraceTreeInterleaved(Buffers, FloatVertexReader(Buffers), ShortIndices, LevelRays, LevelHits, bLevelHits, num)
+                   : TraceTreeInterleaved(Buffers, FloatVertexReader(Buffers), LongIndices, LevelRays, LevelHits, bLevelHits, num);
+            break;
+        case VertexFormat::Quantized16:
+            bHit = bShortIndices ? TraceTreeInterleaved(Buffers, Quantized16VertexReader(Buffers), ShortIndices, LevelRays, LevelHits, bLevelHits, num)
+                   : TraceTreeInterleaved(Buffers, Quantized16VertexReader(Buffers), LongIndices, LevelRays, LevelHits, bLevelHits, num);
+            break;
+        }
+
+        for (size_t i = 0; bHit && i < num; ++i)
+        {
+            if (bLevelHits[i])
+            {
+                bHits[Slots[i]] = true;
+                Hits[Slots[i]]->Level = static_cast<uint32_t>(level);
+            }
         }
     }
+}
+
+// A build of the whole trace per CpuLevel
+#define DEPTH_TRACE_AT(Level, Target) \
+    template<> Target bool Mesh::DepthTraceAt<Level>(Ray& R, HitInfo& Hit) const \
+    { \
+        return TraceLevel(R, Hit); \
+    } \
+    template<> Target void Mesh::DepthTraceInterleavedAt<Level>(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const \
+    { \
+        TraceLevelsInterleaved(Rays, Hits, bHits, Count); \
+    }
+RT_FOR_EACH_CPU_LEVEL(DEPTH_TRACE_AT)
+#undef DEPTH_TRACE_AT
+
+bool Mesh::DepthTrace(Ray& R, HitInfo& Hit)
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return DepthTraceAt<decltype(Level)::value>(R, Hit);
+    });
+}
+
+void Mesh::DepthTraceInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const
+{
+    // The rays are sorted by detail level into buffers of this size
+    assert(Count <= MaxInterleavedRays);
+    DispatchCpu([&](auto Level)
+    {
+        DepthTraceInterleavedAt<decltype(Level)::value>(Rays, Hits, bHits, Count);
+    });
+}
+
+void Mesh::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    const MeshBuffers& Buffers = m_levels[Hit.Level];
+    const uint32_t start = Buffers.FaceStarts ? Buffers.FaceStarts[Hit.PrimID] : 3 * Hit.PrimID;
+    const Point3D V0 = GetVert(GetIndex(start, Hit.Level), Hit.Level);
+    const Point3D V1 = GetVert(GetIndex(start + 1, Hit.Level), Hit.Level);
+    const Point3D V2 = GetVert(GetIndex(start + 2, Hit.Level), Hit.Level);
+
+    Location = Hit.ObjectLocation();
+    Normal = cross(V1 - V0, V2 - V0);
+    Normal.normalize();
+}
+
+template<typename VertexReader, typename IndexType>
+RT_KERNEL_INLINE bool Mesh::TraceTree(const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices, Ray& R, HitInfo& Hit) const
+{
+    bool ret = false;
+    const Point3D rayOrigin = R.GetOrigin();
+    const Vector3D rayDir = R.GetDirection();
+
+    // Median splits keep the tree depth well below the stack size
+    uint32_t stack[64];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const uint32_t nodeIndex = stack[--stackSize];
+        const MeshBVHNode& Node = Buffers.Nodes[nodeIndex];
+
+        // Also skips nodes beyond the closest hit so far
+        if (!CheckIntersection(R, Node.Bounds))
+        {
+            continue;
+        }
+
+        if (Node.Count > 0)
+        {
+            if (TraceLeaf(Node, Buffers, Verts, Indices, R, rayOrigin, rayDir, Hit))
+            {
+                ret = true;
+            }
+        }
+        else
+        {
+            stack[stackSize++] = Node.Start;
+            stack[stackSize++] = nodeIndex + 1;
+        }
+    }
+    return ret;
+}
+
+template<typename VertexReader, typename IndexType>
+RT_KERNEL_INLINE bool Mesh::TraceLeaf(const MeshBVHNode& Node, const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices,
+                                      Ray& R, const Point3D& rayOrigin, const Vector3D& rayDir, HitInfo& Hit) const
+{
+    bool ret = false;
+    for (uint32_t face = Node.Start; face < Node.Start + Node.Count; ++face)
+    {
+        const uint32_t start = Buffers.FaceStarts ? Buffers.FaceStarts[face] : 3 * face;
+        const uint32_t count = Buffers.FaceStarts ? Buffers.FaceStarts[face + 1] - start : 3;
+        Scalar t;
+        if (TraceFace(Verts, Indices + start, count, R, rayOrigin, rayDir, t) && RecordHit(R, t, face, Hit))
+        {
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+template<typename VertexReader, typename IndexType>
+RT_KERNEL_INLINE bool Mesh::TraceTreeInterleaved(const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices,
+                                                 Ray* Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const
+{
+    bool ret = false;
+    std::fill(bHits, bHits + Count, false);
+    TraceInterleaved(Buffers.Nodes, Rays, Count, [&](const MeshBVHNode& Node) RT_KERNEL_LAMBDA
+    {
+        // The vertices are only known once the indices arrive
+        const uint32_t start = Buffers.FaceStarts ? Buffers.FaceStarts[Node.Start] : 3 * Node.Start;
+        RT_PREFETCH(Indices + start);
+    },
+    [&](size_t i, const MeshBVHNode& Node) RT_KERNEL_LAMBDA
+    {
+        Ray& R = *Rays[i];
+        if (TraceLeaf(Node, Buffers, Verts, Indices, R, R.GetOrigin(), R.GetDirection(), *Hits[i]))
+        {
+            bHits[i] = true;
+            ret = true;
+        }
+    });
     return ret;
 }
 
 std::ostream& operator<<(std::ostream& out, const Mesh& mesh)
 {
+    const MeshBuffers& Buffers = mesh.GetBuffers();
     std::cerr << "mesh({";
-    for (std::vector<Point3D>::const_iterator I = mesh.m_verts.begin(); I != mesh.m_verts.end(); ++I)
+    for (uint32_t I = 0; I < Buffers.NumVerts; ++I)
     {
-        if (I != mesh.m_verts.begin())
+        if (I != 0)
         {
             std::cerr << ",\n      ";
         }
-        std::cerr << *I;
+        std::cerr << mesh.GetVert(I);
     }
     std::cerr << "},\n\n     {";
 
-    for (std::vector<Mesh::Face>::const_iterator I = mesh.m_faces.begin(); I != mesh.m_faces.end(); ++I)
+    for (uint32_t I = 0; I < Buffers.NumFaces; ++I)
     {
-        if (I != mesh.m_faces.begin())
+        if (I != 0)
         {
             std::cerr << ",\n      ";
         }
+        const uint32_t start = Buffers.FaceStarts ? Buffers.FaceStarts[I] : 3 * I;
+        const uint32_t end = Buffers.FaceStarts ? Buffers.FaceStarts[I + 1] : start + 3;
         std::cerr << "[";
-        for (Mesh::Face::const_iterator J = I->begin(); J != I->end(); ++J)
+        for (uint32_t J = start; J != end; ++J)
         {
-            if (J != I->begin())
+            if (J != start)
             {
                 std::cerr << ", ";
             }
-            std::cerr << *J;
+            std::cerr << mesh.GetIndex(J);
         }
         std::cerr << "]";
     }
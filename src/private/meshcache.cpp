@@ -0,0 +1,422 @@
+#include "meshcache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const char CacheMagic[4] = {'R', 'T', 'M', 'C'};
+constexpr uint32_t CacheVersion = 5;
+
+// Every buffer starts on a cache line
+constexpr size_t SectionAlignment = 64;
+
+// Bytes hashed at each end of a source file for its stamp
+constexpr size_t SourceEndBytes = 4096;
+
+// Deepest BVH a cache may hold, traversals keep a stack of 64 nodes
+constexpr uint32_t MaxTreeDepth = 60;
+
+// Buffers are mapped as-is so their layout is part of the file format
+static_assert(sizeof(MeshBVHNode) == 6 * sizeof(Scalar) + 2 * sizeof(uint32_t), "Unexpected MeshBVHNode padding");
+
+struct CacheHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint64_t SourceSize;
+    int64_t SourceTime;
+    uint64_t SourceEndsHash;
+    uint8_t PositionFormat;     // VertexFormat
+    uint8_t bWelded;
+    uint8_t ScalarSize;         // The BVH is stored in the build's Scalar
+    uint8_t Padding;
+    uint32_t LODLevels;         // Levels that were asked for, NumLevels can be fewer
+    uint32_t NumLevels;
+    uint32_t Padding2;
+    uint64_t UncompactedBytes;
+    double Bounds[6];   // right, left, top, bottom, front, back
+};
+
+// Follows the header once per level
+struct CacheLevel
+{
+    uint32_t NumVerts;
+    uint32_t NumFaces;
+    uint32_t NumIndices;
+    uint32_t NumNodes;
+    uint8_t bHasFaceStarts;
+    uint8_t IndexSize;
+    uint16_t Padding;
+    uint32_t Padding2;
+    double QuantScale[3];
+    double QuantOffset[3];
+    double FeatureSize;
+};
+
+// Byte offsets of each buffer of a level within a cache file
+struct CacheLayout
+{
+    size_t Positions;
+    size_t FaceStarts;
+    size_t Indices;
+    size_t Nodes;
+    size_t End;
+};
+
+inline size_t Align(size_t offset)
+{
+    return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+}
+
+size_t GetVertexSize(const CacheHeader& Header)
+{
+    switch (static_cast<VertexFormat>(Header.PositionFormat))
+    {
+    case VertexFormat::Double:
+        return 3 * sizeof(double);
+    case VertexFormat::Float:
+        return 3 * sizeof(float);
+    case VertexFormat::Quantized16:
+        return 3 * sizeof(uint16_t);
+    }
+    return 0;
+}
+
+// Layout of the level whose buffers start after offset
+CacheLayout GetLayout(const CacheHeader& Header, const CacheLevel& Level, size_t offset)
+{
+    CacheLayout Layout;
+    Layout.Positions = Align(offset);
+    Layout.FaceStarts = Align(Layout.Positions + GetVertexSize(Header) * Level.NumVerts);
+    Layout.Indices = Align(Layout.FaceStarts + (Level.bHasFaceStarts ? sizeof(uint32_t) * (Level.NumFaces + 1) : 0));
+    Layout.Nodes = Align(Layout.Indices + Level.IndexSize * Level.NumIndices);
+    Layout.End = Layout.Nodes + sizeof(MeshBVHNode) * Level.NumNodes;
+    return Layout;
+}
+
+// Layouts of every level in a cache
+std::vector<CacheLayout> GetLayouts(const CacheHeader& Header, const CacheLevel* Levels)
+{
+    std::vector<CacheLayout> Layouts;
+    size_t offset = sizeof(CacheHeader) + Header.NumLevels * sizeof(CacheLevel);
+    for (uint32_t level = 0; level < Header.NumLevels; ++level)
+    {
+        Layouts.push_back(GetLayout(Header, Levels[level], offset));
+        offset = Layouts.back().End;
+    }
+    return Layouts;
+}
+
+// Whether the faces, indices and BVH of a mapped level stay within its buffers, so that a
+// damaged cache is rebuilt instead of sending traces outside them
+bool IsLevelInRange(const MeshBuffers& Buffers)
+{
+    if (Buffers.IndexSize != sizeof(uint16_t) && Buffers.IndexSize != sizeof(uint32_t))
+    {
+        return false;
+    }
+
+    // Faces are polygons that use up the indices in order
+    if (Buffers.FaceStarts)
+    {
+        if (Buffers.FaceStarts[0] != 0 || Buffers.FaceStarts[Buffers.NumFaces] != Buffers.NumIndices)
+        {
+            return false;
+        }
+        for (uint32_t face = 0; face < Buffers.NumFaces; ++face)
+        {
+            if (Buffers.FaceStarts[face + 1] < Buffers.FaceStarts[face] ||
+                Buffers.FaceStarts[face + 1] - Buffers.FaceStarts[face] < 3)
+            {
+                return false;
+            }
+        }
+    }
+    else if (uint64_t(Buffers.NumFaces) * 3 != Buffers.NumIndices)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < Buffers.NumIndices; ++i)
+    {
+        const uint32_t index = Buffers.IndexSize == sizeof(uint16_t) ? static_cast<const uint16_t*>(Buffers.Indices)[i]
+                               : static_cast<const uint32_t*>(Buffers.Indices)[i];
+        if (index >= Buffers.NumVerts)
+        {
+            return false;
+        }
+    }
+
+    // Leaves hold existing faces, and children follow their parent no deeper than a
+    // traversal's stack
+    std::vector<uint32_t> depth(Buffers.NumNodes, 0);
+    for (uint32_t nodeIndex = 0; nodeIndex < Buffers.NumNodes; ++nodeIndex)
+    {
+        const MeshBVHNode& Node = Buffers.Nodes[nodeIndex];
+        if (Node.Count > 0)
+        {
+            if (uint64_t(Node.Start) + Node.Count > Buffers.NumFaces)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if (Node.Start <= nodeIndex + 1 || Node.Start >= Buffers.NumNodes || depth[nodeIndex] >= MaxTreeDepth)
+        {
+            return false;
+        }
+        depth[nodeIndex + 1] = std::max(depth[nodeIndex + 1], depth[nodeIndex] + 1);
+        depth[Node.Start] = std::max(depth[Node.Start], depth[nodeIndex] + 1);
+    }
+    return true;
+}
+
+void WritePadding(std::ofstream& out, size_t offset)
+{
+    static const char Zeros[SectionAlignment] = {};
+    const size_t current = static_cast<size_t>(out.tellp());
+    out.write(Zeros, offset - current);
+}
+
+// FNV-1a over count bytes, continuing from hash
+uint64_t HashBytes(const char* bytes, size_t count, uint64_t hash)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        hash = (hash ^ static_cast<unsigned char>(bytes[i])) * 1099511628211ULL;
+    }
+    return hash;
+}
+} // namespace
+
+bool GetMeshSourceStamp(const std::string& path, MeshSourceStamp& stamp)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return false;
+    }
+    stamp.Size = static_cast<uint64_t>(info.st_size);
+#ifdef __APPLE__
+    const struct timespec& modified = info.st_mtimespec;
+#else
+    const struct timespec& modified = info.st_mtim;
+#endif
+    stamp.ModifiedTime = static_cast<int64_t>(modified.tv_sec) * 1000000000 + modified.tv_nsec;
+
+    // A file rewritten to the same size within the file system's time resolution
+    // still differs in its header or its last lines
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    char bytes[SourceEndBytes];
+    in.read(bytes, SourceEndBytes);
+    stamp.EndsHash = HashBytes(bytes, static_cast<size_t>(in.gcount()), 14695981039346656037ULL);
+    if (stamp.Size > SourceEndBytes)
+    {
+        in.clear();
+        in.seekg(-static_cast<std::streamoff>(std::min<uint64_t>(stamp.Size - SourceEndBytes, SourceEndBytes)), std::ios::end);
+        in.read(bytes, SourceEndBytes);
+        stamp.EndsHash = HashBytes(bytes, static_cast<size_t>(in.gcount()), stamp.EndsHash);
+    }
+    return true;
+}
+
+MeshCache::MeshCache(void* data, size_t size) :
+    m_data(data),
+    m_size(size)
+{
+    const CacheHeader* Header = static_cast<const CacheHeader*>(m_data);
+    const CacheLevel* Levels = reinterpret_cast<const CacheLevel*>(Header + 1);
+    const std::vector<CacheLayout> Layouts = GetLayouts(*Header, Levels);
+    const char* Base = static_cast<const char*>(m_data);
+
+    m_levels.resize(Header->NumLevels);
+    for (uint32_t level = 0; level < Header->NumLevels; ++level)
+    {
+        const CacheLevel& Level = Levels[level];
+        const CacheLayout& Layout = Layouts[level];
+        MeshBuffers& Buffers = m_levels[level];
+        Buffers.Positions = Base + Layout.Positions;
+        Buffers.PositionFormat = static_cast<VertexFormat>(Header->PositionFormat);
+        std::copy(Level.QuantScale, Level.QuantScale + 3, Buffers.QuantScale);
+        std::copy(Level.QuantOffset, Level.QuantOffset + 3, Buffers.QuantOffset);
+        Buffers.NumVerts = Level.NumVerts;
+        Buffers.FaceStarts = Level.bHasFaceStarts ? reinterpret_cast<const uint32_t*>(Base + Layout.FaceStarts) : nullptr;
+        Buffers.NumFaces = Level.NumFaces;
+        Buffers.Indices = Base + Layout.Indices;
+        Buffers.IndexSize = Level.IndexSize;
+        Buffers.NumIndices = Level.NumIndices;
+        Buffers.Nodes = reinterpret_cast<const MeshBVHNode*>(Base + Layout.Nodes);
+        Buffers.NumNodes = Level.NumNodes;
+        Buffers.FeatureSize = Level.FeatureSize;
+    }
+
+    const double* B = Header->Bounds;
+    m_bounds = BoxF(B[0], B[1], B[2], B[3], B[4], B[5]);
+}
+
+uint64_t MeshCache::GetUncompactedMemoryUsage() const
+{
+    return static_cast<const CacheHeader*>(m_data)->UncompactedBytes;
+}
+
+MeshCache::~MeshCache()
+{
+    munmap(m_data, m_size);
+}
+
+std::shared_ptr<MeshCache> MeshCache::Open(const std::string& path, const MeshSourceStamp& stamp, const MeshStorage& storage)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(CacheHeader))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    const size_t size = static_cast<size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    const CacheHeader* Header = static_cast<const CacheHeader*>(data);
+    bool bValid = std::memcmp(Header->Magic, CacheMagic, sizeof(CacheMagic)) == 0 &&
+                  Header->Version == CacheVersion &&
+                  Header->SourceSize == stamp.Size &&
+                  Header->SourceTime == stamp.ModifiedTime &&
+                  Header->SourceEndsHash == stamp.EndsHash &&
+                  Header->PositionFormat == static_cast<uint8_t>(storage.Format) &&
+                  Header->bWelded == static_cast<uint8_t>(storage.bWeld) &&
+                  Header->ScalarSize == sizeof(Scalar) &&
+                  Header->LODLevels == storage.LODLevels &&
+                  Header->NumLevels > 0 &&
+                  sizeof(CacheHeader) + Header->NumLevels * sizeof(CacheLevel) <= size;
+    if (bValid)
+    {
+        const CacheLevel* Levels = reinterpret_cast<const CacheLevel*>(Header + 1);
+        bValid = GetLayouts(*Header, Levels).back().End <= size;
+    }
+
+    if (!bValid)
+    {
+        munmap(data, size);
+        return nullptr;
+    }
+
+    // Unmaps the file again if it's rejected
+    std::shared_ptr<MeshCache> Cache(new MeshCache(data, size));
+    for (const MeshBuffers& Buffers : Cache->GetLevels())
+    {
+        if (!IsLevelInRange(Buffers))
+        {
+            return nullptr;
+        }
+    }
+    return Cache;
+}
+
+bool MeshCache::Write(const std::string& path, const MeshSourceStamp& stamp, const Mesh& mesh, const MeshStorage& storage)
+{
+    const BoxF Bounds = mesh.GetBox();
+
+    CacheHeader Header;
+    std::memset(&Header, 0, sizeof(Header));
+    std::memcpy(Header.Magic, CacheMagic, sizeof(CacheMagic));
+    Header.Version = CacheVersion;
+    Header.SourceSize = stamp.Size;
+    Header.SourceTime = stamp.ModifiedTime;
+    Header.SourceEndsHash = stamp.EndsHash;
+    Header.PositionFormat = static_cast<uint8_t>(mesh.GetBuffers().PositionFormat);
+    Header.bWelded = static_cast<uint8_t>(storage.bWeld);
+    Header.ScalarSize = sizeof(Scalar);
+    Header.LODLevels = storage.LODLevels;
+    Header.NumLevels = static_cast<uint32_t>(mesh.GetNumLevels());
+    Header.UncompactedBytes = mesh.GetUncompactedMemoryUsage();
+    Header.Bounds[0] = Bounds.GetRight();
+    Header.Bounds[1] = Bounds.GetLeft();
+    Header.Bounds[2] = Bounds.GetTop();
+    Header.Bounds[3] = Bounds.GetBottom();
+    Header.Bounds[4] = Bounds.GetFront();
+    Header.Bounds[5] = Bounds.GetBack();
+
+    std::vector<CacheLevel> Levels(Header.NumLevels);
+    for (uint32_t level = 0; level < Header.NumLevels; ++level)
+    {
+        const MeshBuffers& Buffers = mesh.GetBuffers(level);
+        CacheLevel& Level = Levels[level];
+        std::memset(&Level, 0, sizeof(Level));
+        Level.NumVerts = Buffers.NumVerts;
+        Level.NumFaces = Buffers.NumFaces;
+        Level.NumIndices = Buffers.NumIndices;
+        Level.NumNodes = Buffers.NumNodes;
+        Level.bHasFaceStarts = Buffers.FaceStarts != nullptr;
+        Level.IndexSize = static_cast<uint8_t>(Buffers.IndexSize);
+        std::copy(Buffers.QuantScale, Buffers.QuantScale + 3, Level.QuantScale);
+        std::copy(Buffers.QuantOffset, Buffers.QuantOffset + 3, Level.QuantOffset);
+        Level.FeatureSize = Buffers.FeatureSize;
+    }
+    const std::vector<CacheLayout> Layouts = GetLayouts(Header, Levels.data());
+
+    // Write next to the final path and rename so a partial cache is never mapped
+    const std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+
+        out.write(reinterpret_cast<const char*>(&Header), sizeof(Header));
+        out.write(reinterpret_cast<const char*>(Levels.data()), sizeof(CacheLevel) * Levels.size());
+        for (uint32_t level = 0; level < Header.NumLevels; ++level)
+        {
+            const MeshBuffers& Buffers = mesh.GetBuffers(level);
+            const CacheLayout& Layout = Layouts[level];
+            WritePadding(out, Layout.Positions);
+            out.write(static_cast<const char*>(Buffers.Positions), GetVertexSize(Header) * Buffers.NumVerts);
+            WritePadding(out, Layout.FaceStarts);
+            if (Buffers.FaceStarts)
+            {
+                out.write(reinterpret_cast<const char*>(Buffers.FaceStarts), sizeof(uint32_t) * (Buffers.NumFaces + 1));
+            }
+            WritePadding(out, Layout.Indices);
+            out.write(static_cast<const char*>(Buffers.Indices), Buffers.IndexSize * Buffers.NumIndices);
+            WritePadding(out, Layout.Nodes);
+            out.write(reinterpret_cast<const char*>(Buffers.Nodes), sizeof(MeshBVHNode) * Buffers.NumNodes);
+        }
+
+        if (!out)
+        {
+            out.close();
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+    {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,390 @@
+#include "meshfile.h"
+#include "meshcache.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace
+{
+bool EndsWith(const std::string& str, const std::string& suffix)
+{
+    if (suffix.size() > str.size())
+    {
+        return false;
+    }
+    for (size_t i = 0; i < suffix.size(); ++i)
+    {
+        if (std::tolower(str[str.size() - suffix.size() + i]) != suffix[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Convert a 1-based (or negative, relative) OBJ index to a 0-based one
+int ResolveObjIndex(long index, size_t numVerts)
+{
+    return static_cast<int>(index < 0 ? static_cast<long>(numVerts) + index : index - 1);
+}
+
+bool ReadObj(const std::string& filename, std::vector<Point3D>& verts, std::vector<Mesh::Face>& faces)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        return false;
+    }
+    const std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    const char* cur = contents.c_str();
+    const char* end = cur + contents.size();
+    while (cur < end)
+    {
+        const char* lineEnd = static_cast<const char*>(std::memchr(cur, '\n', end - cur));
+        if (!lineEnd)
+        {
+            lineEnd = end;
+        }
+
+        while (cur < lineEnd && (*cur == ' ' || *cur == '\t'))
+        {
+            ++cur;
+        }
+
+        if (lineEnd - cur > 2 && cur[0] == 'v' && (cur[1] == ' ' || cur[1] == '\t'))
+        {
+            char* next = const_cast<char*>(cur + 2);
+            const double x = std::strtod(next, &next);
+            const double y = std::strtod(next, &next);
+            const double z = std::strtod(next, &next);
+            verts.emplace_back(x, y, z);
+        }
+        else if (lineEnd - cur > 2 && cur[0] == 'f' && (cur[1] == ' ' || cur[1] == '\t'))
+        {
+            Mesh::Face face;
+            char* next = const_cast<char*>(cur + 2);
+            while (next < lineEnd)
+            {
+                char* numEnd;
+                const long index = std::strtol(next, &numEnd, 10);
+                if (numEnd == next)
+                {
+                    break;
+                }
+                face.push_back(ResolveObjIndex(index, verts.size()));
+
+                // Skip texture coordinate and normal indices
+                next = numEnd;
+                while (next < lineEnd && *next != ' ' && *next != '\t')
+                {
+                    ++next;
+                }
+            }
+            faces.push_back(face);
+        }
+
+        cur = lineEnd + 1;
+    }
+    return true;
+}
+
+// Property types that can appear in a PLY header
+enum class PlyType
+{
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64,
+    Invalid
+};
+
+PlyType ParsePlyType(const std::string& name)
+{
+    if (name == "char" || name == "int8")
+    {
+        return PlyType::Int8;
+    }
+    if (name == "uchar" || name == "uint8")
+    {
+        return PlyType::UInt8;
+    }
+    if (name == "short" || name == "int16")
+    {
+        return PlyType::Int16;
+    }
+    if (name == "ushort" || name == "uint16")
+    {
+        return PlyType::UInt16;
+    }
+    if (name == "int" || name == "int32")
+    {
+        return PlyType::Int32;
+    }
+    if (name == "uint" || name == "uint32")
+    {
+        return PlyType::UInt32;
+    }
+    if (name == "float" || name == "float32")
+    {
+        return PlyType::Float32;
+    }
+    if (name == "double" || name == "float64")
+    {
+        return PlyType::Float64;
+    }
+    return PlyType::Invalid;
+}
+
+struct PlyProperty
+{
+    std::string Name;
+    PlyType Type;
+    PlyType CountType;  // Invalid unless this is a list
+};
+
+struct PlyElement
+{
+    std::string Name;
+    size_t Count;
+    std::vector<PlyProperty> Properties;
+};
+
+// Reads PLY values from either the ascii or the binary_little_endian encoding
+class PlyReader
+{
+public:
+    PlyReader(std::istream& in, bool binary) :
+        m_in(in),
+        m_binary(binary)
+    {}
+
+    bool Read(PlyType type, double& value)
+    {
+        if (!m_binary)
+        {
+            return static_cast<bool>(m_in >> value);
+        }
+
+        switch (type)
+        {
+        case PlyType::Int8:
+            return ReadBinary<int8_t>(value);
+        case PlyType::UInt8:
+            return ReadBinary<uint8_t>(value);
+        case PlyType::Int16:
+            return ReadBinary<int16_t>(value);
+        case PlyType::UInt16:
+            return ReadBinary<uint16_t>(value);
+        case PlyType::Int32:
+            return ReadBinary<int32_t>(value);
+        case PlyType::UInt32:
+            return ReadBinary<uint32_t>(value);
+        case PlyType::Float32:
+            return ReadBinary<float>(value);
+        case PlyType::Float64:
+            return ReadBinary<double>(value);
+        case PlyType::Invalid:
+            break;
+        }
+        return false;
+    }
+
+private:
+    template<typename T>
+    bool ReadBinary(double& value)
+    {
+        T raw;
+        if (!m_in.read(reinterpret_cast<char*>(&raw), sizeof(T)))
+        {
+            return false;
+        }
+        value = static_cast<double>(raw);
+        return true;
+    }
+
+    std::istream& m_in;
+    bool m_binary;
+};
+
+bool ReadPly(const std::string& filename, std::vector<Point3D>& verts, std::vector<Mesh::Face>& faces)
+{
+    std::ifstream in(filename, std::ios::binary);
+    std::string line;
+    if (!in || !std::getline(in, line) || line.compare(0, 3, "ply") != 0)
+    {
+        return false;
+    }
+
+    bool binary = false;
+    std::vector<PlyElement> elements;
+    while (std::getline(in, line))
+    {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == "format")
+        {
+            std::string format;
+            words >> format;
+            if (format == "binary_little_endian")
+            {
+                binary = true;
+            }
+            else if (format != "ascii")
+            {
+                std::cerr << filename << ": unsupported PLY format " << format << std::endl;
+                return false;
+            }
+        }
+        else if (keyword == "element")
+        {
+            PlyElement Element;
+            words >> Element.Name >> Element.Count;
+            elements.push_back(Element);
+        }
+        else if (keyword == "property" && !elements.empty())
+        {
+            PlyProperty Property;
+            std::string type;
+            words >> type;
+            if (type == "list")
+            {
+                std::string countType;
+                words >> countType >> type;
+                Property.CountType = ParsePlyType(countType);
+            }
+            else
+            {
+                Property.CountType = PlyType::Invalid;
+            }
+            Property.Type = ParsePlyType(type);
+            words >> Property.Name;
+            if (Property.Type == PlyType::Invalid)
+            {
+                std::cerr << filename << ": unsupported PLY property type " << type << std::endl;
+                return false;
+            }
+            elements.back().Properties.push_back(Property);
+        }
+        else if (keyword == "end_header")
+        {
+            break;
+        }
+    }
+
+    PlyReader Reader(in, binary);
+    for (const PlyElement& Element : elements)
+    {
+        for (size_t n = 0; n < Element.Count; ++n)
+        {
+            Point3D vertex;
+            Mesh::Face face;
+            for (const PlyProperty& Property : Element.Properties)
+            {
+                if (Property.CountType != PlyType::Invalid)
+                {
+                    double count;
+                    if (!Reader.Read(Property.CountType, count))
+                    {
+                        return false;
+                    }
+                    for (size_t i = 0; i < static_cast<size_t>(count); ++i)
+                    {
+                        double index;
+                        if (!Reader.Read(Property.Type, index))
+                        {
+                            return false;
+                        }
+                        if (Element.Name == "face" && (Property.Name == "vertex_indices" || Property.Name == "vertex_index"))
+                        {
+                            face.push_back(static_cast<int>(index));
+                        }
+                    }
+                    continue;
+                }
+
+                double value;
+                if (!Reader.Read(Property.Type, value))
+                {
+                    return false;
+                }
+                if (Element.Name == "vertex" && Property.Name.size() == 1 && Property.Name[0] >= 'x' && Property.Name[0] <= 'z')
+                {
+                    vertex[Property.Name[0] - 'x'] = value;
+                }
+            }
+
+            if (Element.Name == "vertex")
+            {
+                verts.push_back(vertex);
+            }
+            else if (Element.Name == "face")
+            {
+                faces.push_back(face);
+            }
+        }
+    }
+    return true;
+}
+} // namespace
+
+bool ReadMeshFile(const std::string& filename, std::vector<Point3D>& verts, std::vector<Mesh::Face>& faces)
+{
+    bool bRead = false;
+    if (EndsWith(filename, ".obj"))
+    {
+        bRead = ReadObj(filename, verts, faces);
+    }
+    else if (EndsWith(filename, ".ply"))
+    {
+        bRead = ReadPly(filename, verts, faces);
+    }
+    else
+    {
+        std::cerr << filename << ": unknown mesh file type" << std::endl;
+        return false;
+    }
+
+    // Faces that aren't polygons over valid vertices are dropped by the Mesh
+    return bRead;
+}
+
+std::shared_ptr<Mesh> LoadMeshFile(const std::string& filename)
+{
+    MeshSourceStamp stamp;
+    if (!GetMeshSourceStamp(filename, stamp))
+    {
+        std::cerr << "Could not open mesh " << filename << std::endl;
+        return nullptr;
+    }
+
+    const std::string cachePath = filename + ".rtmc";
+    if (std::shared_ptr<MeshCache> cache = MeshCache::Open(cachePath, stamp, MeshStorageMode))
+    {
+        return std::make_shared<Mesh>(cache);
+    }
+
+    std::vector<Point3D> verts;
+    std::vector<Mesh::Face> faces;
+    if (!ReadMeshFile(filename, verts, faces) || faces.empty())
+    {
+        std::cerr << "Could not read mesh " << filename << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<Mesh> mesh = std::make_shared<Mesh>(verts, faces);
+    if (!MeshCache::Write(cachePath, stamp, *mesh, MeshStorageMode))
+    {
+        std::cerr << "Could not write mesh cache " << cachePath << std::endl;
+    }
+    return mesh;
+}
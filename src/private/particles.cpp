@@ -0,0 +1,475 @@
+#include "particles.h"
+#include "bvhinterleave.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+namespace
+{
+// Most particles stored in a single BVH leaf
+constexpr uint32_t MaxLeafParticles = 8;
+
+// Nodes over at least this many particles build their halves at the same time
+constexpr uint32_t MinParallelBuildParticles = 1 << 16;
+
+const char ParticleFileMagic[4] = { 'R', 'T', 'P', 'S' };
+constexpr uint32_t ParticleFileVersion = 1;
+constexpr uint32_t ParticleFileVelocities = 1;
+
+struct ParticleFileHeader
+{
+    char Magic[4];
+    uint32_t Version;
+    uint64_t Count;
+    uint32_t Flags;
+    uint32_t Reserved;
+};
+
+BoxF Union(const BoxF& a, const BoxF& b)
+{
+    return BoxF(std::max(a.GetRight(), b.GetRight()), std::min(a.GetLeft(), b.GetLeft()),
+                std::max(a.GetTop(), b.GetTop()), std::min(a.GetBottom(), b.GetBottom()),
+                std::max(a.GetFront(), b.GetFront()), std::min(a.GetBack(), b.GetBack()));
+}
+
+// Recursively split order[begin, end) on the median centre of the widest axis.
+// Only the tree's shape is built here, Refit bounds it.
+void BuildNode(const std::vector<float> (&Center)[3], std::vector<uint32_t>& order, uint32_t begin, uint32_t end,
+               std::vector<MeshBVHNode>& nodes)
+{
+    const size_t nodeIndex = nodes.size();
+    nodes.emplace_back();
+
+    if (end - begin <= MaxLeafParticles)
+    {
+        nodes[nodeIndex].Start = begin;
+        nodes[nodeIndex].Count = end - begin;
+        return;
+    }
+
+    int axis = 0;
+    float widest = -1.0f;
+    for (int a = 0; a < 3; ++a)
+    {
+        float Min = Center[a][order[begin]];
+        float Max = Min;
+        for (uint32_t i = begin + 1; i < end; ++i)
+        {
+            Min = std::min(Min, Center[a][order[i]]);
+            Max = std::max(Max, Center[a][order[i]]);
+        }
+        if (Max - Min > widest)
+        {
+            widest = Max - Min;
+            axis = a;
+        }
+    }
+
+    // Split at a whole number of leaves so they all fill up but the last
+    const uint32_t mid = begin + ((end - begin) / 2 + MaxLeafParticles - 1) / MaxLeafParticles * MaxLeafParticles;
+    const std::vector<float>& Axis = Center[axis];
+    std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                     [&Axis](uint32_t a, uint32_t b)
+    {
+        return Axis[a] < Axis[b];
+    });
+
+    if (end - begin < MinParallelBuildParticles)
+    {
+        BuildNode(Center, order, begin, mid, nodes);
+        nodes[nodeIndex].Start = static_cast<uint32_t>(nodes.size());
+        nodes[nodeIndex].Count = 0;
+        BuildNode(Center, order, mid, end, nodes);
+        return;
+    }
+
+    // As in a mesh's build, the right half is built by another task and moved after the left
+    std::vector<MeshBVHNode> rightNodes;
+    {
+        ThreadPool::TaskGroup rightTask;
+        rightTask.Run([&Center, &order, mid, end, &rightNodes]
+        {
+            BuildNode(Center, order, mid, end, rightNodes);
+        });
+        BuildNode(Center, order, begin, mid, nodes);
+        rightTask.Wait();
+    }
+
+    const uint32_t offset = static_cast<uint32_t>(nodes.size());
+    nodes[nodeIndex].Start = offset;
+    nodes[nodeIndex].Count = 0;
+    for (MeshBVHNode& node : rightNodes)
+    {
+        if (node.Count == 0)
+        {
+            node.Start += offset;
+        }
+        nodes.push_back(node);
+    }
+}
+
+// Values[order[i]] for each i
+std::vector<float> Reorder(const std::vector<float>& Values, const std::vector<uint32_t>& order)
+{
+    std::vector<float> Out(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        Out[i] = Values[order[i]];
+    }
+    return Out;
+}
+} // namespace
+
+Particles::Particles(const std::vector<float>& Packed, const std::vector<float>& Velocities) :
+    m_duration(0.0)
+{
+    const size_t count = Packed.size() / 4;
+    const bool bMoving = Velocities.size() == 3 * count && count > 0;
+
+    std::vector<float> Center[3];
+    std::vector<float> Radius(count);
+    std::vector<float> Velocity[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        Center[axis].resize(count);
+        Velocity[axis].resize(bMoving ? count : 0);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            Center[axis][i] = Packed[4 * i + axis];
+            if (bMoving)
+            {
+                Velocity[axis][i] = Velocities[3 * i + axis];
+            }
+        }
+        Radius[i] = Packed[4 * i + 3];
+    }
+
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0u);
+    if (count > 0)
+    {
+        m_nodes.reserve(2 * (count / MaxLeafParticles + 1));
+        BuildNode(Center, order, 0, static_cast<uint32_t>(count), m_nodes);
+    }
+
+    // Store the particles in leaf order so every leaf is a contiguous range
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_center[axis] = Reorder(Center[axis], order);
+        m_velocity[axis] = bMoving ? Reorder(Velocity[axis], order) : std::vector<float>();
+    }
+    m_radius = Reorder(Radius, order);
+
+    Refit();
+}
+
+void Particles::Refit()
+{
+    if (m_nodes.empty())
+    {
+        Bounds = BoxF(0, 0, 0, 0, 0, 0);
+        return;
+    }
+
+    // Children always follow their parent
+    const bool bMoving = IsMoving();
+    for (size_t nodeIndex = m_nodes.size(); nodeIndex-- > 0;)
+    {
+        MeshBVHNode& Node = m_nodes[nodeIndex];
+        if (Node.Count == 0)
+        {
+            Node.Bounds = Union(m_nodes[nodeIndex + 1].Bounds, m_nodes[Node.Start].Bounds);
+            continue;
+        }
+
+        Scalar Min[3], Max[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            Min[axis] = std::numeric_limits<Scalar>::infinity();
+            Max[axis] = -std::numeric_limits<Scalar>::infinity();
+            for (uint32_t i = Node.Start; i < Node.Start + Node.Count; ++i)
+            {
+                const Scalar C = m_center[axis][i];
+                const Scalar End = bMoving ? C + m_duration * m_velocity[axis][i] : C;
+                Min[axis] = std::min(Min[axis], std::min(C, End) - m_radius[i]);
+                Max[axis] = std::max(Max[axis], std::max(C, End) + m_radius[i]);
+            }
+        }
+        Node.Bounds = BoxF(Max[0], Min[0], Max[1], Min[1], Max[2], Min[2]);
+    }
+    Bounds = m_nodes[0].Bounds;
+}
+
+void Particles::CacheMotion(double TimeDuration)
+{
+    // Nodes sharing the particles all cache the same duration
+    if (IsMoving() && TimeDuration != m_duration)
+    {
+        m_duration = TimeDuration;
+        Refit();
+    }
+}
+
+size_t Particles::GetMemoryUsage() const
+{
+    return (4 + (IsMoving() ? 3 : 0)) * m_radius.size() * sizeof(float) + m_nodes.size() * sizeof(MeshBVHNode);
+}
+
+template<bool bMoving>
+RT_KERNEL_INLINE bool Particles::TraceLeaf(const MeshBVHNode& Node, Ray& R, const Point3D& O, const Vector3D& D, HitInfo& Hit, Scalar Time) const
+{
+    const float* CX = m_center[0].data();
+    const float* CY = m_center[1].data();
+    const float* CZ = m_center[2].data();
+    const float* Radius = m_radius.data();
+    const float* VX = m_velocity[0].data();
+    const float* VY = m_velocity[1].data();
+    const float* VZ = m_velocity[2].data();
+
+    // Every particle of the leaf at once, the same test as Sphere::DepthTrace.
+    // Misses and roots out of range become infinity.
+    const Scalar tMin = R.GetTMin();
+    const Scalar tMax = R.GetTMax();
+    const uint32_t first = Node.Start;
+    Scalar T[MaxLeafParticles] = { std::numeric_limits<Scalar>::infinity() };    // An empty leaf misses
+    for (uint32_t i = 0; i < Node.Count; ++i)
+    {
+        const uint32_t p = first + i;
+        const Scalar DeltaX = (bMoving ? CX[p] + Time * VX[p] : CX[p]) - O[0];
+        const Scalar DeltaY = (bMoving ? CY[p] + Time * VY[p] : CY[p]) - O[1];
+        const Scalar DeltaZ = (bMoving ? CZ[p] + Time * VZ[p] : CZ[p]) - O[2];
+        const Scalar uDotDelta = D[0] * DeltaX + D[1] * DeltaY + D[2] * DeltaZ;
+        const Scalar PerpX = DeltaX - uDotDelta * D[0];
+        const Scalar PerpY = DeltaY - uDotDelta * D[1];
+        const Scalar PerpZ = DeltaZ - uDotDelta * D[2];
+        const Scalar Disc = Scalar(Radius[p]) * Radius[p] - (PerpX * PerpX + PerpY * PerpY + PerpZ * PerpZ);
+
+        // The far side is only hit from inside, sqrt of a miss is NaN and fails both tests
+        const Scalar SqrtDisc = std::sqrt(Disc);
+        const Scalar Near = uDotDelta - SqrtDisc;
+        const Scalar Far = uDotDelta + SqrtDisc;
+        const Scalar FarT = (Far > tMin && Far < tMax) ? Far : std::numeric_limits<Scalar>::infinity();
+        T[i] = (Near > tMin && Near < tMax) ? Near : FarT;
+    }
+
+    uint32_t closest = 0;
+    for (uint32_t i = 1; i < Node.Count; ++i)
+    {
+        closest = T[i] < T[closest] ? i : closest;
+    }
+    if (RecordHit(R, T[closest], first + closest, Hit))
+    {
+        Hit.Time = Time;
+        return true;
+    }
+    return false;
+}
+
+template<bool bMoving>
+RT_KERNEL_INLINE bool Particles::TraceTree(Ray& R, HitInfo& Hit, Scalar Time) const
+{
+    R.Normalize();
+    if (m_nodes.empty() || !CheckIntersection(R, Bounds))
+    {
+        return false;
+    }
+
+    const Point3D O = R.GetOrigin();
+    const Vector3D D = R.GetDirection();
+    bool ret = false;
+
+    // Median splits keep the tree depth well below the stack size
+    uint32_t stack[64];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const uint32_t nodeIndex = stack[--stackSize];
+        const MeshBVHNode& Node = m_nodes[nodeIndex];
+
+        // Also skips nodes beyond the closest hit so far
+        if (!CheckIntersection(R, Node.Bounds))
+        {
+            continue;
+        }
+
+        if (Node.Count == 0)
+        {
+            stack[stackSize++] = Node.Start;
+            stack[stackSize++] = nodeIndex + 1;
+            continue;
+        }
+
+        if (TraceLeaf<bMoving>(Node, R, O, D, Hit, Time))
+        {
+            ret = true;
+        }
+    }
+    return ret;
+}
+
+template<bool bMoving>
+RT_KERNEL_INLINE void Particles::TraceTreeInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const
+{
+    if (GetMemoryUsage() < MinInterleavedBytes)
+    {
+        for (size_t i = 0; i < Count; ++i)
+        {
+            bHits[i] = TraceTree<bMoving>(Rays[i], *Hits[i], Time);
+        }
+        return;
+    }
+
+    Ray* Live[MaxInterleavedRays];
+    size_t Slots[MaxInterleavedRays];
+    size_t NumLive = 0;
+    for (size_t i = 0; i < Count; ++i)
+    {
+        bHits[i] = false;
+        Rays[i].Normalize();
+        if (!m_nodes.empty() && CheckIntersection(Rays[i], Bounds))
+        {
+            Live[NumLive] = &Rays[i];
+            Slots[NumLive++] = i;
+        }
+    }
+
+    TraceInterleaved(m_nodes.data(), Live, NumLive, [&](const MeshBVHNode& Node) RT_KERNEL_LAMBDA
+    {
+        RT_PREFETCH(&m_center[0][Node.Start]);
+        RT_PREFETCH(&m_center[1][Node.Start]);
+        RT_PREFETCH(&m_center[2][Node.Start]);
+        RT_PREFETCH(&m_radius[Node.Start]);
+        if (bMoving)
+        {
+            RT_PREFETCH(&m_velocity[0][Node.Start]);
+            RT_PREFETCH(&m_velocity[1][Node.Start]);
+            RT_PREFETCH(&m_velocity[2][Node.Start]);
+        }
+    },
+    [&](size_t i, const MeshBVHNode& Node) RT_KERNEL_LAMBDA
+    {
+        Ray& R = *Live[i];
+        if (TraceLeaf<bMoving>(Node, R, R.GetOrigin(), R.GetDirection(), *Hits[Slots[i]], Time))
+        {
+            bHits[Slots[i]] = true;
+        }
+    });
+}
+
+// A build of the whole trace per CpuLevel
+#define TIME_TRACE_AT(Level, Target) \
+    template<> Target bool Particles::TimeTraceAt<Level>(Ray& R, HitInfo& Hit, Scalar Time) const \
+    { \
+        return IsMoving() ? TraceTree<true>(R, Hit, Time) : TraceTree<false>(R, Hit, Time); \
+    } \
+    template<> Target void Particles::TimeTraceInterleavedAt<Level>(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const \
+    { \
+        if (IsMoving()) \
+        { \
+            TraceTreeInterleaved<true>(Rays, Hits, bHits, Count, Time); \
+        } \
+        else \
+        { \
+            TraceTreeInterleaved<false>(Rays, Hits, bHits, Count, Time); \
+        } \
+    }
+RT_FOR_EACH_CPU_LEVEL(TIME_TRACE_AT)
+#undef TIME_TRACE_AT
+
+bool Particles::DepthTrace(Ray& R, HitInfo& Hit)
+{
+    return TimeTrace(R, Hit, 0.0);
+}
+
+bool Particles::TimeTrace(Ray& R, HitInfo& Hit, const double& Time)
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return TimeTraceAt<decltype(Level)::value>(R, Hit, Time);
+    });
+}
+
+void Particles::TimeTraceInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const
+{
+    // The rays that reach the bounds are gathered into buffers of this size
+    assert(Count <= MaxInterleavedRays);
+    DispatchCpu([&](auto Level)
+    {
+        TimeTraceInterleavedAt<decltype(Level)::value>(Rays, Hits, bHits, Count, Time);
+    });
+}
+
+void Particles::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    const uint32_t p = Hit.PrimID;
+    Point3D Center(m_center[0][p], m_center[1][p], m_center[2][p]);
+    if (IsMoving())
+    {
+        Center = Center + Hit.Time * Vector3D(m_velocity[0][p], m_velocity[1][p], m_velocity[2][p]);
+    }
+
+    Location = Hit.ObjectLocation();
+    Normal = Location - Center;
+}
+
+std::shared_ptr<Particles> LoadParticleFile(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in)
+    {
+        std::cerr << "Could not open particle file " << filename << std::endl;
+        return nullptr;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    ParticleFileHeader Header;
+    if (!in.read(reinterpret_cast<char*>(&Header), sizeof(Header)) ||
+        std::memcmp(Header.Magic, ParticleFileMagic, sizeof(ParticleFileMagic)) != 0 ||
+        Header.Version != ParticleFileVersion)
+    {
+        std::cerr << filename << " is not a particle file" << std::endl;
+        return nullptr;
+    }
+
+    // Check the size before allocating anything for the count
+    const bool bMoving = (Header.Flags & ParticleFileVelocities) != 0;
+    const uint64_t floatsPerParticle = bMoving ? 7 : 4;
+    if (Header.Count > (fileSize - sizeof(Header)) / (floatsPerParticle * sizeof(float)) ||
+        fileSize - sizeof(Header) != Header.Count * floatsPerParticle * sizeof(float))
+    {
+        std::cerr << "Particle file " << filename << " should hold " << Header.Count << " particles but is "
+                  << fileSize << " bytes" << std::endl;
+        return nullptr;
+    }
+
+    std::vector<float> Packed(4 * Header.Count);
+    std::vector<float> Velocities(bMoving ? 3 * Header.Count : 0);
+    in.read(reinterpret_cast<char*>(Packed.data()), Packed.size() * sizeof(float));
+    in.read(reinterpret_cast<char*>(Velocities.data()), Velocities.size() * sizeof(float));
+    if (!in)
+    {
+        std::cerr << "Could not read particle file " << filename << std::endl;
+        return nullptr;
+    }
+
+    for (uint64_t i = 0; i < Header.Count; ++i)
+    {
+        if (!(Packed[4 * i + 3] > 0.0f))
+        {
+            std::cerr << "Particle " << i << " of " << filename << " has no positive radius" << std::endl;
+            return nullptr;
+        }
+    }
+    return std::make_shared<Particles>(Packed, Velocities);
+}
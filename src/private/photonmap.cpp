@@ -2,8 +2,13 @@
 #include "scenecontainer.h"
 #include "light.hpp"
 #include "material.hpp"
+#include <algorithm>
 #include <iostream>
 #include "progressthread.h"
+#include "ThreadPool.h"
+
+// Photons a task of the pool emits
+static const PhotonMap::size_type PhotonsPerTask = 1024;
 
 PhotonMap::PhotonMap(SceneContainer* Scene, size_type NumToEmit) : Scene(Scene), Tree(3), NumToEmit(NumToEmit), generator(std::random_device{}()),
 	PhotonDistribution(-1.f,1.f)
@@ -18,7 +23,7 @@ PhotonMap::~PhotonMap()
 }
 
 // Only does caustics
-void PhotonMap::TracePhoton(const Ray& R, const Colour& Power, unsigned int depth, bool bHasRef)
+void PhotonMap::TracePhoton(const Ray& R, const Colour& Power, unsigned int depth, photon_stg_type& Out, bool bHasRef) const
 {
 	if (depth >= 9) return;
 
@@ -57,22 +62,22 @@ void PhotonMap::TracePhoton(const Ray& R, const Colour& Power, unsigned int dept
 
 			// Photons don't do glossy reflection
 			Ray ReflectedRay = R.Reflect(Hit, NdotR);
-			TracePhoton(ReflectedRay, Reflectance*Power, nextDepth, bHasRef);
+			TracePhoton(ReflectedRay, Reflectance*Power, nextDepth, Out, bHasRef);
 
 			Ray RefractedRay = R.Refract(ni, nt, NdotR, sin2t, Hit);
-			TracePhoton(RefractedRay, (1.f-Reflectance)*Power, nextDepth, true);
+			TracePhoton(RefractedRay, (1.f-Reflectance)*Power, nextDepth, Out, true);
 		}
 		else
 		{
 			// Total internal reflection
 			Ray ReflectedRay = R.Reflect(Hit, NdotR);
-			TracePhoton(ReflectedRay, Power, nextDepth, bHasRef);
+			TracePhoton(ReflectedRay, Power, nextDepth, Out, bHasRef);
 		}
 	}
 	else if (bHasRef)
 	{
 		// Stick if this trace has refracted at least once
-		Storage.emplace_back(new Photon(Hit.Location, Power, rayDir));
+		Out.emplace_back(new Photon(Hit.Location, Power, rayDir));
 	}
 }
 
@@ -83,18 +88,43 @@ void PhotonMap::BuildTree()
 		std::cout << "Mapping " << NumToEmit * Scene->lights->size() << " photons..." << std::endl;
 		std::unique_ptr<ProgressThread> Status(CreateThread<ProgressThread>((double)NumToEmit * Scene->lights->size()));
 		Storage.reserve(NumToEmit * Scene->lights->size());
+
+		// The photons are emitted in tasks with their own generators, seeded here in order,
+		// and stored in the order of the tasks
+		const size_type TasksPerLight = (NumToEmit + PhotonsPerTask - 1) / PhotonsPerTask;
+		std::vector<photon_stg_type> TaskStorage(TasksPerLight * Scene->lights->size());
+		ThreadPool::TaskGroup EmitTasks;
+		size_type TaskNum = 0;
 		for (auto& L : *(Scene->lights))
 		{
-			Colour Power = (L->power * L->colour) / NumToEmit;
-			for (size_type n=0;n<NumToEmit;n++)
+			const Colour Power = (L->power * L->colour) / NumToEmit;
+			for (size_type First = 0; First < NumToEmit; First += PhotonsPerTask, TaskNum++)
 			{
-				// Random photon directions
-				Vector3D Dir(PhotonDistribution(generator), PhotonDistribution(generator), PhotonDistribution(generator)); Dir.normalize();
-				TracePhoton(Ray(L->position, Dir), Power, 0);
-				Status->PROGRESS++;
+				const size_type Count = std::min(PhotonsPerTask, NumToEmit - First);
+				const auto Seed = generator();
+				photon_stg_type& Out = TaskStorage[TaskNum];
+				const Light* Source = L.get();
+				ProgressThread* Progress = Status.get();
+				EmitTasks.Run([this, Source, Power, Count, Seed, &Out, Progress]
+				{
+					std::default_random_engine TaskGenerator(Seed);
+					std::uniform_real_distribution<double> Distribution(PhotonDistribution.param());
+					for (size_type n=0;n<Count;n++)
+					{
+						// Random photon directions
+						Vector3D Dir(Distribution(TaskGenerator), Distribution(TaskGenerator), Distribution(TaskGenerator)); Dir.normalize();
+						TracePhoton(Ray(Source->position, Dir), Power, 0, Out);
+						Progress->PROGRESS++;
+					}
+				});
 			}
 		}
+		EmitTasks.Wait();
 
+		for (photon_stg_type& Photons : TaskStorage)
+		{
+			Storage.insert(Storage.end(), Photons.begin(), Photons.end());
+		}
 		Tree.MakeTree(Storage);
 	}
 }
@@ -69,6 +69,10 @@
 /* Imports */
 #include <stdlib.h>
 #include <math.h>
+#include <cmath>
+#include "approxmath.h"
+#include "polyroots.hpp"
+#include "cpudispatch.h"
 
 /* Forward declarations */
 double sink_lookup(double), cosk_lookup(double);
@@ -133,6 +137,77 @@ size_t quadraticRoots( double A, double B, double C, double roots[2] )
 	}
 }
 
+/*
+**  Solve Count <= QUADRATIC_BATCH quadratics at once, lane i being
+**  A[i] x^2 + B[i] x + C[i].  Each lane gets the same roots as
+**  quadraticRoots, NumRoots[i] is 0 where it has none.
+**    Note:  Every lane is evaluated with selects rather than branches
+**    so the compiler can run 4 double lanes per instruction with AVX2
+**    or AVX-512, twice as many float ones.  Roots of lanes without
+**    them are garbage.  It is built for each CpuLevel and the call
+**    picks the build for the running CPU.
+*/
+template<typename T>
+static RT_KERNEL_INLINE void QuadraticRootsBatch( size_t Count, const T A[],
+	const T B[], const T C[], T Roots0[], T Roots1[], size_t NumRoots[] )
+{
+	size_t i;
+
+	for( i = 0; i < Count; ++i ) {
+		const T a = A[i], b = B[i], c = C[i];
+		const T D = b*b - 4*a*c;
+		const T sqrtD = std::sqrt( D < 0 ? 0 : D );
+		const T q = -( b + ( b < 0 ? -sqrtD : sqrtD ) ) * T(0.5);
+
+		/* Both quotients are always taken so no lane branches around a divide,
+		** a linear equation's root picks its terms before the divide instead */
+		const bool bLinear = a == 0;
+		const T first = ( bLinear ? -c : q ) / ( bLinear ? b : a ), other = c/q;
+		const size_t linearRoots = b == 0 ? 0 : 1;
+		const size_t quadraticRoots = D < 0 ? 0 : 2;
+
+		Roots0[i] = first;
+		Roots1[i] = ( bLinear | ( q == 0 ) ) ? first : other;
+		NumRoots[i] = bLinear ? linearRoots : quadraticRoots;
+	}
+}
+
+template<CpuLevel Level, typename T>
+static void QuadraticRootsAt( size_t Count, const T A[], const T B[],
+	const T C[], T Roots0[], T Roots1[], size_t NumRoots[] );
+
+#define QUADRATIC_ROOTS_AT( Level, Target ) \
+	template<> Target void QuadraticRootsAt<Level, double>( size_t Count, \
+		const double A[], const double B[], const double C[], \
+		double Roots0[], double Roots1[], size_t NumRoots[] ) \
+	{ \
+		QuadraticRootsBatch( Count, A, B, C, Roots0, Roots1, NumRoots ); \
+	} \
+	template<> Target void QuadraticRootsAt<Level, float>( size_t Count, \
+		const float A[], const float B[], const float C[], \
+		float Roots0[], float Roots1[], size_t NumRoots[] ) \
+	{ \
+		QuadraticRootsBatch( Count, A, B, C, Roots0, Roots1, NumRoots ); \
+	}
+RT_FOR_EACH_CPU_LEVEL( QUADRATIC_ROOTS_AT )
+#undef QUADRATIC_ROOTS_AT
+
+void quadraticRoots( size_t Count, const double A[], const double B[],
+	const double C[], double Roots0[], double Roots1[], size_t NumRoots[] )
+{
+	DispatchCpu( [&]( auto Level ) {
+		QuadraticRootsAt<decltype( Level )::value>( Count, A, B, C, Roots0, Roots1, NumRoots );
+	} );
+}
+
+void quadraticRoots( size_t Count, const float A[], const float B[],
+	const float C[], float Roots0[], float Roots1[], size_t NumRoots[] )
+{
+	DispatchCpu( [&]( auto Level ) {
+		QuadraticRootsAt<decltype( Level )::value>( Count, A, B, C, Roots0, Roots1, NumRoots );
+	} );
+}
+
 /*
 **  Return the real roots of a monic cubic polynomial over the reals.
 **  Reference: ``Solving Quartics and Cubics for Graphics'',
@@ -308,6 +383,178 @@ size_t quarticRoots(
 	return nr;
 }
 
+/*
+**  Cube root of z > 0 for the batched quartic, its approximation is
+**  polished to full precision by a Newton step.
+*/
+template<typename T>
+static RT_KERNEL_INLINE T CubeRootBatch( T z )
+{
+	const T y = T( FastMath::Exp2Approx( FastMath::Log2Approx( z ) * ( 1.0/3.0 ) ) );
+	return ( 2*y + z/( y*y ) ) * T( 1.0/3.0 );
+}
+
+/*  One Newton step towards a root of x^3 + p x^2 + q x + r, x if it is flat */
+template<typename T>
+static RT_KERNEL_INLINE T PolishCubicBatch( T p, T q, T r, T x )
+{
+	const T y = ( ( x + p )*x + q )*x + r;
+	const T dydx = ( 3*x + 2*p )*x + q;
+	return dydx != 0 ? x - y/( dydx != 0 ? dydx : 1 ) : x;
+}
+
+/*  One Newton step towards a root of x^4 + a x^3 + b x^2 + c x + d */
+template<typename T>
+static RT_KERNEL_INLINE T PolishQuarticBatch( T a, T b, T c, T d, T x )
+{
+	const T y = ( ( ( x + a )*x + b )*x + c )*x + d;
+	const T dydx = ( ( 4*x + 3*a )*x + 2*b )*x + c;
+	return dydx != 0 ? x - y/( dydx != 0 ? dydx : 1 ) : x;
+}
+
+/*
+**  Polish a root x of x^4 + a x^3 + b x^2 + c x + d, HUGE if it is NaN
+**  or doesn't come within 1e-4 of zero as quarticRoots requires.
+*/
+template<typename T>
+static RT_KERNEL_INLINE T PolishQuarticRootBatch( T a, T b, T c, T d, T x )
+{
+	x = PolishQuarticBatch( a, b, c, d, x );
+	x = PolishQuarticBatch( a, b, c, d, x );
+	const T res = ( ( ( x + a )*x + b )*x + c )*x + d;
+	return res < T( 1e-4 ) && res > T( -1e-4 ) ? x : T( HUGE );
+}
+
+/*
+**  Solve Count <= QUARTIC_BATCH monic quartics at once, lane i being
+**  x^4 + A[i] x^3 + B[i] x^2 + C[i] x + D[i].  The roots of lane i are
+**  Roots0[i] to Roots3[i], HUGE where it has fewer than 4.
+**    Note:  The same factorisation as quarticRoots, with both sides of
+**    every branch evaluated and selected so the lanes vectorize.  The
+**    resolvent cubic is solved with the approximations in approxmath.h
+**    and polished by Newton steps, as are the roots themselves.  Roots
+**    that don't come within 1e-4 of zero are dropped as quarticRoots
+**    does, so callers should scale the quartic to about unit size.
+*/
+template<typename T>
+static RT_KERNEL_INLINE void QuarticRootsBatch( size_t Count, const T A[],
+	const T B[], const T C[], const T D[], T Roots0[], T Roots1[],
+	T Roots2[], T Roots3[] )
+{
+	/* Each stage is its own loop over locals, the compiler gives up on
+	** the whole if any step of it won't vectorize */
+	T Y[QUARTIC_BATCH], Gs[QUARTIC_BATCH], Hs[QUARTIC_BATCH];
+	T gs[QUARTIC_BATCH], hs[QUARTIC_BATCH];
+	T x0s[QUARTIC_BATCH], x1s[QUARTIC_BATCH], x2s[QUARTIC_BATCH], x3s[QUARTIC_BATCH];
+	size_t i;
+
+	/* A real root y of the resolvent cubic y^3 + p y^2 + q y + r */
+	for( i = 0; i < Count; ++i ) {
+		const T a = A[i], b = B[i], c = C[i], d = D[i];
+		const T p = -2*b, q = b*b + a*c - 4*d, r = c*c - a*b*c + a*a*d;
+		const T p_over_3 = p * T( 1.0/3.0 );
+		const T u = q - p*p_over_3;
+		const T v = r - p_over_3*q + 2*p_over_3*p_over_3*p_over_3;
+		const T w = ( 4*u*u*u )*T( 1.0/27.0 ) + v*v;
+
+		/* One real root */
+		const T z = std::sqrt( w > 0 ? w : 0 ) + ( v < 0 ? -v : v );
+		const T cz = CubeRootBatch( z > 0 ? z*T( 0.5 ) : T( 1 ) );
+		const T single = ( v < 0 ? 1 : -1 )*( cz - u/( 3*cz ) ) - p_over_3;
+
+		/* Three real roots, the largest or for b, d < 0 the smallest */
+		const T s = std::sqrt( u < 0 ? -u*T( 1.0/3.0 ) : 0 );
+		const T t = s != 0 ? -v/( 2*s*s*( s != 0 ? s : 1 ) ) : 0;
+		T sink, cosk;
+		FastMath::SinCosApprox( FastMath::AcosApprox( t ) * ( 1.0/3.0 ), sink, cosk );
+		const T largest = 2*s*T( cosk ) - p_over_3;
+		const T smallest = s*( -T( cosk ) - T( SQRT3*sink ) ) - p_over_3;
+		const T triple = b < 0 ? ( d < 0 ? smallest : largest ) : largest;
+
+		T y = w > 0 ? single : triple;
+		y = PolishCubicBatch( p, q, r, y );
+		Y[i] = PolishCubicBatch( p, q, r, y );
+	}
+
+	/* Split into x^2 + G x + H and x^2 + g x + h, G and g are NaN if it can't be */
+	for( i = 0; i < Count; ++i ) {
+		const T a = A[i], b = B[i], c = C[i], d = D[i], y = Y[i];
+		const T g1 = a * T( 0.5 ), h1 = ( b - y ) * T( 0.5 );
+		const T n = a*a - 4*y, m = ( b - y )*( b - y ) - 4*d;
+		const T en = b*b + 2*( b*y < 0 ? -b*y : b*y ) + y*y + 4*( d < 0 ? -d : d );
+		const T em = a*a + 4*( y < 0 ? -y : y );
+
+		/* m is used where quarticRoots would, the choice is kept as a
+		** value since the compiler can't vectorize selects of bools */
+		const T better = m*en > n*em ? 1 : 0;
+		const T forced = y > 0 ? ( d > 0 ? ( b < 0 ? 1 : better ) : better ) : better;
+		const T useM = y < 0 ? 0 : forced;
+		const T mn = useM != 0 ? m : n;
+		const T root = std::sqrt( mn > 0 ? mn : 1 );
+		const T other = ( a*h1 - c )/root;
+		const T g2 = useM != 0 ? other : root*T( 0.5 );
+		const T h2 = useM != 0 ? root*T( 0.5 ) : other;
+
+		const T gSign1 = SIGN( g1 ), gSign2 = SIGN( g2 ), hSign1 = SIGN( h1 ), hSign2 = SIGN( h2 );
+		const T gSum = g1 + g2, gDiff = g1 - g2, hSum = h1 + h2, hDiff = h1 - h2;
+		const T gNum = gSign1 == gSign2 ? gSum : gDiff, hNum = hSign1 == hSign2 ? hSum : hDiff;
+		const T gQuot = y/( gNum != 0 ? gNum : 1 ), hQuot = d/( hNum != 0 ? hNum : 1 );
+		const T G = gSign1 == gSign2 ? gSum : ( gDiff == 0 ? gSum : gQuot );
+		const T g = gSign1 == gSign2 ? ( gSum == 0 ? gDiff : gQuot ) : gDiff;
+		Gs[i] = mn > 0 ? G : T( NAN );
+		gs[i] = mn > 0 ? g : T( NAN );
+		Hs[i] = hSign1 == hSign2 ? hSum : ( hDiff == 0 ? hSum : hQuot );
+		hs[i] = hSign1 == hSign2 ? ( hSum == 0 ? hDiff : hQuot ) : hDiff;
+	}
+
+	/* Both quadratics as quadraticRoots solves them, NaN roots where not real */
+	for( i = 0; i < Count; ++i ) {
+		const T a = A[i], b = B[i], c = C[i], d = D[i];
+		const T G = Gs[i], H = Hs[i], g = gs[i], h = hs[i];
+		const T D0 = G*G - 4*H, D1 = g*g - 4*h;
+		const T q0 = -( G + ( G < 0 ? -1 : 1 )*std::sqrt( D0 < 0 ? T( NAN ) : D0 ) )*T( 0.5 );
+		const T q1 = -( g + ( g < 0 ? -1 : 1 )*std::sqrt( D1 < 0 ? T( NAN ) : D1 ) )*T( 0.5 );
+		const T r0 = q0, r1 = q0 != 0 ? H/( q0 != 0 ? q0 : 1 ) : q0;
+		const T r2 = q1, r3 = q1 != 0 ? h/( q1 != 0 ? q1 : 1 ) : q1;
+		x0s[i] = PolishQuarticRootBatch( a, b, c, d, r0 );
+		x1s[i] = PolishQuarticRootBatch( a, b, c, d, r1 );
+		x2s[i] = PolishQuarticRootBatch( a, b, c, d, r2 );
+		x3s[i] = PolishQuarticRootBatch( a, b, c, d, r3 );
+	}
+
+	for( i = 0; i < Count; ++i ) {
+		Roots0[i] = x0s[i];
+		Roots1[i] = x1s[i];
+		Roots2[i] = x2s[i];
+		Roots3[i] = x3s[i];
+	}
+}
+
+template<CpuLevel Level>
+static void QuarticRootsAt( size_t Count, const double A[], const double B[],
+	const double C[], const double D[], double Roots0[], double Roots1[],
+	double Roots2[], double Roots3[] );
+
+#define QUARTIC_ROOTS_AT( Level, Target ) \
+	template<> Target void QuarticRootsAt<Level>( size_t Count, \
+		const double A[], const double B[], const double C[], \
+		const double D[], double Roots0[], double Roots1[], \
+		double Roots2[], double Roots3[] ) \
+	{ \
+		QuarticRootsBatch( Count, A, B, C, D, Roots0, Roots1, Roots2, Roots3 ); \
+	}
+RT_FOR_EACH_CPU_LEVEL( QUARTIC_ROOTS_AT )
+#undef QUARTIC_ROOTS_AT
+
+void quarticRoots( size_t Count, const double A[], const double B[],
+	const double C[], const double D[], double Roots0[], double Roots1[],
+	double Roots2[], double Roots3[] )
+{
+	DispatchCpu( [&]( auto Level ) {
+		QuarticRootsAt<decltype( Level )::value>( Count, A, B, C, D, Roots0, Roots1, Roots2, Roots3 );
+	} );
+}
+
 /*  Polish a monic polynomial root by Newton-Raphson iteration */
 /* degree <= 4; c[] has 'degree' values. */
 static double PolishRoot( 
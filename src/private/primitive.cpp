@@ -3,7 +3,6 @@
 #include "AxisAlignedBox.h"
 #include <limits>
 #include <cmath>
-#include <vector>
 
 Primitive::~Primitive()
 {
@@ -22,175 +21,131 @@ bool Sphere::SimpleTrace(Ray R)
     return (((m_radius * m_radius) - (deltaP - (rayDir.dot(deltaP)) * rayDir).length2()) >= 0);
 }
 
-bool Sphere::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+bool Sphere::DepthTrace(Ray& R, HitInfo& Hit)
 {
     R.Normalize();
+    const Vector3D rayDir = R.GetDirection();
 
-    bool retry;
-    do
+    const Vector3D deltaP = m_center - R.GetOrigin();
+    const Scalar uDotDeltaP = rayDir.dot(deltaP);
+    const Scalar discriminant = (m_radius * m_radius - (deltaP - (uDotDeltaP) * rayDir).length2());
+    if (discriminant < 0)
     {
-        const Point3D rayOrigin = R.GetOrigin();
-        const Vector3D rayDir = R.GetDirection();
-
-        retry = false;
-        Vector3D deltaP = m_center - rayOrigin;
-        double uDotDeltaP = rayDir.dot(deltaP);
-        double discriminant = (m_radius * m_radius - (deltaP - (uDotDeltaP) * rayDir).length2());
-        // std::cout << discriminant << std::endl;
-        if (discriminant >= 0)
-        {
-            double sqrtDisc = sqrt(discriminant);
-            double s = std::min(uDotDeltaP + sqrtDisc, uDotDeltaP - sqrtDisc);
-            if (s < 0)
-            {
-                if (uDotDeltaP + sqrtDisc > 0)
-                {
-                    s = uDotDeltaP + sqrtDisc;
-                }
-                else if (uDotDeltaP - sqrtDisc > 0)
-                {
-                    s = uDotDeltaP - sqrtDisc;
-                }
-                else
-                {
-                    return false;
-                }
-            }
-            Vector3D rayVec = s * rayDir;
-            Point3D hitLoc = rayOrigin + rayVec;
-            Vector3D Normal = (hitLoc - m_center);
+        return false;
+    }
 
-            Point3D WorldRay = M * rayOrigin;
-            Point3D WorldHit = M * hitLoc;
-            if (clampDist(closestDist, WorldRay, WorldHit, Normal, Hit, M))
-            {
-                return true;
-            }
+    // The far side is only hit from inside
+    const Scalar sqrtDisc = sqrt(discriminant);
+    return RecordHit(R, uDotDeltaP - sqrtDisc, 0, Hit) || RecordHit(R, uDotDeltaP + sqrtDisc, 0, Hit);
+}
 
-            if (CheckCloseHit(WorldRay, WorldHit))
-            {
-                R.SetOrigin(rayOrigin + EPSILON * rayDir);
-                retry = true;
-            }
-        }
-    }
-    while (retry);
-    return false;
+void Sphere::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    Location = Hit.ObjectLocation();
+    Normal = Location - m_center;
 }
 
-bool Cube::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+bool Cube::DepthTrace(Ray& R, HitInfo& Hit)
 {
     R.Normalize();
 
-    bool ret = false, retry;
-    do
-    {
-        const Point3D rayOrigin = R.GetOrigin();
-
-        retry = false;
-        if (GetIntersection(R, Bounds, Hit))
-        {
-            const Point3D WorldRay = M * rayOrigin;
-            const Point3D WorldHit = M * Hit.Location;
-            if (clampDist(closestDist, WorldRay, WorldHit, Hit.Normal, Hit, M))
-            {
-                ret = true;
-            }
-            else if (CheckCloseHit(WorldRay, WorldHit))
-            {
-                R.SetOrigin(rayOrigin + (EPSILON * R.GetDirection()));
-                retry = true;
-            }
-        }
-    }
-    while (retry);
+    Scalar s;
+    BoxF::NormalSelect face;
+    return GetIntersection(R, Bounds, s, face) && RecordHit(R, s, static_cast<uint32_t>(face), Hit);
+}
 
-    return ret;
+void Cube::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    Location = Hit.ObjectLocation();
+    Normal = BoxF::GetNormal(static_cast<BoxF::NormalSelect>(Hit.PrimID));
 }
 
 Cylinder::~Cylinder()
 {
 }
 
-bool Cylinder::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+bool Cylinder::DepthTrace(Ray& R, HitInfo& Hit)
 {
     R.Normalize();
-    bool retry;
-    do
-    {
-        const Point3D rayOrigin = R.GetOrigin();
-        const Vector3D rayDir = R.GetDirection();
+    const Vector3D rayDir = R.GetDirection();
+    const Point3D rayOrigin = R.GetOrigin();
 
-        retry = false;
-        double XD = rayDir[0], YD = rayDir[1], ZD = rayDir[2],
-               XE = rayOrigin[0], YE = rayOrigin[1], ZE = rayOrigin[2], roots[2];
-        size_t numRoots = quadraticRoots(XD * XD + YD * YD, 2 * XE * XD + 2 * YE * YD, XE * XE + YE * YE - 1.f, roots);
-        if (numRoots > 0)
+    Scalar XD = rayDir[0], YD = rayDir[1], ZD = rayDir[2],
+           XE = rayOrigin[0], YE = rayOrigin[1], ZE = rayOrigin[2];
+    double roots[2];
+    size_t numRoots = quadraticRoots(XD * XD + YD * YD, 2 * XE * XD + 2 * YE * YD, XE * XE + YE * YE - 1.f, roots);
+    if (numRoots > 0)
+    {
+        uint32_t part = CylinderTangent;
+        Scalar s = -1.f;
+        if (numRoots == 1 && roots[0] > 0)
+        {
+            s = roots[0];
+        }
+        else if (numRoots == 2)
         {
-            Vector3D Normal;
-            double s = -1.f;
-            if (numRoots == 1 && roots[0] > 0)
+            bool fPstv = roots[0] > 0, sPstv = roots[1] > 0;
+            if (!fPstv && !sPstv)
             {
-                s = roots[0];
+                return false;    // no hits in front
             }
-            else if (numRoots == 2)
+            s = std::min(fPstv ? roots[0] : 0, sPstv ? roots[1] : 0);
+            Scalar s2 = std::max(roots[0], roots[1]);
+            Point3D hitLoc1 = rayOrigin + s * rayDir;
+            Point3D hitLoc2 = rayOrigin + s2 * rayDir;
+            part = CylinderSide;
+            if (hitLoc1[2] > 1.f && hitLoc2[2] < 1.f)
             {
-                bool fPstv = roots[0] > 0, sPstv = roots[1] > 0;
-                if (!fPstv && !sPstv)
-                {
-                    return false;    // no hits in front
-                }
-                s = std::min(fPstv ? roots[0] : 0, sPstv ? roots[1] : 0);
-                double s2 = std::max(roots[0], roots[1]);
-                Point3D hitLoc1 = rayOrigin + s * rayDir;
-                Point3D hitLoc2 = rayOrigin + s2 * rayDir;
-                Normal = (hitLoc1 - Point3D(0, 0, hitLoc1[2]));
-                if (hitLoc1[2] > 1.f && hitLoc2[2] < 1.f)
-                {
-                    s = (1.f - ZE) / ZD;
-                    Normal = Vector3D(0, 0, 1);
-                }
-                else if (hitLoc1[2] < -1.f && hitLoc2[2] > -1.f)
-                {
-                    s = (-1.f - ZE) / ZD;
-                    Normal = Vector3D(0, 0, -1);
-                }
+                s = (1.f - ZE) / ZD;
+                part = CylinderTop;
             }
-            if (s <= 0)
+            else if (hitLoc1[2] < -1.f && hitLoc2[2] > -1.f)
             {
-                return false;    // no good hit
+                s = (-1.f - ZE) / ZD;
+                part = CylinderBottom;
             }
+        }
+        if (s <= 0)
+        {
+            return false;    // no good hit
+        }
 
-            Vector3D rayVec = s * rayDir;
-            Point3D hitLoc = rayOrigin + rayVec;
-
-            Point3D WorldRay = M * rayOrigin;
-            Point3D WorldHit = M * hitLoc;
-
-            if (hitLoc[2] > -1.005f && hitLoc[2] < 1.005f)
-            {
-                if (clampDist(closestDist, WorldRay, WorldHit, Normal, Hit, M))
-                {
-                    return true;
-                }
+        Vector3D rayVec = s * rayDir;
+        Point3D hitLoc = rayOrigin + rayVec;
 
-                if (CheckCloseHit(WorldRay, WorldHit))
-                {
-                    R.SetOrigin(rayOrigin + EPSILON * rayDir);
-                    retry = true;
-                }
-            }
+        if (hitLoc[2] > -1.005f && hitLoc[2] < 1.005f)
+        {
+            return RecordHit(R, s, part, Hit);
         }
     }
-    while (retry);
     return false;
 }
 
+void Cylinder::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    Location = Hit.ObjectLocation();
+    switch (Hit.PrimID)
+    {
+    case CylinderSide:
+        Normal = Location - Point3D(0, 0, Location[2]);
+        break;
+    case CylinderTop:
+        Normal = Vector3D(0, 0, 1);
+        break;
+    case CylinderBottom:
+        Normal = Vector3D(0, 0, -1);
+        break;
+    default:
+        Normal = Vector3D::ZeroVector;
+        break;
+    }
+}
+
 Cone::~Cone()
 {
 }
 
-bool Cone::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+bool Cone::DepthTrace(Ray& R, HitInfo& Hit)
 {
     R.Normalize();
     const Point3D rayOrigin = R.GetOrigin();
@@ -198,69 +153,120 @@ bool Cone::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4&
 
     if (CheckIntersection(R, Bounds))
     {
-        double XD = rayDir[0], YD = rayDir[1], ZD = rayDir[2],
-               XE = rayOrigin[0], YE = rayOrigin[1], ZE = rayOrigin[2], roots[2];
+        Scalar XD = rayDir[0], YD = rayDir[1], ZD = rayDir[2],
+               XE = rayOrigin[0], YE = rayOrigin[1], ZE = rayOrigin[2];
+        double roots[2];
         size_t numRoots = quadraticRoots(XD * XD + YD * YD - ZD * ZD, 2 * XE * XD + 2 * YE * YD - 2 * ZE * ZD, XE * XE + YE * YE - ZE * ZE, roots);
         if (numRoots > 0)
         {
-            std::vector<Point3D> Hits;      // do not use reserve
-            std::vector<Vector3D> Normals;  // do not use reserve
-            Vector3D rayVec = rayDir;
+            // Closest of the side and cap hits inside the ray's range
+            Scalar closestT = std::numeric_limits<Scalar>::infinity();
+            uint32_t closestPart = ConeSide;
 
             // Find cone hit
-            Point3D hitLoc = rayOrigin + roots[0] * rayVec;
-            if (hitLoc[2] > -0.0005f && hitLoc[2] < 1.0005f)
+            for (size_t i = 0; i < numRoots; ++i)
             {
-                Hits.push_back(hitLoc);
-                Normals.push_back(Vector3D(2 * hitLoc[0], 2 * hitLoc[1], -2 * hitLoc[2]));
-            }
-            if (numRoots == 2)
-            {
-                hitLoc = rayOrigin + roots[1] * rayVec;
-                if (hitLoc[2] > -0.0005f && hitLoc[2] < 1.0005f)
+                const Point3D hitLoc = rayOrigin + roots[i] * rayDir;
+                if (roots[i] < closestT && R.InRange(roots[i]) && hitLoc[2] > -0.0005f && hitLoc[2] < 1.0005f)
                 {
-                    Hits.push_back(hitLoc);
-                    Normals.push_back(Vector3D(2 * hitLoc[0], 2 * hitLoc[1], -2 * hitLoc[2]));
+                    closestT = roots[i];
                 }
             }
 
             // Find cone cap hit
-            Vector3D Normal;
-            double S = (1.f - ZE) / ZD;
-            hitLoc = rayOrigin + S * rayVec;
-            if (hitLoc[2] > -0.0005f && hitLoc[2] < 1.0005f && (hitLoc[0]*hitLoc[0] + hitLoc[1]*hitLoc[1]) <= 1.f)
+            const Scalar S = (1.f - ZE) / ZD;
+            const Point3D hitLoc = rayOrigin + S * rayDir;
+            if (S < closestT && R.InRange(S) && hitLoc[2] > -0.0005f && hitLoc[2] < 1.0005f && (hitLoc[0]*hitLoc[0] + hitLoc[1]*hitLoc[1]) <= 1.f)
             {
-                Hits.push_back(hitLoc);
-                Normals.push_back(Vector3D(0, 0, 1));
+                closestT = S;
+                closestPart = ConeCap;
             }
 
-            if (Hits.size() > 0)
+            if (RecordHit(R, closestT, closestPart, Hit))
             {
-                hitLoc = Point3D(std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
-                int i = 0;
-                for (Point3D& P : Hits)
-                {
-                    if ((P - rayOrigin).length2() < (hitLoc - rayOrigin).length2())
-                    {
-                        hitLoc = P;
-                        Normal = Normals[i];
-                    }
-                    ++i;
-                }
-
-                Point3D WorldRay = M * rayOrigin;
-                Point3D WorldHit = M * hitLoc;
-
-                if (clampDist(closestDist, WorldRay, WorldHit, Normal, Hit, M))
-                {
-                    return true;
-                }
+                return true;
             }
         }
     }
     return false;
 }
 
+void Cone::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    Location = Hit.ObjectLocation();
+    if (Hit.PrimID == ConeCap)
+    {
+        Normal = Vector3D(0, 0, 1);
+    }
+    else
+    {
+        Normal = Vector3D(2 * Location[0], 2 * Location[1], -2 * Location[2]);
+    }
+}
+
+Torus::~Torus()
+{
+}
+
+bool Torus::GetQuartic(Scalar OX, Scalar OY, Scalar OZ, Scalar DX, Scalar DY, Scalar DZ, double MinorRadius,
+                       double& Shift, double& Scale, double& A, double& B, double& C, double& D)
+{
+    Scale = 1 / std::sqrt(double(DX) * DX + double(DY) * DY + double(DZ) * DZ);
+    const double UX = DX * Scale, UY = DY * Scale, UZ = DZ * Scale;
+
+    // Closest approach to the centre, less the bounding sphere's radius
+    const double Outer = 1 + MinorRadius;
+    const double Along = -(OX * UX + OY * UY + OZ * UZ);
+    const double Miss2 = double(OX) * OX + double(OY) * OY + double(OZ) * OZ - Along * Along;
+    const double Entry = std::max(Along - Outer, 0.0);
+    Shift = Entry * Scale;
+
+    // (|P|^2 + 1 - r^2)^2 = 4 (Px^2 + Py^2) for P on the ray from its entry
+    const double PX = OX + Entry * UX, PY = OY + Entry * UY, PZ = OZ + Entry * UZ;
+    const double PU = PX * UX + PY * UY + PZ * UZ;
+    const double E = PX * PX + PY * PY + PZ * PZ + 1 - MinorRadius * MinorRadius;
+    A = 4 * PU;
+    B = 4 * PU * PU + 2 * E - 4 * (UX * UX + UY * UY);
+    C = 4 * PU * E - 8 * (PX * UX + PY * UY);
+    D = E * E - 4 * (PX * PX + PY * PY);
+    return Miss2 <= Outer * Outer;
+}
+
+bool Torus::DepthTrace(Ray& R, HitInfo& Hit)
+{
+    R.Normalize();
+    const Vector3D rayDir = R.GetDirection();
+    const Point3D rayOrigin = R.GetOrigin();
+
+    double Shift, Scale, A, B, C, D;
+    if (!GetQuartic(rayOrigin[0], rayOrigin[1], rayOrigin[2], rayDir[0], rayDir[1], rayDir[2], m_minorRadius,
+                    Shift, Scale, A, B, C, D))
+    {
+        return false;
+    }
+
+    double roots[4];
+    const size_t numRoots = quarticRoots(A, B, C, D, roots);
+    Scalar closestT = std::numeric_limits<Scalar>::infinity();
+    for (size_t i = 0; i < numRoots; ++i)
+    {
+        const Scalar t = static_cast<Scalar>(Shift + roots[i] * Scale);
+        if (t < closestT && R.InRange(t))
+        {
+            closestT = t;
+        }
+    }
+    return RecordHit(R, closestT, 0, Hit);
+}
+
+void Torus::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+{
+    // Away from the nearest point of the ring through the tube's centre
+    Location = Hit.ObjectLocation();
+    const Scalar Ring = std::sqrt(Location[0] * Location[0] + Location[1] * Location[1]);
+    Normal = Location - Point3D(Location[0] / Ring, Location[1] / Ring, 0);
+}
+
 NonhierSphere::~NonhierSphere()
 {
 }
@@ -274,65 +280,34 @@ bool NonhierSphere::SimpleTrace(Ray R)
     return (((m_radius * m_radius) - (deltaP - (rayDir.dot(deltaP)) * rayDir).length2()) >= 0);
 }
 
-bool NonhierSphere::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+bool NonhierSphere::DepthTrace(Ray& R, HitInfo& Hit)
 {
-    bool retry;
-    Matrix4x4 Mat = M * m_trans;
-    R.Transform(m_invtrans);
-    R.Normalize();
-
-    do
+    Ray Local(R);
+    Local.Transform(m_invtrans);
+    const Vector3D rayDir = Local.GetDirection();
+
+    const Vector3D deltaP = m_pos - Local.GetOrigin();
+    const Scalar uDotDeltaP = rayDir.dot(deltaP);
+    const Scalar discriminant = (m_radius * m_radius - (deltaP - (uDotDeltaP) * rayDir).length2());
+    if (discriminant < 0)
     {
-        const Point3D rayOrigin = R.GetOrigin();
-        const Vector3D rayDir = R.GetDirection();
-
-        retry = false;
-        Vector3D deltaP = m_pos - rayOrigin;
-        double uDotDeltaP = rayDir.dot(deltaP);
-        double discriminant = (m_radius * m_radius - (deltaP - (uDotDeltaP) * rayDir).length2());
-        if (discriminant >= 0)
-        {
-            double sqrtDisc = sqrt(discriminant);
-            double s = std::min(uDotDeltaP + sqrtDisc, uDotDeltaP - sqrtDisc);
-            if (s < 0)
-            {
-                if (uDotDeltaP + sqrtDisc > 0)
-                {
-                    s = uDotDeltaP + sqrtDisc;
-                }
-                else if (uDotDeltaP - sqrtDisc > 0)
-                {
-                    s = uDotDeltaP - sqrtDisc;
-                }
-                else
-                {
-                    return false;
-                }
-            }
-            Vector3D rayVec = s * rayDir;
-            Point3D hitLoc = rayOrigin + rayVec;
-            Vector3D Normal = (hitLoc - m_pos);
-
-            Point3D WorldRay = Mat * rayOrigin;
-            Point3D WorldHit = Mat * hitLoc;
-
-            if (clampDist(closestDist, WorldRay, WorldHit, Normal, Hit, Mat))
-            {
-                return true;
-            }
+        return false;
+    }
 
-            if (CheckCloseHit(WorldRay, WorldHit))
-            {
-                R.SetOrigin(rayOrigin + EPSILON * rayDir);
-                retry = true;
-            }
-        }
+    // The far side is only hit from inside
+    const Scalar sqrtDisc = sqrt(discriminant);
+    if (RecordHit(Local, uDotDeltaP - sqrtDisc, 0, Hit) || RecordHit(Local, uDotDeltaP + sqrtDisc, 0, Hit))
+    {
+        R.CopyTMax(Local);
+        return true;
     }
-    while (retry);
     return false;
 }
 
-inline bool CheckCloseHit(const Point3D& WorldRay, const Point3D& WorldHit)
+void NonhierSphere::GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
 {
-    return (WorldHit - WorldRay).length2() < EPSILON2;
-}
\ No newline at end of file
+    // Hits are recorded against the unit sphere
+    const Point3D UnitLocation = Hit.ObjectLocation();
+    Location = m_trans * UnitLocation;
+    Normal = m_normalMatrix * (UnitLocation - m_pos);
+}
@@ -0,0 +1,688 @@
+#include "primitivetable.h"
+#include "bvhinterleave.h"
+#include "polyroots.hpp"
+#include "scene.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+// Nearest root of a lane inside the ray's range, infinity if there is none
+inline Scalar ClosestRoot(Scalar tMin, Scalar tMax, size_t NumRoots, Scalar Root0, Scalar Root1)
+{
+    Scalar t = std::numeric_limits<Scalar>::infinity();
+    if (NumRoots > 0 && Root0 > tMin && Root0 < tMax)
+    {
+        t = Root0;
+    }
+    if (NumRoots > 1 && Root1 > tMin && Root1 < tMax)
+    {
+        t = std::min(t, Root1);
+    }
+    return t;
+}
+
+// Primitives whose parts move on their own are traced at the time, the rest where they are
+template<typename PrimType>
+RT_KERNEL_INLINE bool TracePrimitive(PrimType& Prim, Ray& R, HitInfo& Hit, const double& Time)
+{
+    (void)Time;
+    return Prim.DepthTrace(R, Hit);
+}
+
+RT_KERNEL_INLINE bool TracePrimitive(Particles& Prim, Ray& R, HitInfo& Hit, const double& Time)
+{
+    return Prim.TimeTrace(R, Hit, Time);
+}
+
+RT_KERNEL_INLINE bool TracePrimitive(Primitive& Prim, Ray& R, HitInfo& Hit, const double& Time)
+{
+    return Prim.TimeTrace(R, Hit, Time);
+}
+
+// The primitives with trees of their own trace several rays interleaved
+RT_KERNEL_INLINE void TracePrimitiveInterleaved(const Mesh& Prim, Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, const double& Time)
+{
+    (void)Time;
+    Prim.DepthTraceInterleaved(Rays, Hits, bHits, Count);
+}
+
+RT_KERNEL_INLINE void TracePrimitiveInterleaved(const Particles& Prim, Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, const double& Time)
+{
+    Prim.TimeTraceInterleaved(Rays, Hits, bHits, Count, Time);
+}
+
+static_assert(MaxPacketRays <= MaxInterleavedRays, "A packet's rays must fit in one interleaved trace");
+}
+
+PrimitiveTable::PrimitiveTable(const std::vector<std::unique_ptr<SceneNode>>& Nodes)
+{
+    m_refs.reserve(Nodes.size());
+    for (auto& S : Nodes)
+    {
+        GeometryNode* Node = dynamic_cast<GeometryNode*>(S.get());
+        if (!Node)
+        {
+            continue;
+        }
+
+        Primitive* Prim = Node->GetPrimitive();
+        if (Sphere* P = dynamic_cast<Sphere*>(Prim))
+        {
+            Add(m_spheres, PrimitiveType::Sphere, Node->GetToLocal(), Node->GetVelocity(), P->GetCenter(), P->GetRadius(), *Node);
+        }
+        else if (NonhierSphere* P = dynamic_cast<NonhierSphere*>(Prim))
+        {
+            // Traced in the space the sphere records its hits in
+            Add(m_spheres, PrimitiveType::Sphere, P->GetToUnit() * Node->GetToLocal(), P->GetToUnit() * Node->GetVelocity(),
+                P->GetCenter(), P->GetRadius(), *Node);
+        }
+        else if (Cube* P = dynamic_cast<Cube*>(Prim))
+        {
+            Add(m_cubes, PrimitiveType::Cube, P, *Node);
+        }
+        else if (dynamic_cast<Cylinder*>(Prim))
+        {
+            Add(m_cylinders, PrimitiveType::Cylinder, Node->GetToLocal(), Node->GetVelocity(), Point3D(), 1.0, *Node);
+        }
+        else if (dynamic_cast<Cone*>(Prim))
+        {
+            Add(m_cones, PrimitiveType::Cone, Node->GetToLocal(), Node->GetVelocity(), Point3D(), 1.0, *Node);
+        }
+        else if (Torus* P = dynamic_cast<Torus*>(Prim))
+        {
+            Add(m_tori, PrimitiveType::Torus, Node->GetToLocal(), Node->GetVelocity(), Point3D(), P->GetMinorRadius(), *Node);
+        }
+        else if (Mesh* P = dynamic_cast<Mesh*>(Prim))
+        {
+            Add(m_meshes, PrimitiveType::Mesh, P, *Node);
+        }
+        else if (Particles* P = dynamic_cast<Particles*>(Prim))
+        {
+            Add(m_particles, PrimitiveType::Particles, P, *Node);
+        }
+        else
+        {
+            Add(m_others, PrimitiveType::Other, Prim, *Node);
+        }
+    }
+}
+
+template<typename PrimType>
+void PrimitiveTable::Add(Batch<PrimType>& Batch, PrimitiveType Type, PrimType* Prim, GeometryNode& Node)
+{
+    PrimitiveRef Ref;
+    Ref.Type = Type;
+    Ref.Index = static_cast<uint32_t>(Batch.size());
+    Ref.Bounds = Node.GetBox();
+    m_refs.push_back(Ref);
+
+    Instance<PrimType> I;
+    I.ToLocal = Node.GetToLocal();
+    I.Velocity = Node.GetVelocity();
+    I.bMoving = I.Velocity != Vector3D::ZeroVector;
+    I.Prim = Prim;
+    I.Node = &Node;
+    Batch.push_back(I);
+}
+
+void PrimitiveTable::Add(QuadricBatch& Batch, PrimitiveType Type, const AffineTransform& ToLocal, const Vector3D& Velocity,
+                         const Point3D& Center, Scalar Radius, GeometryNode& Node)
+{
+    PrimitiveRef Ref;
+    Ref.Type = Type;
+    Ref.Index = static_cast<uint32_t>(Batch.Nodes.size());
+    Ref.Bounds = Node.GetBox();
+    m_refs.push_back(Ref);
+
+    for (size_t i = 0; i < 12; ++i)
+    {
+        Batch.ToLocal[i].push_back(ToLocal[i / 4][i % 4]);
+    }
+    for (size_t i = 0; i < 3; ++i)
+    {
+        Batch.Velocity[i].push_back(Velocity[i]);
+        Batch.Center[i].push_back(Center[i]);
+    }
+    Batch.Radius2.push_back(Radius * Radius);
+    Batch.Nodes.push_back(&Node);
+}
+
+RT_KERNEL_INLINE void PrimitiveTable::LocalRay(const QuadricBatch& Batch, size_t i, const Point3D& Origin, const Vector3D& Direction,
+                                               Scalar LocalTime, Scalar& OX, Scalar& OY, Scalar& OZ, Scalar& DX, Scalar& DY, Scalar& DZ)
+{
+    const Scalar M0 = Batch.ToLocal[0][i], M1 = Batch.ToLocal[1][i], M2 = Batch.ToLocal[2][i], M3 = Batch.ToLocal[3][i];
+    const Scalar M4 = Batch.ToLocal[4][i], M5 = Batch.ToLocal[5][i], M6 = Batch.ToLocal[6][i], M7 = Batch.ToLocal[7][i];
+    const Scalar M8 = Batch.ToLocal[8][i], M9 = Batch.ToLocal[9][i], M10 = Batch.ToLocal[10][i], M11 = Batch.ToLocal[11][i];
+
+    DX = M0 * Direction[0] + M1 * Direction[1] + M2 * Direction[2];
+    DY = M4 * Direction[0] + M5 * Direction[1] + M6 * Direction[2];
+    DZ = M8 * Direction[0] + M9 * Direction[1] + M10 * Direction[2];
+    OX = M0 * Origin[0] + M1 * Origin[1] + M2 * Origin[2] + M3 - LocalTime * Batch.Velocity[0][i];
+    OY = M4 * Origin[0] + M5 * Origin[1] + M6 * Origin[2] + M7 - LocalTime * Batch.Velocity[1][i];
+    OZ = M8 * Origin[0] + M9 * Origin[1] + M10 * Origin[2] + M11 - LocalTime * Batch.Velocity[2][i];
+}
+
+template<typename PrimType>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceInstance(const Instance<PrimType>& I, Ray& R, HitInfo& Hit, const double& Time)
+{
+    // Same as GeometryNode::TimeTrace
+    Ray Local(R);
+    Local.Transform(I.ToLocal);
+    if (I.bMoving)
+    {
+        Local.SetOrigin(Local.GetOrigin() - Time * I.Velocity);
+    }
+
+    // The primitive classes are final so this is a direct call
+    if (TracePrimitive(*I.Prim, Local, Hit, Time))
+    {
+        R.CopyTMax(Local);
+        Hit.Node = I.Node;
+        return true;
+    }
+    return false;
+}
+
+template<typename PrimType>
+RT_KERNEL_INLINE void PrimitiveTable::TraceInstanceInterleaved(const Instance<PrimType>& I, RayPacket& Packet, uint32_t Active,
+                                                               HitInfo Hits[], bool bHits[], const double& Time)
+{
+    Ray Local[MaxPacketRays];
+    HitInfo* LocalHits[MaxPacketRays];
+    bool bLocalHits[MaxPacketRays];
+    size_t Slots[MaxPacketRays];
+    size_t num = 0;
+    for (size_t i = 0; i < Packet.Num(); ++i)
+    {
+        if (Active & (uint32_t(1) << i))
+        {
+            Local[num] = Packet[i];
+            Local[num].Transform(I.ToLocal);
+            if (I.bMoving)
+            {
+                Local[num].SetOrigin(Local[num].GetOrigin() - Time * I.Velocity);
+            }
+            LocalHits[num] = &Hits[i];
+            Slots[num++] = i;
+        }
+    }
+
+    TracePrimitiveInterleaved(*I.Prim, Local, LocalHits, bLocalHits, num, Time);
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (bLocalHits[i])
+        {
+            Packet[Slots[i]].CopyTMax(Local[i]);
+            Hits[Slots[i]].Node = I.Node;
+            bHits[Slots[i]] = true;
+        }
+    }
+}
+
+template<typename Query, typename PrimType>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceBatch(const Batch<PrimType>& Batch, Ray& R, HitInfo& Hit, const double& Time)
+{
+    bool bHit = false;
+    for (const Instance<PrimType>& I : Batch)
+    {
+        if (TraceInstance(I, R, Hit, Time))
+        {
+            bHit = true;
+            if (Query::bAnyHit)
+            {
+                break;
+            }
+        }
+    }
+    return bHit;
+}
+
+template<PrimitiveTable::QuadricShape Shape>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceQuadrics(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                                   Ray& R, HitInfo& Hit, const double& Time)
+{
+    const Point3D Origin = R.GetOrigin();
+    const Vector3D Direction = R.GetDirection();
+    const Scalar tMin = R.GetTMin();
+    const Scalar LocalTime = static_cast<Scalar>(Time);
+
+    // The local rays are not normalized so their t is the same as R's
+    Scalar OX[QUADRATIC_BATCH], OY[QUADRATIC_BATCH], OZ[QUADRATIC_BATCH];
+    Scalar DX[QUADRATIC_BATCH], DY[QUADRATIC_BATCH], DZ[QUADRATIC_BATCH];
+    Scalar A[QUADRATIC_BATCH], B[QUADRATIC_BATCH], C[QUADRATIC_BATCH];
+    Scalar Roots0[QUADRATIC_BATCH], Roots1[QUADRATIC_BATCH];
+    size_t NumRoots[QUADRATIC_BATCH];
+
+    bool bHit = false;
+    for (size_t Start = 0; Start < Count; Start += QUADRATIC_BATCH)
+    {
+        const size_t Lanes = std::min(Count - Start, static_cast<size_t>(QUADRATIC_BATCH));
+
+        // Local rays and quadratic coefficients of every lane
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            const size_t i = Indices ? Indices[Start + l] : First + Start + l;
+            LocalRay(Batch, i, Origin, Direction, LocalTime, OX[l], OY[l], OZ[l], DX[l], DY[l], DZ[l]);
+
+            switch (Shape)
+            {
+            case QuadricShape::Sphere:
+            {
+                const Scalar EX = OX[l] - Batch.Center[0][i], EY = OY[l] - Batch.Center[1][i], EZ = OZ[l] - Batch.Center[2][i];
+                A[l] = DX[l] * DX[l] + DY[l] * DY[l] + DZ[l] * DZ[l];
+                B[l] = 2 * (EX * DX[l] + EY * DY[l] + EZ * DZ[l]);
+                C[l] = EX * EX + EY * EY + EZ * EZ - Batch.Radius2[i];
+                break;
+            }
+            case QuadricShape::Cylinder:
+                A[l] = DX[l] * DX[l] + DY[l] * DY[l];
+                B[l] = 2 * OX[l] * DX[l] + 2 * OY[l] * DY[l];
+                C[l] = OX[l] * OX[l] + OY[l] * OY[l] - 1;
+                break;
+            case QuadricShape::Cone:
+                A[l] = DX[l] * DX[l] + DY[l] * DY[l] - DZ[l] * DZ[l];
+                B[l] = 2 * OX[l] * DX[l] + 2 * OY[l] * DY[l] - 2 * OZ[l] * DZ[l];
+                C[l] = OX[l] * OX[l] + OY[l] * OY[l] - OZ[l] * OZ[l];
+                break;
+            }
+        }
+
+        quadraticRoots(Lanes, A, B, C, Roots0, Roots1, NumRoots);
+
+        // Pick each lane's hit the way its DepthTrace would and keep the closest
+        const Scalar tMax = R.GetTMax();
+        Scalar tBest = tMax;
+        size_t Best = Lanes;
+        uint32_t BestPart = 0;
+        for (size_t l = 0; l < Lanes; ++l)
+        {
+            Scalar t = std::numeric_limits<Scalar>::infinity();
+            uint32_t Part = 0;
+            switch (Shape)
+            {
+            case QuadricShape::Sphere:
+                t = ClosestRoot(tMin, tMax, NumRoots[l], Roots0[l], Roots1[l]);
+                break;
+            case QuadricShape::Cylinder:
+                if (NumRoots[l] > 0)
+                {
+                    // A single root is a ray grazing the side, as in Cylinder::DepthTrace
+                    Scalar s = Roots0[l];
+                    Part = CylinderTangent;
+                    if (NumRoots[l] == 2)
+                    {
+                        // Rays starting inside the infinite cylinder can only hit a cap
+                        const Scalar Near = std::max(std::min(Roots0[l], Roots1[l]), Scalar(0));
+                        const Scalar Far = std::max(Roots0[l], Roots1[l]);
+                        const Scalar NearZ = OZ[l] + Near * DZ[l], FarZ = OZ[l] + Far * DZ[l];
+                        s = Near;
+                        Part = CylinderSide;
+                        if (NearZ > 1.f && FarZ < 1.f)
+                        {
+                            s = (1.f - OZ[l]) / DZ[l];
+                            Part = CylinderTop;
+                        }
+                        else if (NearZ < -1.f && FarZ > -1.f)
+                        {
+                            s = (-1.f - OZ[l]) / DZ[l];
+                            Part = CylinderBottom;
+                        }
+                    }
+
+                    const Scalar HitZ = OZ[l] + s * DZ[l];
+                    if (s > tMin && s < tMax && HitZ > -1.005f && HitZ < 1.005f)
+                    {
+                        t = s;
+                    }
+                }
+                break;
+            case QuadricShape::Cone:
+                if (NumRoots[l] > 0)
+                {
+                    for (size_t r = 0; r < NumRoots[l]; ++r)
+                    {
+                        const Scalar s = r == 0 ? Roots0[l] : Roots1[l];
+                        const Scalar HitZ = OZ[l] + s * DZ[l];
+                        if (s < t && s > tMin && s < tMax && HitZ > -0.0005f && HitZ < 1.0005f)
+                        {
+                            t = s;
+                        }
+                    }
+
+                    const Scalar S = (1.f - OZ[l]) / DZ[l];
+                    const Scalar HitX = OX[l] + S * DX[l], HitY = OY[l] + S * DY[l], HitZ = OZ[l] + S * DZ[l];
+                    if (S < t && S > tMin && S < tMax && HitZ > -0.0005f && HitZ < 1.0005f && HitX * HitX + HitY * HitY <= 1.f)
+                    {
+                        t = S;
+                        Part = ConeCap;
+                    }
+                }
+                break;
+            }
+
+            if (t < tBest)
+            {
+                tBest = t;
+                Best = l;
+                BestPart = Part;
+            }
+        }
+
+        if (Best < Lanes)
+        {
+            const size_t i = Indices ? Indices[Start + Best] : First + Start + Best;
+            R.SetTMax(tBest);
+            Hit.T = tBest;
+            Hit.RayOrigin = Point3D(OX[Best], OY[Best], OZ[Best]);
+            Hit.RayDirection = Vector3D(DX[Best], DY[Best], DZ[Best]);
+            Hit.PrimID = BestPart;
+            Hit.Node = Batch.Nodes[i];
+            bHit = true;
+        }
+    }
+    return bHit;
+}
+
+RT_KERNEL_INLINE bool PrimitiveTable::TraceTori(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                                                Ray& R, HitInfo& Hit, const double& Time)
+{
+    const Point3D Origin = R.GetOrigin();
+    const Vector3D Direction = R.GetDirection();
+    const Scalar tMin = R.GetTMin();
+    const Scalar LocalTime = static_cast<Scalar>(Time);
+
+    // Only the instances whose bounding sphere the ray passes through are gathered into
+    // lanes, a quartic costs too much to solve for every instance like the quadrics do
+    Scalar OX[QUARTIC_BATCH], OY[QUARTIC_BATCH], OZ[QUARTIC_BATCH];
+    Scalar DX[QUARTIC_BATCH], DY[QUARTIC_BATCH], DZ[QUARTIC_BATCH];
+    double Shift[QUARTIC_BATCH], Scale[QUARTIC_BATCH];
+    double A[QUARTIC_BATCH], B[QUARTIC_BATCH], C[QUARTIC_BATCH], D[QUARTIC_BATCH];
+    double Roots[4][QUARTIC_BATCH];
+    size_t Instances[QUARTIC_BATCH];
+    size_t Lanes = 0;
+
+    bool bHit = false;
+    for (size_t n = 0; n < Count; ++n)
+    {
+        const size_t i = Indices ? Indices[n] : First + n;
+        const size_t l = Lanes;
+        LocalRay(Batch, i, Origin, Direction, LocalTime, OX[l], OY[l], OZ[l], DX[l], DY[l], DZ[l]);
+        if (Torus::GetQuartic(OX[l], OY[l], OZ[l], DX[l], DY[l], DZ[l], std::sqrt(Batch.Radius2[i]),
+                              Shift[l], Scale[l], A[l], B[l], C[l], D[l]))
+        {
+            Instances[Lanes++] = i;
+        }
+        if (Lanes < QUARTIC_BATCH && n + 1 < Count)
+        {
+            continue;
+        }
+
+        quarticRoots(Lanes, A, B, C, D, Roots[0], Roots[1], Roots[2], Roots[3]);
+
+        // Missing roots are HUGE_VAL, so t is infinite and never in range
+        Scalar tBest = R.GetTMax();
+        size_t Best = Lanes;
+        for (size_t Lane = 0; Lane < Lanes; ++Lane)
+        {
+            for (size_t r = 0; r < 4; ++r)
+            {
+                const Scalar t = static_cast<Scalar>(Shift[Lane] + Roots[r][Lane] * Scale[Lane]);
+                if (t > tMin && t < tBest)
+                {
+                    tBest = t;
+                    Best = Lane;
+                }
+            }
+        }
+
+        if (Best < Lanes)
+        {
+            R.SetTMax(tBest);
+            Hit.T = tBest;
+            Hit.RayOrigin = Point3D(OX[Best], OY[Best], OZ[Best]);
+            Hit.RayDirection = Vector3D(DX[Best], DY[Best], DZ[Best]);
+            Hit.PrimID = 0;
+            Hit.Node = Batch.Nodes[Instances[Best]];
+            bHit = true;
+        }
+        Lanes = 0;
+    }
+    return bHit;
+}
+
+// A build of each quadric kernel per CpuLevel
+#define TRACE_QUADRICS_AT(Shape, Level, Target) \
+    template<> Target bool PrimitiveTable::TraceQuadricsAt<PrimitiveTable::QuadricShape::Shape, Level>(const QuadricBatch& Batch, \
+        const uint32_t* Indices, size_t First, size_t Count, Ray& R, HitInfo& Hit, const double& Time) \
+    { \
+        return TraceQuadrics<QuadricShape::Shape>(Batch, Indices, First, Count, R, Hit, Time); \
+    }
+#define TRACE_AT(Level, Target) \
+    TRACE_QUADRICS_AT(Sphere, Level, Target) \
+    TRACE_QUADRICS_AT(Cylinder, Level, Target) \
+    TRACE_QUADRICS_AT(Cone, Level, Target) \
+    template<> Target bool PrimitiveTable::TraceToriAt<Level>(const QuadricBatch& Batch, const uint32_t* Indices, \
+        size_t First, size_t Count, Ray& R, HitInfo& Hit, const double& Time) \
+    { \
+        return TraceTori(Batch, Indices, First, Count, R, Hit, Time); \
+    }
+RT_FOR_EACH_CPU_LEVEL(TRACE_AT)
+#undef TRACE_AT
+#undef TRACE_QUADRICS_AT
+
+template<CpuLevel Level, typename Query>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceAll(Ray& R, HitInfo& Hit, const double& Time) const
+{
+    // Any-hit queries stop after the first batch that is hit
+    bool bHit = false;
+    const auto Done = [&](bool bBatchHit) RT_KERNEL_LAMBDA
+    {
+        bHit = bBatchHit || bHit;
+        return Query::bAnyHit && bHit;
+    };
+    Done(TraceQuadricsAt<QuadricShape::Sphere, Level>(m_spheres, nullptr, 0, m_spheres.Nodes.size(), R, Hit, Time)) ||
+    Done(TraceBatch<Query>(m_cubes, R, Hit, Time)) ||
+    Done(TraceQuadricsAt<QuadricShape::Cylinder, Level>(m_cylinders, nullptr, 0, m_cylinders.Nodes.size(), R, Hit, Time)) ||
+    Done(TraceQuadricsAt<QuadricShape::Cone, Level>(m_cones, nullptr, 0, m_cones.Nodes.size(), R, Hit, Time)) ||
+    Done(TraceToriAt<Level>(m_tori, nullptr, 0, m_tori.Nodes.size(), R, Hit, Time)) ||
+    Done(TraceBatch<Query>(m_meshes, R, Hit, Time)) ||
+    Done(TraceBatch<Query>(m_particles, R, Hit, Time)) ||
+    Done(TraceBatch<Query>(m_others, R, Hit, Time));
+    return bHit;
+}
+
+template<CpuLevel Level>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceRef(const PrimitiveRef& Ref, Ray& R, HitInfo& Hit, const double& Time) const
+{
+    switch (Ref.Type)
+    {
+    case PrimitiveType::Sphere:
+        return TraceQuadricsAt<QuadricShape::Sphere, Level>(m_spheres, nullptr, Ref.Index, 1, R, Hit, Time);
+    case PrimitiveType::Cube:
+        return TraceInstance(m_cubes[Ref.Index], R, Hit, Time);
+    case PrimitiveType::Cylinder:
+        return TraceQuadricsAt<QuadricShape::Cylinder, Level>(m_cylinders, nullptr, Ref.Index, 1, R, Hit, Time);
+    case PrimitiveType::Cone:
+        return TraceQuadricsAt<QuadricShape::Cone, Level>(m_cones, nullptr, Ref.Index, 1, R, Hit, Time);
+    case PrimitiveType::Torus:
+        return TraceToriAt<Level>(m_tori, nullptr, Ref.Index, 1, R, Hit, Time);
+    case PrimitiveType::Mesh:
+        return TraceInstance(m_meshes[Ref.Index], R, Hit, Time);
+    case PrimitiveType::Particles:
+        return TraceInstance(m_particles[Ref.Index], R, Hit, Time);
+    case PrimitiveType::Other:
+        return TraceInstance(m_others[Ref.Index], R, Hit, Time);
+    }
+    return false;
+}
+
+template<CpuLevel Level, typename Query, bool bSkipInterleaved>
+RT_KERNEL_INLINE bool PrimitiveTable::TraceRefs(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const
+{
+    // Quadrics and tori are gathered per shape and traced a full batch at a time
+    uint32_t Spheres[QUADRATIC_BATCH], Cylinders[QUADRATIC_BATCH], Cones[QUADRATIC_BATCH], Tori[QUARTIC_BATCH];
+    size_t NumSpheres = 0, NumCylinders = 0, NumCones = 0, NumTori = 0;
+
+    bool bHit = false;
+    for (size_t i = 0; i < Refs.Num(); ++i)
+    {
+        const PrimitiveRef& Ref = *Refs[i];
+        switch (Ref.Type)
+        {
+        case PrimitiveType::Sphere:
+            Spheres[NumSpheres++] = Ref.Index;
+            if (NumSpheres == QUADRATIC_BATCH)
+            {
+                bHit = TraceQuadricsAt<QuadricShape::Sphere, Level>(m_spheres, Spheres, 0, NumSpheres, R, Hit, Time) || bHit;
+                NumSpheres = 0;
+            }
+            break;
+        case PrimitiveType::Cylinder:
+            Cylinders[NumCylinders++] = Ref.Index;
+            if (NumCylinders == QUADRATIC_BATCH)
+            {
+                bHit = TraceQuadricsAt<QuadricShape::Cylinder, Level>(m_cylinders, Cylinders, 0, NumCylinders, R, Hit, Time) || bHit;
+                NumCylinders = 0;
+            }
+            break;
+        case PrimitiveType::Cone:
+            Cones[NumCones++] = Ref.Index;
+            if (NumCones == QUADRATIC_BATCH)
+            {
+                bHit = TraceQuadricsAt<QuadricShape::Cone, Level>(m_cones, Cones, 0, NumCones, R, Hit, Time) || bHit;
+                NumCones = 0;
+            }
+            break;
+        case PrimitiveType::Torus:
+            Tori[NumTori++] = Ref.Index;
+            if (NumTori == QUARTIC_BATCH)
+            {
+                bHit = TraceToriAt<Level>(m_tori, Tori, 0, NumTori, R, Hit, Time) || bHit;
+                NumTori = 0;
+            }
+            break;
+        case PrimitiveType::Mesh:
+        case PrimitiveType::Particles:
+            if (!bSkipInterleaved)
+            {
+                bHit = TraceRef<Level>(Ref, R, Hit, Time) || bHit;
+            }
+            break;
+        default:
+            bHit = TraceRef<Level>(Ref, R, Hit, Time) || bHit;
+            break;
+        }
+
+        if (Query::bAnyHit && bHit)
+        {
+            return true;
+        }
+    }
+
+    bHit = TraceQuadricsAt<QuadricShape::Sphere, Level>(m_spheres, Spheres, 0, NumSpheres, R, Hit, Time) || bHit;
+    bHit = TraceQuadricsAt<QuadricShape::Cylinder, Level>(m_cylinders, Cylinders, 0, NumCylinders, R, Hit, Time) || bHit;
+    bHit = TraceQuadricsAt<QuadricShape::Cone, Level>(m_cones, Cones, 0, NumCones, R, Hit, Time) || bHit;
+    bHit = TraceToriAt<Level>(m_tori, Tori, 0, NumTori, R, Hit, Time) || bHit;
+    return bHit;
+}
+
+template<CpuLevel Level>
+RT_KERNEL_INLINE void PrimitiveTable::TracePacketRefs(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, HitInfo Hits[],
+                                                      bool bHits[], const double& Time) const
+{
+    // A lone ray has nothing to interleave with
+    const bool bInterleave = (Active & (Active - 1)) != 0;
+    if (bInterleave)
+    {
+        for (size_t i = 0; i < Refs.Num(); ++i)
+        {
+            const PrimitiveRef& Ref = *Refs[i];
+            if (Ref.Type == PrimitiveType::Mesh)
+            {
+                TraceInstanceInterleaved(m_meshes[Ref.Index], Packet, Active, Hits, bHits, Time);
+            }
+            else if (Ref.Type == PrimitiveType::Particles)
+            {
+                TraceInstanceInterleaved(m_particles[Ref.Index], Packet, Active, Hits, bHits, Time);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < Packet.Num(); ++i)
+    {
+        if (!(Active & (uint32_t(1) << i)))
+        {
+            continue;
+        }
+        const bool bHit = bInterleave ? TraceRefs<Level, ClosestHitQuery, true>(Refs, Packet[i], Hits[i], Time)
+                          : TraceRefs<Level, ClosestHitQuery>(Refs, Packet[i], Hits[i], Time);
+        if (bHit)
+        {
+            bHits[i] = true;
+        }
+    }
+}
+
+// And of the whole table and octree node traces, those also per kind of query
+#define TRACE_QUERY_AT(Query, Level, Target) \
+    template<> Target bool PrimitiveTable::TraceAt<Level, Query>(Ray& R, HitInfo& Hit, const double& Time) const \
+    { \
+        return TraceAll<Level, Query>(R, Hit, Time); \
+    } \
+    template<> Target bool PrimitiveTable::TraceAt<Level, Query>(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, \
+        const double& Time) const \
+    { \
+        return TraceRefs<Level, Query>(Refs, R, Hit, Time); \
+    }
+#define TRACE_AT(Level, Target) \
+    RT_FOR_EACH_TRACE_QUERY(TRACE_QUERY_AT, Level, Target) \
+    template<> Target void PrimitiveTable::TraceAt<Level>(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, \
+        HitInfo Hits[], bool bHits[], const double& Time) const \
+    { \
+        TracePacketRefs<Level>(Refs, Packet, Active, Hits, bHits, Time); \
+    }
+RT_FOR_EACH_CPU_LEVEL(TRACE_AT)
+#undef TRACE_AT
+#undef TRACE_QUERY_AT
+
+template<typename Query>
+bool PrimitiveTable::Trace(Ray& R, HitInfo& Hit, const double& Time) const
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return TraceAt<decltype(Level)::value, Query>(R, Hit, Time);
+    });
+}
+
+bool PrimitiveTable::Trace(const PrimitiveRef& Ref, Ray& R, HitInfo& Hit, const double& Time) const
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return TraceRef<decltype(Level)::value>(Ref, R, Hit, Time);
+    });
+}
+
+template<typename Query>
+bool PrimitiveTable::Trace(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return TraceAt<decltype(Level)::value, Query>(Refs, R, Hit, Time);
+    });
+}
+
+#define TRACE_QUERY(Query, ...) \
+    template bool PrimitiveTable::Trace<Query>(Ray& R, HitInfo& Hit, const double& Time) const; \
+    template bool PrimitiveTable::Trace<Query>(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const;
+RT_FOR_EACH_TRACE_QUERY(TRACE_QUERY, )
+#undef TRACE_QUERY
+
+void PrimitiveTable::Trace(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, HitInfo Hits[], bool bHits[],
+                           const double& Time) const
+{
+    DispatchCpu([&](auto Level)
+    {
+        TraceAt<decltype(Level)::value>(Refs, Packet, Active, Hits, bHits, Time);
+    });
+}
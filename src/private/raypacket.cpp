@@ -0,0 +1,94 @@
+#include "raypacket.h"
+#include <algorithm>
+#include <cassert>
+
+RayPacket::RayPacket() :
+    m_count(0)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        std::fill(m_origin[axis], m_origin[axis] + MaxPacketRays, Scalar(0));
+        std::fill(m_aabbDiv[axis], m_aabbDiv[axis] + MaxPacketRays, Scalar(0));
+    }
+}
+
+void RayPacket::Add(const Ray& R)
+{
+    // Callers split their rays into packets, a full one means rays would go missing
+    assert(m_count < MaxPacketRays);
+    if (m_count == MaxPacketRays)
+    {
+        return;
+    }
+
+    const Point3D Origin = R.GetOrigin();
+    const Vector3D AABBDiv = R.GetAABBDiv();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        m_origin[axis][m_count] = Origin[axis];
+        m_aabbDiv[axis][m_count] = AABBDiv[axis];
+    }
+    m_rays[m_count++] = R;
+}
+
+RT_KERNEL_INLINE uint32_t RayPacket::TestBox(const BoxF& Box, uint32_t Active) const
+{
+    const Scalar Left = Box.GetLeft(), Right = Box.GetRight();
+    const Scalar Bottom = Box.GetBottom(), Top = Box.GetTop();
+    const Scalar Back = Box.GetBack(), Front = Box.GetFront();
+
+    Scalar RayTMax[MaxPacketRays] = {};
+    for (size_t i = 0; i < m_count; ++i)
+    {
+        RayTMax[i] = m_rays[i].GetTMax();
+    }
+
+    // Every slot, in the same steps as Contains and DoIntersect so each ray gets
+    // the answer CheckIntersection would give it
+    int Pass[MaxPacketRays];
+    for (size_t i = 0; i < MaxPacketRays; ++i)
+    {
+        const Scalar OX = m_origin[0][i], OY = m_origin[1][i], OZ = m_origin[2][i];
+        const bool bInside = (OX >= Left) & (OX <= Right) & (OY >= Bottom) & (OY <= Top) & (OZ >= Back) & (OZ <= Front);
+
+        const Scalar tx1 = (Left - OX) * m_aabbDiv[0][i];
+        const Scalar tx2 = (Right - OX) * m_aabbDiv[0][i];
+        Scalar tMin = std::min(tx1, tx2);
+        Scalar tMax = std::max(tx1, tx2);
+
+        const Scalar ty1 = (Bottom - OY) * m_aabbDiv[1][i];
+        const Scalar ty2 = (Top - OY) * m_aabbDiv[1][i];
+        tMin = std::max(tMin, std::min(ty1, ty2));
+        tMax = std::min(tMax, std::max(ty1, ty2));
+
+        const Scalar tz1 = (Back - OZ) * m_aabbDiv[2][i];
+        const Scalar tz2 = (Front - OZ) * m_aabbDiv[2][i];
+        tMin = std::max(tMin, std::min(tz1, tz2));
+        tMax = std::min(tMax, std::max(tz1, tz2));
+
+        Pass[i] = bInside | ((tMax >= std::max(Scalar(0), tMin)) & (tMin < RayTMax[i]));
+    }
+
+    uint32_t Mask = 0;
+    for (size_t i = 0; i < MaxPacketRays; ++i)
+    {
+        Mask |= uint32_t(Pass[i]) << i;
+    }
+    return Mask & Active;
+}
+
+#define CHECK_INTERSECTION_AT(Level, Target) \
+    template<> Target uint32_t RayPacket::CheckIntersectionAt<Level>(const BoxF& Box, uint32_t Active) const \
+    { \
+        return TestBox(Box, Active); \
+    }
+RT_FOR_EACH_CPU_LEVEL(CHECK_INTERSECTION_AT)
+#undef CHECK_INTERSECTION_AT
+
+uint32_t RayPacket::CheckIntersection(const BoxF& Box, uint32_t Active) const
+{
+    return DispatchCpu([&](auto Level)
+    {
+        return CheckIntersectionAt<decltype(Level)::value>(Box, Active);
+    });
+}
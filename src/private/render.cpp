@@ -1,18 +1,70 @@
 #include "render.hpp"
 #include "image.hpp"
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <memory>
 #include <vector>
+#include "approxmath.h"
 #include "octree.h"
 #include "scenecontainer.h"
 #include "PixelQueue.h"
+#include "ThreadPool.h"
+#include "raypacket.h"
 
 atomic_int PROGRESS(0);
 
 // TODO: get rid of all globals
 size_t numThreads = 1, SuperSamples = 1; // AA
+size_t PacketSize = 1;
 bool bUseOctree = false, bUseAdaptive = false;
+bool bUseWavefront = false;
+
+// Pixels a WavefrontThread takes from the queue at a time
+static const size_t WavefrontPixels = 256;
+
+// Pixels RenderPixelRuns takes from the queue at a time, a row of a default tile
+static const size_t PacketRunPixels = 16;
+
+// Equally distributed super-samples (grid) of pixel (x, y), or its centre without them
+template<typename CameraType>
+static void GetSubSampleRays(const CameraType& Cam, int x, int y, int SuperSamples, std::vector<Ray>& Rays)
+{
+    if (SuperSamples <= 1)
+    {
+        Rays.push_back(Cam.template GetRayThroughPixelAs<CameraType>(x, y, 0.5f, 0.5f));
+        return;
+    }
+
+    const double halfSubWidth = 0.5 / SuperSamples;
+    for (double i = halfSubWidth; i < 1; i += halfSubWidth * 2)
+    {
+        for (double j = halfSubWidth; j < 1; j += halfSubWidth * 2)
+        {
+            Rays.push_back(Cam.template GetRayThroughPixelAs<CameraType>(x, y, i, j));
+        }
+    }
+}
+
+// Make a Sampler thread for a camera of type LenseCamera if bLense, else PointCamera, and a
+// scene in an OctreeSceneContainer if bOctree
+template<typename Sampler, typename... Args>
+static std::unique_ptr<RenderThread> CreateRenderThread(bool bLense, bool bOctree, Args&&... args)
+{
+    if (bLense)
+    {
+        if (bOctree)
+        {
+            return std::make_unique<TypedRenderThread<Sampler, LenseCamera, OctreeSceneContainer>>(std::forward<Args>(args)...);
+        }
+        return std::make_unique<TypedRenderThread<Sampler, LenseCamera, SceneContainer>>(std::forward<Args>(args)...);
+    }
+    if (bOctree)
+    {
+        return std::make_unique<TypedRenderThread<Sampler, PointCamera, OctreeSceneContainer>>(std::forward<Args>(args)...);
+    }
+    return std::make_unique<TypedRenderThread<Sampler, PointCamera, SceneContainer>>(std::forward<Args>(args)...);
+}
 
 void render( // What to render
     std::unique_ptr<SceneNode>&& root,
@@ -33,6 +85,10 @@ void render( // What to render
     // Scene setup
     std::vector<std::unique_ptr<SceneNode>> List;
     root->FlattenScene(List);
+    for (auto& Node : List)
+    {
+        Node->CacheMotion(TimeDuration);
+    }
 
     std::unique_ptr<SceneContainer> Scene;
     if (bUseOctree)
@@ -81,20 +137,35 @@ void render( // What to render
     std::cout << "Tracing rays..." << std::endl;
     std::unique_ptr<RenderThread> threads[numThreads];
 
+    // The threads are built for the camera and container types, and run as tasks of the
+    // shared pool rather than started on their own. Each is made by the worker that runs it,
+    // so that its scratch memory is on that worker's NUMA node.
+    ThreadPool::TaskGroup RenderTasks;
+    const bool bLense = dynamic_cast<const LenseCamera*>(cam.get()) != nullptr;
+    const bool bOctree = dynamic_cast<const OctreeSceneContainer*>(Scene.get()) != nullptr;
     for (size_t threadNum = 0; threadNum < numThreads; ++threadNum)
     {
-        if (bUseAdaptive)
+        std::unique_ptr<RenderThread>* Slot = &threads[threadNum];
+        RenderTasks.Run([Slot, bLense, bOctree, renderData]
         {
-            threads[threadNum] = CreateThread<AdaptiveSampleThread>(renderData);
-        }
-        else if (SuperSamples > 1)
-        {
-            threads[threadNum] = CreateThread<SuperSampleThread>(renderData, SuperSamples);
-        }
-        else
-        {
-            threads[threadNum] = CreateThread<RenderThread>(renderData);
-        }
+            if (bUseAdaptive)
+            {
+                *Slot = CreateRenderThread<AdaptiveSampleThread>(bLense, bOctree, renderData);
+            }
+            else if (bUseWavefront)
+            {
+                *Slot = CreateRenderThread<WavefrontThread>(bLense, bOctree, renderData, SuperSamples);
+            }
+            else if (SuperSamples > 1)
+            {
+                *Slot = CreateRenderThread<SuperSampleThread>(bLense, bOctree, renderData, SuperSamples);
+            }
+            else
+            {
+                *Slot = CreateRenderThread<RenderThread>(bLense, bOctree, renderData);
+            }
+            (*Slot)->Main();
+        });
     }
 
     // Status bar
@@ -106,17 +177,23 @@ void render( // What to render
     }
 
     // Wait for threads to finish
-    for (size_t j = 0; j < numThreads; j++)
-    {
-        threads[j]->Join();
-    }
+    RenderTasks.Wait();
 
     std::cout << "Creating image file (" << filename << ")..." << std::endl;
     img->savePng(filename);
 }
 
-void RenderThread::Main()
+template<typename Sampler, typename CameraType, typename ContainerType>
+void RenderThread::RenderPixels()
 {
+    Sampler& Self = static_cast<Sampler&>(*this);
+    if (PacketSize > 1 && Sampler::bGridSamples)
+    {
+        RenderPixelRuns<CameraType, ContainerType>(Self.GetSubSamples());
+        return;
+    }
+
+    const CameraType& Cam = GetCamera<CameraType>();
     for (Pixel pixel = m_renderData.m_pixelQueue->GetNextPixel(); pixel != Pixel::NullPixel; pixel = m_renderData.m_pixelQueue->GetNextPixel())
     {
         const Pixel::StorageType x = pixel.GetX();
@@ -128,12 +205,12 @@ void RenderThread::Main()
         {
             const double Time  = m_renderData.m_timeDuration * ((double)t / (double)m_renderData.m_timeSteps);
             Colour DOFTotal;
-            for (int d = 0; d < m_renderData.m_normCam->GetDOFRays(); d++)
+            for (int d = 0; d < Cam.GetDOFRays(); d++)
             {
-                DOFTotal += TracePixelAntiAliased(x, y, Time);
+                DOFTotal += Self.template TracePixelAntiAliased<CameraType, ContainerType>(x, y, Time);
             }
             // Average DOF ray colour
-            Total += DOFTotal / m_renderData.m_normCam->GetDOFRays();
+            Total += DOFTotal / Cam.GetDOFRays();
         }
 
         Total /= m_renderData.m_timeSteps;
@@ -145,12 +222,81 @@ void RenderThread::Main()
     }
 }
 
+template<typename CameraType, typename ContainerType>
+void RenderThread::RenderPixelRuns(int SubSamples)
+{
+    const CameraType& Cam = GetCamera<CameraType>();
+    std::vector<Pixel> Run;
+    std::vector<Ray> Rays;
+    std::vector<Colour> Cols, Totals, DOFTotals;
+    for (;;)
+    {
+        Run.clear();
+        if (m_renderData.m_pixelQueue->GetNextPixels(Run, PacketRunPixels) == 0)
+        {
+            break;
+        }
+
+        // Averaged as RenderPixels and TracePixelAntiAliased do, a pixel at a time
+        Totals.assign(Run.size(), Colour());
+        for (int t = 0; t < m_renderData.m_timeSteps; t++)
+        {
+            const double Time  = m_renderData.m_timeDuration * ((double)t / (double)m_renderData.m_timeSteps);
+            DOFTotals.assign(Run.size(), Colour());
+            for (int d = 0; d < Cam.GetDOFRays(); d++)
+            {
+                Rays.clear();
+                for (const Pixel& pixel : Run)
+                {
+                    GetSubSampleRays(Cam, pixel.GetX(), pixel.GetY(), SubSamples, Rays);
+                }
+                Cols.resize(Rays.size());
+                TracePrimaryRays<ContainerType>(Rays.data(), Rays.size(), Cols.data(), Time);
+
+                const size_t numRays = Rays.size() / Run.size();
+                for (size_t p = 0; p < Run.size(); p++)
+                {
+                    if (SubSamples > 1)
+                    {
+                        Colour SuperTotal;
+                        for (size_t i = 0; i < numRays; i++)
+                        {
+                            SuperTotal += Cols[p * numRays + i];
+                        }
+                        DOFTotals[p] += SuperTotal / static_cast<double>(numRays);
+                    }
+                    else
+                    {
+                        DOFTotals[p] += Cols[p];
+                    }
+                }
+            }
+            for (size_t p = 0; p < Run.size(); p++)
+            {
+                Totals[p] += DOFTotals[p] / Cam.GetDOFRays();
+            }
+        }
+
+        for (size_t p = 0; p < Run.size(); p++)
+        {
+            Colour Total = Totals[p];
+            Total /= m_renderData.m_timeSteps;
+            (*(m_renderData.m_outImage))(Run[p].GetX(), Run[p].GetY(), 0) = Total.R();
+            (*(m_renderData.m_outImage))(Run[p].GetX(), Run[p].GetY(), 1) = Total.G();
+            (*(m_renderData.m_outImage))(Run[p].GetX(), Run[p].GetY(), 2) = Total.B();
+            ++PROGRESS;
+        }
+    }
+}
+
+template<typename CameraType, typename ContainerType>
 inline Colour RenderThread::TracePixelAntiAliased(int x, int y, const double& Time)
 {
-    Ray ray = m_renderData.m_normCam->GetRayThroughPixel(x, y, 0.5f, 0.5f);
-    return TraceRay(ray, 1.0, 0, Time);
+    Ray ray = GetCamera<CameraType>().template GetRayThroughPixelAs<CameraType>(x, y, 0.5f, 0.5f);
+    return TraceRay<ContainerType>(ray, 1.0, 0, Time);
 }
 
+template<typename ContainerType>
 Colour RenderThread::TraceRay(Ray& ray, double powerCoef, unsigned int depth, const double& Time)
 {
     if (powerCoef <= 0.05 || depth >= 9)
@@ -158,13 +304,30 @@ Colour RenderThread::TraceRay(Ray& ray, double powerCoef, unsigned int depth, co
         return Colour::Black;
     }
 
-    Colour TraceColour(0, 0, 0);
+    // SceneContainer::TimeRayTrace, with the closest hit traced by ContainerType directly
+    const ContainerType& Scene = GetScene<ContainerType>();
     HitInfo Hit;
-    if (!m_renderData.m_scene->TimeRayTrace(TraceColour, ray, Hit, *(m_renderData.m_ambient), Time))
+    if (!Scene.template TimeClosestHitAs<ContainerType>(ray, Hit, Time))
     {
         return Colour::Black;
     }
+    Colour TraceColour(0, 0, 0);
+    Scene.LightTimeHit(TraceColour, ray, Hit, *(m_renderData.m_ambient), Time);
+    return ShadeHit<ContainerType>(ray, Hit, TraceColour, powerCoef, depth, Time);
+}
 
+template<typename ContainerType>
+Colour RenderThread::ShadeHit(const Ray& ray, HitInfo& Hit, const Colour& TraceColour, double powerCoef, unsigned int depth, const double& Time)
+{
+    return ScatterHit(ray, Hit, TraceColour, powerCoef, depth, [&](Ray& R, double coef, unsigned int nextDepth, double)
+    {
+        return TraceRay<ContainerType>(R, coef, nextDepth, Time);
+    });
+}
+
+template<typename TraceFn>
+Colour RenderThread::ScatterHit(const Ray& ray, HitInfo& Hit, const Colour& TraceColour, double powerCoef, unsigned int depth, TraceFn&& Trace)
+{
     const Vector3D rayDir = ray.GetDirection();
 
     // Refraction enabled?
@@ -212,30 +375,36 @@ Colour RenderThread::TraceRay(Ray& ray, double powerCoef, unsigned int depth, co
                 const Vector3D v = cross(reflRayDir, u);
 
                 // TODO: remove magic number 8
+                const double glossWeight = 1.0 / 8;
                 Colour TotalGloss;
                 for (int i = 0; i < 8; i++)
                 {
-                    const double theta = acos(pow((1.0 - RefrDistribution(generator)), 1.0 / (Hit.Mat->GetGloss() + 1.0)));
+                    const double theta = FastMath::Acos(FastMath::Pow((1.0 - RefrDistribution(generator)), 1.0 / (Hit.Mat->GetGloss() + 1.0)));
                     const double phi = 2.0 * M_PI * RefrDistribution(generator);
-                    const double x = sin(theta) * cos(phi);
-                    const double y = sin(theta) * sin(phi);
+                    double sinTheta, cosTheta, sinPhi, cosPhi;
+                    FastMath::SinCos(theta, sinTheta, cosTheta);
+                    FastMath::SinCos(phi, sinPhi, cosPhi);
+                    const double x = sinTheta * cosPhi;
+                    const double y = sinTheta * sinPhi;
 
                     // Perturb ray
-                    Ray GlossRay(ReflectedRay.GetOrigin(), x * u + y * v + reflRayDir);
-                    TotalGloss += TraceRay(GlossRay, powerCoef * Reflectance, nextDepth, Time);
+                    const Vector3D GlossDir = x * u + y * v + reflRayDir;
+                    Ray GlossRay(OffsetRayOrigin(Hit.Location, Hit.Normal, GlossDir), GlossDir);
+                    GlossRay.InheritFootprint(ray, Hit.Location);
+                    TotalGloss += Trace(GlossRay, powerCoef * Reflectance, nextDepth, glossWeight);
                 }
-                reflectionColour = TotalGloss * 0.125;
+                reflectionColour = TotalGloss * glossWeight;
             }
             else
             {
                 // Total internal reflection
-                reflectionColour = TraceRay(ReflectedRay, powerCoef * Reflectance, nextDepth, Time);
+                reflectionColour = Trace(ReflectedRay, powerCoef * Reflectance, nextDepth, 1.0);
             }
 
             // Refracted ray creation
             Ray RefractedRay = ray.Refract(ni, nt, NdotR, sin2t, Hit);
             const double refrCoef = powerCoef * (1.0 - Reflectance);
-            const Colour refractionColour = (refrCoef * TraceColour) + TraceRay(RefractedRay, refrCoef, nextDepth, Time);
+            const Colour refractionColour = (refrCoef * TraceColour) + Trace(RefractedRay, refrCoef, nextDepth, 1.0);
 
             return reflectionColour + refractionColour;
         }
@@ -243,7 +412,7 @@ Colour RenderThread::TraceRay(Ray& ray, double powerCoef, unsigned int depth, co
         {
             // Total Internal Reflection
             Ray ReflectedRay = ray.Reflect(Hit, (-rayDir).dot(Hit.Normal));
-            return TraceRay(ReflectedRay, powerCoef, nextDepth, Time);
+            return Trace(ReflectedRay, powerCoef, nextDepth, 1.0);
         }
     }
     else
@@ -253,22 +422,57 @@ Colour RenderThread::TraceRay(Ray& ray, double powerCoef, unsigned int depth, co
     }
 }
 
-Colour SuperSampleThread::TracePixelAntiAliased(int x, int y, const double& Time)
+template<typename ContainerType>
+void RenderThread::TracePrimaryRays(const Ray Rays[], size_t Count, Colour Out[], const double& Time)
 {
-    // Equally distributed super-samples (grid)
-    const double halfSubWidth = 0.5 / SuperSamples;
-    const size_t numRays = SuperSamples * SuperSamples;
-    Colour Cols[numRays];
-    uint32_t index = 0;
-    for (double i = halfSubWidth; i < 1; i += halfSubWidth * 2)
+    if (PacketSize <= 1)
     {
-        for (double j = halfSubWidth; j < 1; j += halfSubWidth * 2)
+        for (size_t i = 0; i < Count; i++)
         {
-            Ray ray = m_renderData.m_normCam->GetRayThroughPixel(x, y, i, j);
-            Cols[index++] = TraceRay(ray, 1.0, 0, Time);
+            Ray ray(Rays[i]);
+            Out[i] = TraceRay<ContainerType>(ray, 1.0, 0, Time);
         }
+        return;
     }
 
+    // Find the hits of a packet together, then carry on with each ray on its own
+    const size_t packetSize = std::min(PacketSize, MaxPacketRays);
+    for (size_t first = 0; first < Count; first += packetSize)
+    {
+        const size_t num = std::min(packetSize, Count - first);
+        RayPacket Packet;
+        for (size_t i = 0; i < num; i++)
+        {
+            Packet.Add(Rays[first + i]);
+        }
+
+        HitInfo Hits[MaxPacketRays];
+        bool bHits[MaxPacketRays];
+        const ContainerType& Scene = GetScene<ContainerType>();
+        Scene.template TimePacketTraceAs<ContainerType>(Packet, Hits, bHits, Time);
+        for (size_t i = 0; i < num; i++)
+        {
+            Out[first + i] = Colour::Black;
+            if (bHits[i])
+            {
+                Colour TraceColour(0, 0, 0);
+                Scene.LightTimeHit(TraceColour, Rays[first + i], Hits[i], *(m_renderData.m_ambient), Time);
+                Out[first + i] = ShadeHit<ContainerType>(Rays[first + i], Hits[i], TraceColour, 1.0, 0, Time);
+            }
+        }
+    }
+}
+
+template<typename CameraType, typename ContainerType>
+Colour SuperSampleThread::TracePixelAntiAliased(int x, int y, const double& Time)
+{
+    const size_t numRays = SuperSamples * SuperSamples;
+    std::vector<Ray> Rays;
+    Rays.reserve(numRays);
+    Colour Cols[numRays];
+    GetSubSampleRays(GetCamera<CameraType>(), x, y, SuperSamples, Rays);
+    TracePrimaryRays<ContainerType>(Rays.data(), Rays.size(), Cols, Time);
+
     Colour SuperTotal;
     for (size_t i = 0; i < numRays; i++)
     {
@@ -277,24 +481,27 @@ Colour SuperSampleThread::TracePixelAntiAliased(int x, int y, const double& Time
     return SuperTotal / static_cast<double>(numRays);
 }
 
+template<typename CameraType, typename ContainerType>
 inline Colour AdaptiveSampleThread::TracePixelAntiAliased(int x, int y, const double& Time)
 {
-    return AdaptiveSuperSample(x, y, 0.0, 1.0, 0.0, 1.0, 0, Time);
+    return AdaptiveSuperSample<CameraType, ContainerType>(x, y, 0.0, 1.0, 0.0, 1.0, 0, Time);
 }
 
+template<typename CameraType, typename ContainerType>
 Colour AdaptiveSampleThread::AdaptiveSuperSample(const int x, const int y, const double xNormMin, const double xNormMax, const double yNormMin, const double yNormMax, const unsigned int depth, const double& Time)
 {
     Colour Cols[4];
     const double QuartX = (xNormMax - xNormMin) * 0.25;
     const double QuartY = (yNormMax - yNormMin) * 0.25;
-    Ray R0 = m_renderData.m_normCam->GetRayThroughPixel(x, y, xNormMin + QuartX, yNormMin + QuartY);
-    Ray R1 = m_renderData.m_normCam->GetRayThroughPixel(x, y, xNormMin + QuartX, yNormMax - QuartY);
-    Ray R2 = m_renderData.m_normCam->GetRayThroughPixel(x, y, xNormMax - QuartX, yNormMin + QuartY);
-    Ray R3 = m_renderData.m_normCam->GetRayThroughPixel(x, y, xNormMax - QuartX, yNormMax - QuartY);
-    Cols[0] = TraceRay(R0, 1.0, 0, Time);
-    Cols[1] = TraceRay(R1, 1.0, 0, Time);
-    Cols[2] = TraceRay(R2, 1.0, 0, Time);
-    Cols[3] = TraceRay(R3, 1.0, 0, Time);
+    const CameraType& Cam = GetCamera<CameraType>();
+    const Ray Rays[4] =
+    {
+        Cam.template GetRayThroughPixelAs<CameraType>(x, y, xNormMin + QuartX, yNormMin + QuartY),
+        Cam.template GetRayThroughPixelAs<CameraType>(x, y, xNormMin + QuartX, yNormMax - QuartY),
+        Cam.template GetRayThroughPixelAs<CameraType>(x, y, xNormMax - QuartX, yNormMin + QuartY),
+        Cam.template GetRayThroughPixelAs<CameraType>(x, y, xNormMax - QuartX, yNormMax - QuartY)
+    };
+    TracePrimaryRays<ContainerType>(Rays, 4, Cols, Time);
     Colour Total = Cols[0] + Cols[1] + Cols[2] + Cols[3];
 
     // Not the same colours - recurse
@@ -304,10 +511,10 @@ Colour AdaptiveSampleThread::AdaptiveSuperSample(const int x, const int y, const
         const double HalfY = QuartY * 2;
         const unsigned int newDepth = depth + 1;
 
-        Total += AdaptiveSuperSample(x, y, xNormMin, xNormMin + HalfX, yNormMin, yNormMin + HalfY, newDepth, Time) +
-                 AdaptiveSuperSample(x, y, xNormMin + HalfX, xNormMax, yNormMin, yNormMin + HalfY, newDepth, Time) +
-                 AdaptiveSuperSample(x, y, xNormMin, xNormMin + HalfX, yNormMin + HalfY, yNormMax, newDepth, Time) +
-                 AdaptiveSuperSample(x, y, xNormMin + HalfX, xNormMax, yNormMin + HalfY, yNormMax, newDepth, Time);
+        Total += AdaptiveSuperSample<CameraType, ContainerType>(x, y, xNormMin, xNormMin + HalfX, yNormMin, yNormMin + HalfY, newDepth, Time) +
+                 AdaptiveSuperSample<CameraType, ContainerType>(x, y, xNormMin + HalfX, xNormMax, yNormMin, yNormMin + HalfY, newDepth, Time) +
+                 AdaptiveSuperSample<CameraType, ContainerType>(x, y, xNormMin, xNormMin + HalfX, yNormMin + HalfY, yNormMax, newDepth, Time) +
+                 AdaptiveSuperSample<CameraType, ContainerType>(x, y, xNormMin + HalfX, xNormMax, yNormMin + HalfY, yNormMax, newDepth, Time);
 
         Total *= 0.125;
     }
@@ -318,4 +525,215 @@ Colour AdaptiveSampleThread::AdaptiveSuperSample(const int x, const int y, const
     }
 
     return Total;
-}
\ No newline at end of file
+}
+
+template<typename Sampler, typename CameraType, typename ContainerType>
+void WavefrontThread::RenderPixels()
+{
+    const CameraType& Cam = GetCamera<CameraType>();
+    std::vector<Pixel> Block;
+    std::vector<Colour> Samples;
+    std::vector<Ray> Rays;
+    size_t numRays = 1;
+
+    for (;;)
+    {
+        Block.clear();
+        if (m_renderData.m_pixelQueue->GetNextPixels(Block, WavefrontPixels) == 0)
+        {
+            break;
+        }
+
+        // Every primary ray of the block, each the start of its own sample
+        m_queue.clear();
+        Samples.clear();
+        for (const Pixel& pixel : Block)
+        {
+            for (int t = 0; t < m_renderData.m_timeSteps; t++)
+            {
+                const double Time  = m_renderData.m_timeDuration * ((double)t / (double)m_renderData.m_timeSteps);
+                for (int d = 0; d < Cam.GetDOFRays(); d++)
+                {
+                    Rays.clear();
+                    GetSubSampleRays(Cam, pixel.GetX(), pixel.GetY(), SuperSamples, Rays);
+                    numRays = Rays.size();
+                    for (const Ray& R : Rays)
+                    {
+                        m_queue.push_back(QueuedRay{R, 1.0, 1.0, Time, 0, static_cast<uint32_t>(Samples.size())});
+                        Samples.push_back(Colour::Black);
+                    }
+                }
+            }
+        }
+
+        while (!m_queue.empty())
+        {
+            TraceBounce<ContainerType>(m_queue, m_next, Samples);
+            std::swap(m_queue, m_next);
+        }
+
+        // Average the samples as RenderThread::RenderPixels and TracePixelAntiAliased do
+        size_t sample = 0;
+        for (const Pixel& pixel : Block)
+        {
+            Colour Total;
+            for (int t = 0; t < m_renderData.m_timeSteps; t++)
+            {
+                Colour DOFTotal;
+                for (int d = 0; d < Cam.GetDOFRays(); d++)
+                {
+                    if (SuperSamples > 1)
+                    {
+                        Colour SuperTotal;
+                        for (size_t i = 0; i < numRays; i++)
+                        {
+                            SuperTotal += Samples[sample++];
+                        }
+                        DOFTotal += SuperTotal / static_cast<double>(numRays);
+                    }
+                    else
+                    {
+                        DOFTotal += Samples[sample++];
+                    }
+                }
+                Total += DOFTotal / Cam.GetDOFRays();
+            }
+
+            Total /= m_renderData.m_timeSteps;
+
+            (*(m_renderData.m_outImage))(pixel.GetX(), pixel.GetY(), 0) = Total.R();
+            (*(m_renderData.m_outImage))(pixel.GetX(), pixel.GetY(), 1) = Total.G();
+            (*(m_renderData.m_outImage))(pixel.GetX(), pixel.GetY(), 2) = Total.B();
+            ++PROGRESS;
+        }
+    }
+}
+
+template<typename ContainerType>
+void WavefrontThread::TraceBounce(std::vector<QueuedRay>& Queue, std::vector<QueuedRay>& Next, std::vector<Colour>& Samples)
+{
+    const ContainerType& Scene = GetScene<ContainerType>();
+    SortRays(Queue);
+
+    // Closest hits, neighbouring rays in packets if they're enabled
+    m_hits.clear();
+    m_hits.resize(Queue.size());
+    m_shadeOrder.clear();
+    const size_t packetSize = std::min(PacketSize, MaxPacketRays);
+    for (size_t first = 0; first < Queue.size();)
+    {
+        const double Time = Queue[first].Time;
+        size_t num = 1;
+        while (num < packetSize && first + num < Queue.size() && Queue[first + num].Time == Time)
+        {
+            num++;
+        }
+
+        bool bHits[MaxPacketRays];
+        if (num > 1)
+        {
+            RayPacket Packet;
+            for (size_t i = 0; i < num; i++)
+            {
+                Packet.Add(Queue[first + i].R);
+            }
+            Scene.template TimePacketTraceAs<ContainerType>(Packet, &m_hits[first], bHits, Time);
+        }
+        else
+        {
+            bHits[0] = Scene.template TimeClosestHitAs<ContainerType>(Queue[first].R, m_hits[first], Time);
+        }
+
+        for (size_t i = 0; i < num; i++)
+        {
+            // Hit.Mat is only filled in when the hit is lit, the node already knows it
+            if (bHits[i])
+            {
+                const Material* Mat = m_hits[first + i].Node->get_material();
+                m_shadeOrder.emplace_back(reinterpret_cast<uintptr_t>(Mat), static_cast<uint32_t>(first + i));
+            }
+        }
+        first += num;
+    }
+
+    // Shade the hits material by material, queueing the rays they scatter for the next bounce
+    std::sort(m_shadeOrder.begin(), m_shadeOrder.end());
+    Next.clear();
+    for (const auto& Entry : m_shadeOrder)
+    {
+        const QueuedRay& Queued = Queue[Entry.second];
+        HitInfo& Hit = m_hits[Entry.second];
+
+        Colour TraceColour(0, 0, 0);
+        Scene.LightTimeHit(TraceColour, Queued.R, Hit, *(m_renderData.m_ambient), Queued.Time);
+        const Colour Local = ScatterHit(Queued.R, Hit, TraceColour, Queued.PowerCoef, Queued.Depth, [&](Ray& R, double coef, unsigned int nextDepth, double Weight)
+        {
+            // TraceRay's cut-off
+            if (coef > 0.05 && nextDepth < 9)
+            {
+                Next.push_back(QueuedRay{R, coef, Queued.Weight * Weight, Queued.Time, nextDepth, Queued.Sample});
+            }
+            return Colour::Black;
+        });
+        Samples[Queued.Sample] += Queued.Weight * Local;
+    }
+}
+
+// Spread the low 9 bits of v three apart
+static uint32_t SpreadBits(uint32_t v)
+{
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+void WavefrontThread::SortRays(std::vector<QueuedRay>& Queue)
+{
+    if (Queue.size() < 2)
+    {
+        return;
+    }
+
+    Point3D Min = Queue[0].R.GetOrigin(), Max = Min;
+    for (const QueuedRay& Queued : Queue)
+    {
+        const Point3D Origin = Queued.R.GetOrigin();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            Min[axis] = std::min(Min[axis], Origin[axis]);
+            Max[axis] = std::max(Max[axis], Origin[axis]);
+        }
+    }
+
+    // 3 bits of octant and 27 of Morton code above the ray's index, which keeps ties in order
+    double Scale[3];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const double Extent = Max[axis] - Min[axis];
+        Scale[axis] = Extent > 0 ? 511.0 / Extent : 0.0;
+    }
+    m_keys.resize(Queue.size());
+    for (size_t i = 0; i < Queue.size(); i++)
+    {
+        const Point3D Origin = Queue[i].R.GetOrigin();
+        const Vector3D Dir = Queue[i].R.GetDirection();
+        uint32_t Morton = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const uint32_t Cell = std::min(511u, static_cast<uint32_t>((Origin[axis] - Min[axis]) * Scale[axis]));
+            Morton |= SpreadBits(Cell) << axis;
+        }
+        const uint64_t Octant = (Dir[0] < 0 ? 1 : 0) | (Dir[1] < 0 ? 2 : 0) | (Dir[2] < 0 ? 4 : 0);
+        m_keys[i] = (((Octant << 27) | Morton) << 32) | i;
+    }
+    std::sort(m_keys.begin(), m_keys.end());
+
+    m_sorted.clear();
+    for (uint64_t Key : m_keys)
+    {
+        m_sorted.push_back(Queue[static_cast<uint32_t>(Key)]);
+    }
+    std::swap(Queue, m_sorted);
+}
@@ -5,6 +5,7 @@ SceneNode::SceneNode(const std::string& name, Matrix4x4 M)
     : m_name(name),
       m_trans(M)
 {
+    CacheTransforms();
 }
 
 bool SceneNode::SimpleTrace(Ray R)
@@ -22,50 +23,24 @@ bool SceneNode::SimpleTrace(Ray R)
     return false;
 }
 
-bool SceneNode::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M)
+bool SceneNode::TimeTrace(Ray& R, HitInfo& Hit, const double& Time)
 {
-    R.Transform(m_invtrans);
-    Matrix4x4 T(M * m_trans);
+    Ray Local(R);
+    Local.Transform(m_toLocal);
 
     bool ret = false;
     for (auto iter = m_children.begin(); iter != m_children.end(); ++iter)
     {
         auto& Node = *iter;
-        if (Node->DepthTrace(R, closestDist, Hit, T))
+        if (Node->TimeTrace(Local, Hit, Time))
         {
             ret = true;
         }
     }
+    R.CopyTMax(Local);
     return ret;
 }
 
-bool SceneNode::ColourTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M)
-{
-    R.Transform(m_invtrans);
-    Matrix4x4 T(M * m_trans);
-
-    bool ret = false;
-    for (auto iter = m_children.begin(); iter != m_children.end(); ++iter)
-    {
-        auto& Node = *iter;
-        if (Node->ColourTrace(R, closestDist, Hit, T))
-        {
-            ret = true;
-        }
-    }
-    return ret;
-}
-
-bool SceneNode::TimeTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M, const double& Time)
-{
-    (void)R;
-    (void)closestDist;
-    (void)Hit;
-    (void)M;
-    (void)Time;
-    return false;
-}
-
 void SceneNode::FlattenScene(std::vector<std::unique_ptr<SceneNode>>& List, Matrix4x4 M)
 {
     for (auto& s : m_children)
@@ -79,6 +54,7 @@ void SceneNode::rotate(char axis, double angle)
     //std::cerr << "Stub: Rotate " << m_name << " around " << axis << " by " << angle << std::endl;
     m_trans.rotate(axis, angle);
     m_invtrans = m_trans.invert();
+    CacheTransforms();
 }
 
 void SceneNode::scale(const Vector3D& amount)
@@ -86,6 +62,7 @@ void SceneNode::scale(const Vector3D& amount)
     //std::cerr << "Stub: Scale " << m_name << " by " << amount << std::endl;
     m_trans.scale(amount);
     m_invtrans = m_trans.invert();
+    CacheTransforms();
 }
 
 void SceneNode::translate(const Vector3D& amount)
@@ -93,6 +70,14 @@ void SceneNode::translate(const Vector3D& amount)
     //std::cerr << "Stub: Translate " << m_name << " by " << amount << std::endl;
     m_trans.translate(amount);
     m_invtrans = m_trans.invert();
+    CacheTransforms();
+}
+
+void SceneNode::CacheTransforms()
+{
+    m_toParent = AffineTransform(m_trans);
+    m_toLocal = m_toParent.invert();
+    m_normalToParent = m_toParent.normalMatrix();
 }
 
 bool SceneNode::is_joint() const
@@ -127,6 +112,7 @@ void JointNode::set_joint_y(double min, double init, double max)
 GeometryNode::GeometryNode(const std::string& name, std::shared_ptr<Primitive> primitive, Vector3D Velocity)
     : SceneNode(name),
       Velocity(Velocity),
+      m_bMoving(Velocity != Vector3D::ZeroVector),
       m_primitive(primitive)
 {
 }
@@ -134,6 +120,7 @@ GeometryNode::GeometryNode(const std::string& name, std::shared_ptr<Primitive> p
 GeometryNode::GeometryNode(const std::string& name, std::shared_ptr<Primitive> primitive, std::shared_ptr<Material>& Mat, Matrix4x4 M, Vector3D Velocity)
     : SceneNode(name, M),
       Velocity(Velocity),
+      m_bMoving(Velocity != Vector3D::ZeroVector),
       m_material(Mat),
       m_primitive(primitive)
 {
@@ -145,6 +132,12 @@ void GeometryNode::FlattenScene(std::vector<std::unique_ptr<SceneNode>>& List, M
     List.emplace_back(std::make_unique<GeometryNode>(m_name, m_primitive, m_material, M * m_trans, Velocity));
 }
 
+void GeometryNode::CacheMotion(double TimeDuration)
+{
+    m_sweep = m_toParent * (TimeDuration * Velocity);
+    m_primitive->CacheMotion(TimeDuration);
+}
+
 bool GeometryNode::SimpleTrace(Ray R)
 {
     if (m_primitive->SimpleTrace(R))
@@ -154,70 +147,71 @@ bool GeometryNode::SimpleTrace(Ray R)
     return false;
 }
 
-bool GeometryNode::DepthTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M)
+bool GeometryNode::TimeTrace(Ray& R, HitInfo& Hit, const double& Time)
 {
-    R.Transform(m_invtrans);
-
-    bool ret = false;
-    if (m_primitive->DepthTrace(R, closestDist, Hit, M * m_trans))
+    Ray Local(R);
+    Local.Transform(m_toLocal);
+    if (m_bMoving)
     {
-        ret = true;
+        // The node has moved Time * Velocity through its own space
+        Local.SetOrigin(Local.GetOrigin() - Time * Velocity);
     }
-    return ret;
-}
-
-bool GeometryNode::ColourTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M)
-{
-    R.Transform(m_invtrans);
 
-    if (m_primitive->DepthTrace(R, closestDist, Hit, M * m_trans))
+    if (m_primitive->TimeTrace(Local, Hit, Time))
     {
-        Hit.Mat = m_material.get();
+        R.CopyTMax(Local);
+        Hit.Node = this;
         return true;
     }
     return false;
 }
 
-bool GeometryNode::TimeTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M, const double& Time)
+void GeometryNode::FinalizeHit(HitInfo& Hit, const double& Time) const
 {
-    Matrix4x4 m_timetrans = M * m_trans;
-    if (Velocity != Vector3D::ZeroVector)
-    {
-        m_timetrans.translate(Time * Velocity);
-        R.Transform(m_timetrans.invert());
-    }
-    else
-    {
-        R.Transform(m_invtrans);
-    }
-    // std::cout << "Scene:" << R.Start << "," << R.Direction << std::endl;
+    Point3D Location;
+    Vector3D Normal;
+    m_primitive->GetSurface(Hit, Location, Normal);
+    Hit.Location = m_toParent * (Location + Time * Velocity);
+    Hit.Normal = m_normalToParent * Normal;
+    Hit.Mat = m_material.get();
+}
 
-    if (m_primitive->DepthTrace(R, closestDist, Hit, m_timetrans))
-    {
-        Hit.Mat = m_material.get();
-        return true;
-    }
-    return false;
+const Material* GeometryNode::get_material() const
+{
+    return m_material.get();
+}
+
+Material* GeometryNode::get_material()
+{
+    return m_material.get();
 }
 
 BoxF GeometryNode::GetBox()
 {
     BoxF Bounds = m_primitive->GetBox();
     Bounds.Transform(m_trans);
-    return Bounds;
+    if (!m_bMoving)
+    {
+        return Bounds;
+    }
+
+    // Everywhere the node passes through during the render
+    return BoxF(std::max(Bounds.GetRight(), Bounds.GetRight() + m_sweep[0]), std::min(Bounds.GetLeft(), Bounds.GetLeft() + m_sweep[0]),
+                std::max(Bounds.GetTop(), Bounds.GetTop() + m_sweep[1]), std::min(Bounds.GetBottom(), Bounds.GetBottom() + m_sweep[1]),
+                std::max(Bounds.GetFront(), Bounds.GetFront() + m_sweep[2]), std::min(Bounds.GetBack(), Bounds.GetBack() + m_sweep[2]));
 }
 
 BoxF GetSceneBounds(const std::vector<std::unique_ptr<SceneNode>>& Scene)
 {
-    const double posInf = std::numeric_limits<double>::max();
-    const double negInf = std::numeric_limits<double>::min();
+    const Scalar posInf = std::numeric_limits<Scalar>::max();
+    const Scalar negInf = std::numeric_limits<Scalar>::min();
 
-    double right = negInf;
-    double left = posInf;
-    double top = negInf;
-    double bottom = posInf;
-    double front = negInf;
-    double back = posInf;
+    Scalar right = negInf;
+    Scalar left = posInf;
+    Scalar top = negInf;
+    Scalar bottom = posInf;
+    Scalar front = negInf;
+    Scalar back = posInf;
 
     for (auto& Node : Scene)
     {
@@ -46,6 +46,8 @@
 #include "luacamera.h"
 #include "render.hpp"
 #include "mesh.hpp"
+#include "meshfile.h"
+#include "particles.h"
 #include <memory>
 
 // Uncomment the following line to enable debugging messages
@@ -115,6 +117,20 @@ void get_tuple(lua_State* L, int arg, T* data, int n)
   }
 }
 
+// Read a flat table of numbers whose length is a multiple of n
+void get_flat_numbers(lua_State* L, int arg, std::vector<float>& data, int n)
+{
+  luaL_checktype(L, arg, LUA_TTABLE);
+  int count = luaL_getn(L, arg);
+  luaL_argcheck(L, count % n == 0, arg, "Flat table of tuples expected");
+  data.resize(count);
+  for (int i = 1; i <= count; i++) {
+    lua_rawgeti(L, arg, i);
+    data[i - 1] = static_cast<float>(luaL_checknumber(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
 // Create a node
 extern "C"
 int gr_node_cmd(lua_State* L)
@@ -252,6 +268,26 @@ int gr_cone_cmd(lua_State* L)
   return 1;
 }
 
+// Create a torus node
+extern "C"
+int gr_torus_cmd(lua_State* L)
+{
+  GRLUA_DEBUG_CALL;
+  
+  gr_node_ud* data = (gr_node_ud*)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+  
+  const char* name = luaL_checkstring(L, 1);
+  double minorRadius = luaL_checknumber(L, 2);
+  luaL_argcheck(L, minorRadius > 0 && minorRadius < 1, 2, "Minor radius must be between 0 and 1");
+  data->node = new GeometryNode(name, std::make_shared<Torus>(minorRadius));
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Create a non-hierarchical s node
 extern "C"
 int gr_nh_sphere_cmd(lua_State* L)
@@ -328,6 +364,35 @@ int gr_mesh_cmd(lua_State* L)
 
   std::shared_ptr<Mesh> mesh(new Mesh(verts, faces));
   GRLUA_DEBUG(*mesh);
+  if (MeshStorageMode.bReport) {
+    mesh->PrintMemoryReport(std::cout, name);
+  }
+  data->node = new GeometryNode(name, mesh);
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
+// Create a polygonal mesh node from an OBJ or PLY file
+extern "C"
+int gr_loadmesh_cmd(lua_State* L)
+{
+  GRLUA_DEBUG_CALL;
+  
+  gr_node_ud* data = (gr_node_ud*)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char* name = luaL_checkstring(L, 1);
+  const char* filename = luaL_checkstring(L, 2);
+
+  std::shared_ptr<Mesh> mesh = LoadMeshFile(filename);
+  luaL_argcheck(L, mesh != nullptr, 2, "Could not load mesh file");
+  GRLUA_DEBUG(*mesh);
+  if (MeshStorageMode.bReport) {
+    mesh->PrintMemoryReport(std::cout, name);
+  }
   data->node = new GeometryNode(name, mesh);
 
   luaL_getmetatable(L, "gr.node");
@@ -336,6 +401,47 @@ int gr_mesh_cmd(lua_State* L)
   return 1;
 }
 
+// Create a particle set node from a flat table of x, y, z, radius per particle or from
+// a particle file, optionally moving with a flat table of x, y, z velocities per particle
+extern "C"
+int gr_particles_cmd(lua_State* L)
+{
+  GRLUA_DEBUG_CALL;
+  
+  gr_node_ud* data = (gr_node_ud*)lua_newuserdata(L, sizeof(gr_node_ud));
+  data->node = 0;
+
+  const char* name = luaL_checkstring(L, 1);
+
+  std::shared_ptr<Particles> particles;
+  if (lua_type(L, 2) == LUA_TSTRING) {
+    luaL_argcheck(L, lua_isnoneornil(L, 3), 3, "Velocities of a particle file are read from the file");
+    particles = LoadParticleFile(lua_tostring(L, 2));
+    luaL_argcheck(L, particles != nullptr, 2, "Could not load particle file");
+  } else {
+    std::vector<float> packed;
+    get_flat_numbers(L, 2, packed, 4);
+    for (size_t i = 3; i < packed.size(); i += 4) {
+      luaL_argcheck(L, packed[i] > 0, 2, "Radii must be positive");
+    }
+
+    std::vector<float> velocities;
+    if (!lua_isnoneornil(L, 3)) {
+      get_flat_numbers(L, 3, velocities, 3);
+      luaL_argcheck(L, velocities.size() / 3 == packed.size() / 4, 3, "One velocity per particle expected");
+    }
+    particles = std::make_shared<Particles>(packed, velocities);
+  }
+  std::cout << "Particles " << name << ": " << particles->GetNumParticles() << " particles, "
+            << particles->GetMemoryUsage() / 1024.0 << " KB" << std::endl;
+  data->node = new GeometryNode(name, particles);
+
+  luaL_getmetatable(L, "gr.node");
+  lua_setmetatable(L, -2);
+
+  return 1;
+}
+
 // Make a point light
 extern "C"
 int gr_light_cmd(lua_State* L)
@@ -716,8 +822,11 @@ static const luaL_reg grlib_functions[] = {
   {"cube", gr_cube_cmd},
   {"cylinder", gr_cylinder_cmd},
   {"cone", gr_cone_cmd},
+  {"torus", gr_torus_cmd},
   {"nh_sphere", gr_nh_sphere_cmd},
   {"mesh", gr_mesh_cmd},
+  {"loadmesh", gr_loadmesh_cmd},
+  {"particles", gr_particles_cmd},
   {"light", gr_light_cmd},
   {"alight", gr_alight_cmd},
   {"pcamera", gr_pcamera_cmd},
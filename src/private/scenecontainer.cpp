@@ -1,51 +1,31 @@
 #include "scenecontainer.h"
 #include "scene.hpp"
+#include <algorithm>
 #include <limits>
 
-bool SceneContainer::ContainerSpecificTimeTrace(const Ray& R, HitInfo& Hit, const double& Time) const
+template<typename Query>
+bool SceneContainer::Traverse(Ray& R, HitInfo& Hit, const double& Time) const
 {
-    double closestDist = std::numeric_limits<double>::max();
-    Matrix4x4 M;
-    bool bHit = false;
-    for (auto& S : *Nodes)
-    {
-        if (S->TimeTrace(R, closestDist, Hit, M, Time))
-        {
-            bHit = true;
-        }
-    }
-    return bHit;
+    return Table.Trace<Query>(R, Hit, Time);
 }
 
-bool SceneContainer::ContainerSpecificColourTrace(const Ray& R, HitInfo& Hit) const
-{
-    double closestDist = std::numeric_limits<double>::max();
-    Matrix4x4 M;
-    bool bHit = false;
-    for (auto& S : *Nodes)
-    {
-        if (S->ColourTrace(R, closestDist, Hit, M))
-        {
-            bHit = true;
-        }
+// Each container's ContainerSpecificTrace for every kind of query
+#define CONTAINER_TRACE(Query, Container) \
+    bool Container::ContainerSpecificTrace(Ray& R, HitInfo& Hit, const double& Time, Query) const \
+    { \
+        return Traverse<Query>(R, Hit, Time); \
     }
-    return bHit;
-}
+RT_FOR_EACH_TRACE_QUERY(CONTAINER_TRACE, SceneContainer)
+RT_FOR_EACH_TRACE_QUERY(CONTAINER_TRACE, OctreeSceneContainer)
+#undef CONTAINER_TRACE
 
-bool SceneContainer::ContainerSpecificDepthTrace(const Ray& R, double& dist) const
+void SceneContainer::ContainerSpecificPacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const
 {
-    bool bHit = false;
-    HitInfo ShadowHit;
-    Matrix4x4 M;
-    dist = std::numeric_limits<double>::max();
-    for (auto& S : *Nodes)
+    // Without an acceleration structure there are no node fetches to share
+    for (size_t i = 0; i < Packet.Num(); ++i)
     {
-        if (S->DepthTrace(R, dist, ShadowHit, M))
-        {
-            bHit = true;
-        }
+        bHits[i] = Traverse<ClosestHitQuery>(Packet[i], Hits[i], Time);
     }
-    return bHit;
 }
 
 void SceneContainer::LocatePhotons(Array<Photon*>& OutArray, const Point3D& CheckLoc, const double& SearchDistSq, double& MaxDist2) const
@@ -55,20 +35,46 @@ void SceneContainer::LocatePhotons(Array<Photon*>& OutArray, const Point3D& Chec
 
 bool SceneContainer::TimeRayTrace(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient, const double& Time) const
 {
-    if (ContainerSpecificTimeTrace(R, Hit, Time))
+    if (TimeClosestHit(R, Hit, Time))
     {
-        Hit.Normal.normalize();
-
-        OutCol = Hit.Mat->DoLighting(this, R, lights, Hit, ambient, Time);
+        LightTimeHit(OutCol, R, Hit, ambient, Time);
         return true;
     }
     return false;
 }
 
+bool SceneContainer::TimeClosestHit(const Ray& R, HitInfo& Hit, const double& Time) const
+{
+    Ray Closest(R);
+    return ContainerSpecificTrace(Closest, Hit, Time, ClosestHitQuery());
+}
+
+bool SceneContainer::TimeAnyHit(const Ray& R, const double& Time) const
+{
+    Ray Any(R);
+    HitInfo Hit;
+    return ContainerSpecificTrace(Any, Hit, Time, AnyHitQuery());
+}
+
+void SceneContainer::TimePacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const
+{
+    ContainerSpecificPacketTrace(Packet, Hits, bHits, Time);
+}
+
+void SceneContainer::LightTimeHit(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient, const double& Time) const
+{
+    Hit.Node->FinalizeHit(Hit, Time);
+    Hit.Normal.normalize();
+
+    OutCol = Hit.Mat->DoLighting(this, R, lights, Hit, ambient, Time);
+}
+
 bool SceneContainer::RayTrace(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient) const
 {
-    if (ContainerSpecificColourTrace(R, Hit))
+    Ray Closest(R);
+    if (ContainerSpecificTrace(Closest, Hit, 0, ClosestHitQuery()))
     {
+        Hit.Node->FinalizeHit(Hit, 0);
         Hit.Normal.normalize();
 
         OutCol = Hit.Mat->DoLighting(this, R, lights, Hit, ambient, 0);
@@ -79,81 +85,65 @@ bool SceneContainer::RayTrace(Colour& OutCol, const Ray& R, HitInfo& Hit, const
 
 bool SceneContainer::PhotonTrace(const Ray& R, HitInfo& Hit) const
 {
-    return ContainerSpecificColourTrace(R, Hit);
+    Ray Closest(R);
+    if (ContainerSpecificTrace(Closest, Hit, 0, ClosestHitQuery()))
+    {
+        Hit.Node->FinalizeHit(Hit, 0);
+        Hit.Normal.normalize();
+        return true;
+    }
+    return false;
 }
 
 bool SceneContainer::TimeDepthTrace(const Ray& R, double& dist, const double& Time) const
 {
+    Ray Closest(R);
     HitInfo Hit;
-    bool bHit = ContainerSpecificTimeTrace(R, Hit, Time);
-    dist = (Hit.Location - R.GetOrigin()).length2();
+    bool bHit = ContainerSpecificTrace(Closest, Hit, Time, ClosestHitQuery());
+    dist = Closest.GetTMax();
     return bHit;
 }
 
 bool SceneContainer::DepthTrace(const Ray& R, double& dist) const
 {
-    return ContainerSpecificDepthTrace(R, dist);
+    Ray Closest(R);
+    HitInfo Hit;
+    bool bHit = ContainerSpecificTrace(Closest, Hit, 0, ClosestHitQuery());
+    dist = Closest.GetTMax();
+    return bHit;
 }
 
 OctreeSceneContainer::OctreeSceneContainer(std::vector<std::unique_ptr<SceneNode>>* Nodes, const std::list<std::unique_ptr<Light>>* lights, unsigned int Photons) :
     SceneContainer(Nodes, lights, Photons)
 {
     std::cout << "Building octree..." << std::endl;
-    Tree = OcTree<SceneNode>(GetSceneBounds(*Nodes));
-    for (auto& s : *Nodes)
+    Tree = OcTree<PrimitiveRef>(GetSceneBounds(*Nodes));
+    for (PrimitiveRef& Ref : Table.GetRefs())
     {
-        Tree.Insert(s.get());
+        Tree.Insert(&Ref);
     }
 }
 
-bool OctreeSceneContainer::ContainerSpecificTimeTrace(const Ray& R, HitInfo& Hit, const double& Time) const
+template<typename Query>
+bool OctreeSceneContainer::Traverse(Ray& R, HitInfo& Hit, const double& Time) const
 {
-    double closestDist = std::numeric_limits<double>::max();
-    Matrix4x4 M;
     bool bHit = false;
-    Array<SceneNode*> OctList;
-    Tree.Trace(OctList, R);
-    for (SceneNode* S : OctList)
+    Tree.Trace(R, [&](const Array<PrimitiveRef*>& Refs)
     {
-        if (S->TimeTrace(R, closestDist, Hit, M, Time))
+        if (Table.Trace<Query>(Refs, R, Hit, Time))
         {
             bHit = true;
         }
-    }
+        return Query::bAnyHit && bHit;
+    });
     return bHit;
 }
 
-bool OctreeSceneContainer::ContainerSpecificColourTrace(const Ray& R, HitInfo& Hit) const
+void OctreeSceneContainer::ContainerSpecificPacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const
 {
-    double closestDist = std::numeric_limits<double>::max();
-    Matrix4x4 M;
-    bool bHit = false;
-    Array<SceneNode*> OctList;
-    Tree.Trace(OctList, R);
-    for (SceneNode* S : OctList)
+    std::fill(bHits, bHits + Packet.Num(), false);
+    Tree.TracePacket(Packet, Packet.AllRays(), [&](const Array<PrimitiveRef*>& Refs, uint32_t Active)
     {
-        if (S->ColourTrace(R, closestDist, Hit, M))
-        {
-            bHit = true;
-        }
-    }
-    return bHit;
+        Table.Trace(Refs, Packet, Active, Hits, bHits, Time);
+    });
 }
-
-bool OctreeSceneContainer::ContainerSpecificDepthTrace(const Ray& R, double& dist) const
-{
-    bool bHit = false;
-    HitInfo Hit;
-    Matrix4x4 M;
-    dist = std::numeric_limits<double>::max();
-    Array<SceneNode*> OctList;
-    Tree.Trace(OctList, R);
-    for (SceneNode* S : OctList)
-    {
-        if (S->DepthTrace(R, dist, Hit, M))
-        {
-            bHit = true;
-        }
-    }
-    return bHit;
-}
\ No newline at end of file
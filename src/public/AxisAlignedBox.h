@@ -129,19 +129,19 @@ inline T AxisAlignedBox<T>::GetBack() const noexcept
 template<typename T>
 inline T AxisAlignedBox<T>::GetWidth() const
 {
-    return abs(data[1] - data[0]);
+    return std::abs(data[1] - data[0]);
 }
 
 template<typename T>
 inline T AxisAlignedBox<T>::GetHeight() const
 {
-    return abs(data[2] - data[3]);
+    return std::abs(data[2] - data[3]);
 }
 
 template<typename T>
 inline T AxisAlignedBox<T>::GetDepth() const
 {
-    return abs(data[4] - data[5]);
+    return std::abs(data[4] - data[5]);
 }
 
 template<typename T>
@@ -213,55 +213,43 @@ void DoIntersect(const Ray& ray, const AxisAlignedBox<T>& box, AABIntersectData<
 }
 
 // Return if the ray intersects or not. Optimized.
-// Return outMult indicating the intersection point in the forward direction
+// Return tHit, the t of the intersection point in the forward direction, and the face it is on
 template<typename T>
-bool GetIntersection(const Ray& ray, const AxisAlignedBox<T>& box, HitInfo& hit)
+bool GetIntersection(const Ray& ray, const AxisAlignedBox<T>& box, T& tHit, typename AxisAlignedBox<T>::NormalSelect& face)
 {
-    const Vector3D rayDir = ray.GetDirection();
-
     AABIntersectData<T> data;
     DoIntersect(ray, box, data);
     const bool haveIntersected = data.tMax >= std::max(static_cast<T>(0), data.tMin);
 
     if (haveIntersected)
     {
-        T tUsed;
-
-        const Point3D rayOrigin = ray.GetOrigin();
-        if (Contains(box, rayOrigin))
-        {
-            tUsed = data.tMax;
-            hit.Location = rayOrigin + ((data.tMax + EPSILON) * rayDir);
-        }
-        else
-        {
-            tUsed = data.tMin;
-            hit.Location = rayOrigin + ((data.tMin - EPSILON) * rayDir);
-        }
+        typedef typename AxisAlignedBox<T>::NormalSelect NormalSelect;
+        const T tUsed = Contains(box, ray.GetOrigin()) ? data.tMax : data.tMin;
+        tHit = tUsed;
 
         if (tUsed == data.tx1)
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Left);
+            face = NormalSelect::Left;
         }
         else if (tUsed == data.tx2)
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Right);
+            face = NormalSelect::Right;
         }
         else if (tUsed == data.ty1)
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Bottom);
+            face = NormalSelect::Bottom;
         }
         else if (tUsed == data.ty2)
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Top);
+            face = NormalSelect::Top;
         }
         else if (tUsed == data.tz1)
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Back);
+            face = NormalSelect::Back;
         }
         else
         {
-            hit.Normal = AxisAlignedBox<T>::GetNormal(AxisAlignedBox<T>::NormalSelect::Front);
+            face = NormalSelect::Front;
         }
     }
 
@@ -269,6 +257,7 @@ bool GetIntersection(const Ray& ray, const AxisAlignedBox<T>& box, HitInfo& hit)
 }
 
 // Return if the ray intersects or not (or starts inside of). Optimized.
+// Boxes behind the ray or beyond its tMax are missed.
 template<typename T>
 bool CheckIntersection(const Ray& ray, const AxisAlignedBox<T>& box)
 {
@@ -280,7 +269,7 @@ bool CheckIntersection(const Ray& ray, const AxisAlignedBox<T>& box)
 
     AABIntersectData<T> data;
     DoIntersect(ray, box, data);
-    return data.tMax >= data.tMin;
+    return data.tMax >= std::max(static_cast<T>(0), data.tMin) && data.tMin < ray.GetTMax();
 }
 
 template<typename T>
@@ -292,4 +281,4 @@ inline std::ostream& operator <<(std::ostream& os, const AxisAlignedBox<T>& B)
            B.GetFront() << "," << B.GetBack() << "]" ;
 }
 
-using BoxF = AxisAlignedBox<double>;
\ No newline at end of file
+using BoxF = AxisAlignedBox<Scalar>;
\ No newline at end of file
@@ -1,15 +1,45 @@
 #pragma once
 
 #include "Pixel.h"
-#include "Thread.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
-/** A manager of pixels for the render threads to pull from to get their next job. */
+// The order a PixelQueue hands out its tiles in
+enum class TileOrder : uint8_t
+{
+    Scanline,   // Row by row
+    Morton,     // Along a Z-order curve
+    Hilbert     // Along a Hilbert curve, each tile next to the one before it
+};
+
+// How a PixelQueue splits up the image
+struct TileSettings
+{
+    unsigned int Size;      // Width and height of a tile in pixels
+    TileOrder Order;
+    bool bCentreFirst;      // Square rings of tiles from the centre out, each ring in Order
+};
+
+// Settings of every render's queue (set from the command line)
+extern TileSettings TileMode;
+
+/**
+ *  A manager of pixels for the render threads to pull from to get their next job.
+ *  The image is split into square tiles whose pixels are handed out together, so that a
+ *  thread's neighbouring pixels see the same parts of the scene. Pixels are claimed from
+ *  an atomic counter rather than under a lock.
+ */
 class PixelQueue
 {
 public:
     using DimensionType = typename Pixel::StorageType;
 
-    PixelQueue(DimensionType maxX, DimensionType maxY);
+    PixelQueue(DimensionType maxX, DimensionType maxY, const TileSettings& settings = TileMode);
+
+    PixelQueue(const PixelQueue&) = delete;
+    PixelQueue& operator=(const PixelQueue&) = delete;
 
     /**
      *  Get the next pixel in the queue
@@ -17,12 +47,27 @@ public:
      */
     Pixel GetNextPixel();
 
+    /**
+     *  Append up to Max of the next pixels to Out, claimed together
+     *  @return how many were appended, 0 if no more exist
+     */
+    size_t GetNextPixels(std::vector<Pixel>& Out, size_t Max);
+
 private:
-    Mutex m_mutex;
+    /** The pixel of a slot, false if it is past the image edge in an edge tile */
+    bool GetSlotPixel(size_t Slot, DimensionType& x, DimensionType& y) const;
 
     /** Assumes the pixels start from [0,0] */
-    DimensionType m_currentX;
-    DimensionType m_currentY;
     DimensionType m_maxX;
     DimensionType m_maxY;
-};
\ No newline at end of file
+    DimensionType m_tileSize;
+    size_t m_tileArea;
+    size_t m_numSlots;      // m_tileArea for every tile
+
+    /** Top left pixel of each tile, in the order they're handed out */
+    std::vector<Pixel> m_tiles;
+
+    /** Keeps the counter every thread writes off the cache line of the members above */
+    char m_padding[64];
+    std::atomic<size_t> m_nextSlot;
+};
@@ -37,7 +37,8 @@ protected:
 public:
 	Thread();
 	Thread( Thread& T ) = delete;
-	~Thread();
+	/** Virtual so threads can be owned and destroyed through a base pointer */
+	virtual ~Thread();
 
 	/** The function that runs in the thread */
 	virtual void Main() = 0;
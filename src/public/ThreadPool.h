@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Thread.h"
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Worker threads kept for the whole run, which every phase hands its work to as tasks, so
+// photon mapping, acceleration builds, rendering and encoding share the cores without
+// starting threads of their own.
+// Each worker has a deque of tasks: it runs the newest of its own, which is where the tasks
+// it submits go, and when it has none steals the oldest of another worker's.
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+	// Tasks that are waited on together
+	class TaskGroup
+	{
+		ThreadPool& Pool;
+		std::atomic<size_t> Pending;
+
+	public:
+		explicit TaskGroup( ThreadPool& Pool = ThreadPool::Get() );
+		TaskGroup( TaskGroup& G ) = delete;
+		~TaskGroup();
+
+		void Run( Task T );
+
+		/** Run the pool's tasks on this thread until every task of the group has finished */
+		void Wait();
+
+		TaskGroup& operator=( TaskGroup& G ) = delete;
+	};
+
+	explicit ThreadPool( unsigned int NumWorkers );
+	ThreadPool( ThreadPool& P ) = delete;
+	~ThreadPool();
+
+	/** The pool shared by every phase, with a worker per core placed as AffinityMode says */
+	static ThreadPool& Get();
+
+	size_t GetNumWorkers() const { return Workers.size(); }
+
+	/** Call Body(i) for each i in [Begin, End), Grain of them to a task, and wait for them all */
+	template<typename Fn>
+	void ParallelFor( size_t Begin, size_t End, size_t Grain, Fn&& Body );
+
+	ThreadPool& operator=( ThreadPool& P ) = delete;
+
+private:
+	class Worker;
+
+	struct TaskQueue
+	{
+		Mutex Lock;
+		std::deque<Task> Tasks;
+	};
+
+	/** Onto the calling worker's queue, or the workers' in turn from other threads */
+	void Push( Task T );
+
+	/** Run a task from the calling worker's queue, or stolen from another's if it has none */
+	bool RunOne();
+
+	void WorkerMain( size_t Index );
+
+	std::vector<std::unique_ptr<TaskQueue>> Queues;
+	std::vector<std::unique_ptr<Worker>> Workers;
+
+	// Workers with nothing to run or steal sleep until a task is pushed
+	Mutex SleepLock;
+	CondLock Wake;
+	std::atomic<size_t> NumQueued;
+	std::atomic<size_t> NextQueue;
+	std::atomic<bool> bStopping;
+};
+
+template<typename Fn>
+void ThreadPool::ParallelFor( size_t Begin, size_t End, size_t Grain, Fn&& Body )
+{
+	Grain = std::max<size_t>(Grain, 1);
+	TaskGroup Group(*this);
+	for (size_t First = Begin; First < End; First += Grain)
+	{
+		const size_t Last = std::min(End, First + Grain);
+		Group.Run([&Body, First, Last]
+		{
+			for (size_t i = First; i < Last; ++i)
+			{
+				Body(i);
+			}
+		});
+	}
+	Group.Wait();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Where the thread pool's workers run
+enum class ThreadPlacement : uint8_t
+{
+    None,       // Wherever the OS schedules them
+    Compact,    // Pinned to a CPU each, filling a NUMA node before moving on to the next
+    Scatter     // Pinned to a CPU each, taking the NUMA nodes in turn
+};
+
+struct AffinitySettings
+{
+    ThreadPlacement Placement;
+    bool bReplicate;    // Copy large meshes into each NUMA node's memory for its threads to trace
+};
+
+// Settings of the pool and the scene's meshes (set from the command line)
+extern AffinitySettings AffinityMode;
+
+// The CPUs this process may run on, grouped by NUMA node. One node of them all where the
+// system doesn't describe its nodes.
+const std::vector<std::vector<unsigned int>>& GetNumaNodes();
+
+// Pin the calling thread to the CPU the Index'th thread is given under Placement, so its
+// allocations are first touched on that CPU's node.
+// @return false if Placement is None or the thread couldn't be pinned
+bool PinThread(ThreadPlacement Placement, size_t Index);
+
+// The NUMA node the calling thread was pinned to, 0 if it wasn't
+unsigned int GetThreadNumaNode();
+
+// Call Fn(Node) for each NUMA node on a thread pinned to that node's CPUs, all at once,
+// and wait for them
+void RunOnEachNumaNode(const std::function<void(unsigned int Node)>& Fn);
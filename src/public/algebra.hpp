@@ -30,7 +30,7 @@ inline Matrix4x4 operator *(const Matrix4x4& a, const Matrix4x4& b);
 class Matrix4x4
 {
 public:
-    using value_type = double;
+    using value_type = Scalar;
 
     static const Matrix4x4 Identity;
 
@@ -82,6 +82,11 @@ public:
         return (value_type*)v_ + 4 * row;
     }
 
+    const value_type* getRowData(size_t row) const
+    {
+        return v_ + 4 * row;
+    }
+
     Vector4D getColumn(size_t col) const
     {
         return Vector4D(v_[col], v_[4 + col], v_[8 + col], v_[12 + col]);
@@ -172,7 +177,7 @@ struct MultMtxRowCol<Matrix4x4, 4>
 {
     static inline auto eval(const Matrix4x4&, const Matrix4x4&, const size_t, const size_t)
     {
-        return 0.0;
+        return Matrix4x4::value_type(0);
     }
 };
 
@@ -191,20 +196,19 @@ inline Matrix4x4 operator*(const Matrix4x4& a, const Matrix4x4& b)
     return ret;
 }
 
+inline Vector4D operator*(const Matrix4x4& M, const Vector4D& v)
+{
+    return Vector4D(FastMath::Simd::MatVec(M.getRowData(0), M.getRowData(1), M.getRowData(2), M.getRowData(3), v[0], v[1], v[2], v[3]));
+}
+
 inline Vector3D operator*(const Matrix4x4& M, const Vector3D& v)
 {
-    return Vector3D(
-               v[0] * M[0][0] + v[1] * M[0][1] + v[2] * M[0][2],
-               v[0] * M[1][0] + v[1] * M[1][1] + v[2] * M[1][2],
-               v[0] * M[2][0] + v[1] * M[2][1] + v[2] * M[2][2]);
+    return Vector3D(FastMath::Simd::TransformVector(M.getRowData(0), M.getRowData(1), M.getRowData(2), v[0], v[1], v[2]));
 }
 
 inline Point3D operator*(const Matrix4x4& M, const Point3D& p)
 {
-    return Point3D(
-               p[0] * M[0][0] + p[1] * M[0][1] + p[2] * M[0][2] + M[0][3],
-               p[0] * M[1][0] + p[1] * M[1][1] + p[2] * M[1][2] + M[1][3],
-               p[0] * M[2][0] + p[1] * M[2][1] + p[2] * M[2][2] + M[2][3]);
+    return Point3D(FastMath::Simd::TransformPoint(M.getRowData(0), M.getRowData(1), M.getRowData(2), p[0], p[1], p[2]));
 }
 
 inline Vector3D transNorm(const Matrix4x4& M, const Vector3D& n)
@@ -215,6 +219,76 @@ inline Vector3D transNorm(const Matrix4x4& M, const Vector3D& n)
                n[0] * M[0][2] + n[1] * M[1][2] + n[2] * M[2][2]);
 }
 
+// A Matrix4x4 whose bottom row is [0 0 0 1], kept as its top three rows.
+// Enough for every scene transform and cheaper to apply and invert.
+class AffineTransform
+{
+public:
+    using value_type = Scalar;
+
+    AffineTransform()
+    {
+        for (size_t i = 0; i < 12; ++i)
+        {
+            v_[i] = (i % 5 == 0) ? 1.0 : 0.0;
+        }
+    }
+
+    // Drops M's bottom row
+    explicit AffineTransform(const Matrix4x4& M)
+    {
+        for (size_t row = 0; row < 3; ++row)
+        {
+            for (size_t col = 0; col < 4; ++col)
+            {
+                v_[4 * row + col] = M[row][col];
+            }
+        }
+    }
+
+    const value_type* operator[](size_t row) const
+    {
+        return v_ + 4 * row;
+    }
+
+    value_type* operator[](size_t row)
+    {
+        return v_ + 4 * row;
+    }
+
+    // Closed form inverse through the 3x3 adjugate
+    AffineTransform invert() const;
+
+    // Takes normals through this transform: the inverse transpose of the 3x3 part
+    AffineTransform normalMatrix() const;
+
+private:
+    value_type v_[12];
+};
+
+inline AffineTransform operator*(const AffineTransform& a, const AffineTransform& b)
+{
+    AffineTransform ret;
+    for (size_t row = 0; row < 3; ++row)
+    {
+        for (size_t col = 0; col < 4; ++col)
+        {
+            ret[row][col] = a[row][0] * b[0][col] + a[row][1] * b[1][col] + a[row][2] * b[2][col] + (col == 3 ? a[row][3] : 0);
+        }
+    }
+    return ret;
+}
+
+inline Vector3D operator*(const AffineTransform& M, const Vector3D& v)
+{
+    return Vector3D(FastMath::Simd::TransformVector(M[0], M[1], M[2], v[0], v[1], v[2]));
+}
+
+inline Point3D operator*(const AffineTransform& M, const Point3D& p)
+{
+    return Point3D(FastMath::Simd::TransformPoint(M[0], M[1], M[2], p[0], p[1], p[2]));
+}
+
 inline std::ostream& operator <<(std::ostream& os, const Matrix4x4& M)
 {
     return os << "[" << M[0][0] << " " << M[0][1] << " "
@@ -230,102 +304,98 @@ inline std::ostream& operator <<(std::ostream& os, const Matrix4x4& M)
            << M[3][2] << " " << M[3][3] << "]";
 }
 
+// r, g, b and a 0 pad lane, worked on as Simd::Lanes4
 class Colour
 {
 public:
+    using Lanes = FastMath::Simd::Lanes4<double>;
+
     Colour(double r, double g, double b)
-        : r_(r)
-        , g_(g)
-        , b_(b)
+        : c_{r, g, b, 0.0}
     {}
 
     Colour(double c)
-        : r_(c)
-        , g_(c)
-        , b_(c)
+        : c_{c, c, c, 0.0}
     {}
 
     Colour()
-        : r_(0.0)
-        , g_(0.0)
-        , b_(0.0)
+        : c_{0.0, 0.0, 0.0, 0.0}
     {}
 
     Colour(const Colour& other)
-        : r_(other.r_)
-        , g_(other.g_)
-        , b_(other.b_)
-    {}
+    {
+        other.lanes().Store(c_);
+    }
+
+    explicit Colour(const Lanes& lanes)
+    {
+        lanes.Store(c_);
+    }
 
     static const Colour Black;
     static const Colour White;
 
     Colour& operator=(const Colour& other)
     {
-        r_ = other.r_;
-        g_ = other.g_;
-        b_ = other.b_;
+        other.lanes().Store(c_);
         return *this;
     }
 
+    Lanes lanes() const
+    {
+        return Lanes::Load(c_);
+    }
+
     double R() const noexcept
     {
-        return r_;
+        return c_[0];
     }
 
     double G() const noexcept
     {
-        return g_;
+        return c_[1];
     }
 
     double B() const noexcept
     {
-        return b_;
+        return c_[2];
     }
 
     double& R() noexcept
     {
-        return r_;
+        return c_[0];
     }
 
     double& G() noexcept
     {
-        return g_;
+        return c_[1];
     }
 
     double& B() noexcept
     {
-        return b_;
+        return c_[2];
     }
 
     Colour& operator*=(const double& value)
     {
-        r_ *= value;
-        g_ *= value;
-        b_ *= value;
+        (lanes() * Lanes::Broadcast3(value)).Store(c_);
         return *this;
     }
  
     Colour& operator/=(const double& value)
     {
-        r_ /= value;
-        g_ /= value;
-        b_ /= value;
+        (lanes() / Lanes::Set(value, value, value, 1.0)).Store(c_);
         return *this;
     }
 
     Colour& operator+=(const Colour& other)
     {
-        r_ += other.r_;
-        g_ += other.g_;
-        b_ += other.b_;
+        (lanes() + other.lanes()).Store(c_);
         return *this;
     }
 
 private:
-    double r_;
-    double g_;
-    double b_;
+    double c_[4];
 };
 
 inline bool operator==(const Colour& a, const Colour& b)
@@ -345,22 +415,28 @@ inline bool operator!=(const Colour& a, const Colour& b)
 
 inline Colour operator*(double s, const Colour& a)
 {
-    return Colour(s * a.R(), s * a.G(), s * a.B());
+    return Colour(Colour::Lanes::Broadcast3(s) * a.lanes());
+}
+
+// Without this a * s would convert s to a Colour first
+inline Colour operator*(const Colour& a, double s)
+{
+    return Colour(a.lanes() * Colour::Lanes::Broadcast3(s));
 }
 
 inline Colour operator*(const Colour& a, const Colour& b)
 {
-    return Colour(a.R() * b.R(), a.G() * b.G(), a.B() * b.B());
+    return Colour(a.lanes() * b.lanes());
 }
 
 inline Colour operator/(const Colour& a, const double& b)
 {
-    return Colour(a.R() / b, a.G() / b, a.B() / b);
+    return Colour(a.lanes() / Colour::Lanes::Set(b, b, b, 1.0));
 }
 
 inline Colour operator+(const Colour& a, const Colour& b)
 {
-    return Colour(a.R() + b.R(), a.G() + b.G(), a.B() + b.B());
+    return Colour(a.lanes() + b.lanes());
 }
 
 inline std::ostream& operator <<(std::ostream& os, const Colour& c)
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "fastmath.h"
+
+// Set by -f, the renderer then samples and shades with the approximations below
+extern bool bUseApproxMath;
+
+namespace FastMath
+{
+
+// ################################################################
+// ### Approximations
+// ################################################################
+
+// Stand ins for libm in the sampling and shading code. They are straight line code
+// without calls or branches, so loops over them can vectorize. Each states its largest
+// error over its domain, measured against libm over a dense sweep of it.
+
+namespace Approx
+{
+inline uint64_t ToBits(double x)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+inline double FromBits(uint64_t bits)
+{
+    double x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+// b ? x : y without a branch, compilers turn ?: on doubles into jumps
+inline double Select(bool b, double x, double y)
+{
+    const uint64_t mask = uint64_t(0) - uint64_t(b);
+    return FromBits((ToBits(x) & mask) | (ToBits(y) & ~mask));
+}
+
+// x rounded to the nearest integer, for |x| < 2^51
+inline double Round(double x)
+{
+    const double shift = 6755399441055744.0;    // 1.5 * 2^52
+    return (x + shift) - shift;
+}
+} // namespace Approx
+
+// log2(x) for normal x > 0, absolute error below 5e-8
+inline double Log2Approx(double x)
+{
+    // Split x into 2^exponent * m with m in [sqrt(1/2), sqrt(2)), centred on 1 so
+    // the series below converges fast
+    const uint64_t bits = Approx::ToBits(x);
+    const int64_t exponent = int64_t(bits - 0x3fe6a09e667f3bcdULL) >> 52;
+    const double m = Approx::FromBits(bits - (uint64_t(exponent) << 52));
+
+    // ln(m) = 2 atanh(t), |t| <= 0.172
+    const double t = (m - 1) / (m + 1);
+    const double t2 = t * t;
+    const double series = 1 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7)));
+    return double(exponent) + (2 * t * series) * 1.4426950408889634;
+}
+
+// 2^y, y is clamped to [-1022, 1023]. Relative error below 1e-8.
+inline double Exp2Approx(double y)
+{
+    y = std::max(-1022.0, std::min(y, 1023.0));
+    const double n = Approx::Round(y);
+
+    // e^(f ln 2) for |f| <= 0.5
+    const double x = (y - n) * 0.6931471805599453;
+    const double p = 1 + x * (1 + x * (1.0 / 2 + x * (1.0 / 6 + x * (1.0 / 24 + x * (1.0 / 120 + x * (1.0 / 720 +
+                     x * (1.0 / 5040)))))));
+    return p * Approx::FromBits(uint64_t(int64_t(n) + 1023) << 52);
+}
+
+// x^y for x >= 0, 0^0 is 1. Relative error below 6e-8 * (1 + |y log2(x)|).
+inline double PowApprox(double x, double y)
+{
+    const double r = Exp2Approx(y * Log2Approx(Approx::Select(x > 0, x, 1)));
+    return Approx::Select(x > 0, r, Approx::Select(y == 0, 1, 0));
+}
+
+// sin(x) and cos(x) for |x| <= 1e5, absolute error below 2e-9
+inline void SinCosApprox(double x, double& s, double& c)
+{
+    // Take out the nearest multiple k of pi/2 in two parts so r stays exact
+    const double k = Approx::Round(x * 0.63661977236758134);
+    const double r = (x - k * 1.57079632673412561417) - k * 6.07710050650619224932e-11;
+    const double r2 = r * r;
+
+    // Series on |r| <= pi/4
+    const double sr = r * (1 - r2 * (1.0 / 6 - r2 * (1.0 / 120 - r2 * (1.0 / 5040 - r2 * (1.0 / 362880)))));
+    const double cr = 1 - r2 * (1.0 / 2 - r2 * (1.0 / 24 - r2 * (1.0 / 720 - r2 * (1.0 / 40320 - r2 * (1.0 / 3628800)))));
+
+    const int64_t quadrant = int64_t(k) & 3;
+    const double sq = Approx::Select(quadrant & 1, cr, sr);
+    const double cq = Approx::Select(quadrant & 1, sr, cr);
+    s = Approx::FromBits(Approx::ToBits(sq) ^ (uint64_t(quadrant & 2) << 62));
+    c = Approx::FromBits(Approx::ToBits(cq) ^ (uint64_t((quadrant + 1) & 2) << 62));
+}
+
+// acos(x) for x in [-1, 1], absolute error below 3e-8.
+// Abramowitz and Stegun 4.4.46.
+inline double AcosApprox(double x)
+{
+    const double a = std::min(std::fabs(x), 1.0);
+    const double p = 1.5707963050 + a * (-0.2145988016 + a * (0.0889789874 + a * (-0.0501743046 +
+                     a * (0.0308918810 + a * (-0.0170881256 + a * (0.0066700901 + a * -0.0012624911))))));
+    const double r = std::sqrt(1 - a) * p;
+    return Approx::Select(x < 0, PI - r, r);
+}
+
+// 1 / sqrt(x) for normal x > 0, relative error below 4e-11
+inline double RsqrtApprox(double x)
+{
+    // Halving the exponent bits gives a guess within 4%, each Newton step squares the error
+    double y = Approx::FromBits(0x5fe6eb50c7b537a9ULL - (Approx::ToBits(x) >> 1));
+    const double halfX = 0.5 * x;
+    y = y * (1.5 - halfX * y * y);
+    y = y * (1.5 - halfX * y * y);
+    y = y * (1.5 - halfX * y * y);
+    return y;
+}
+
+// The calls the renderer makes, approximated when bUseApproxMath is set.
+// The libm calls stay the default so images don't change unless asked.
+inline double Pow(double x, double y)
+{
+    return bUseApproxMath ? PowApprox(x, y) : std::pow(x, y);
+}
+
+inline double Acos(double x)
+{
+    return bUseApproxMath ? AcosApprox(x) : std::acos(x);
+}
+
+inline void SinCos(double x, double& s, double& c)
+{
+    if (bUseApproxMath)
+    {
+        SinCosApprox(x, s, c);
+    }
+    else
+    {
+        s = std::sin(x);
+        c = std::cos(x);
+    }
+}
+
+// v.normalize(), approximated when bUseApproxMath is set
+inline void Normalize(Vector3D& v)
+{
+    if (bUseApproxMath)
+    {
+        v *= RsqrtApprox(v.length2());
+    }
+    else
+    {
+        v.normalize();
+    }
+}
+
+} // namespace FastMath
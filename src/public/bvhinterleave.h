@@ -0,0 +1,112 @@
+#pragma once
+
+#include "AxisAlignedBox.h"
+#include "cpudispatch.h"
+#include "mesh.hpp"
+#include "ray.h"
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RT_PREFETCH(Address) __builtin_prefetch(Address)
+#else
+#define RT_PREFETCH(Address)
+#endif
+
+// Most rays TraceInterleaved keeps in flight
+constexpr size_t MaxInterleavedRays = 16;
+
+// Smaller trees mostly stay in the cache, where taking turns costs more than it hides,
+// so primitives trace rays through them one at a time instead
+constexpr size_t MinInterleavedBytes = size_t(16) << 20;
+
+// Trace Count independent rays through a tree of MeshBVHNodes together, for trees much
+// larger than the cache. Each ray walks the tree with its own stack in the order a lone
+// trace would, but the rays take turns a node at a time: a ray prefetches the children it
+// pushes, or the contents of a leaf it reaches, and then yields so that the fetch is in
+// flight while the other rays work.
+// PrefetchLeaf(Node) prefetches a leaf's contents and TraceLeaf(i, Node) traces Rays[i]
+// against them on the ray's next turn. Up to MaxInterleavedRays rays are in flight, the
+// rest wait for a place.
+template<typename PrefetchFn, typename LeafFn>
+RT_KERNEL_INLINE void TraceInterleaved(const MeshBVHNode* Nodes, Ray* Rays[], size_t Count, PrefetchFn&& PrefetchLeaf, LeafFn&& TraceLeaf)
+{
+    const uint32_t NoLeaf = ~uint32_t(0);
+
+    // Median splits keep the tree depth well below the stack size
+    struct Walk
+    {
+        uint32_t Stack[64];
+        uint32_t StackSize;
+        uint32_t Leaf;      // Reached on the last turn, traced on the next
+        uint32_t Ray;
+    };
+    Walk Walks[MaxInterleavedRays];
+    size_t NumWalks = 0;
+    size_t NextRay = 0;
+    auto StartWalk = [&](Walk& W)
+    {
+        W.Stack[0] = 0;
+        W.StackSize = 1;
+        W.Leaf = NoLeaf;
+        W.Ray = static_cast<uint32_t>(NextRay++);
+    };
+    while (NumWalks < MaxInterleavedRays && NextRay < Count)
+    {
+        StartWalk(Walks[NumWalks++]);
+    }
+
+    while (NumWalks > 0)
+    {
+        for (size_t w = 0; w < NumWalks;)
+        {
+            Walk& W = Walks[w];
+            Ray& R = *Rays[W.Ray];
+            if (W.Leaf != NoLeaf)
+            {
+                TraceLeaf(W.Ray, Nodes[W.Leaf]);
+                W.Leaf = NoLeaf;
+            }
+            else
+            {
+                const uint32_t nodeIndex = W.Stack[--W.StackSize];
+                const MeshBVHNode& Node = Nodes[nodeIndex];
+
+                // Also skips nodes beyond the closest hit so far
+                if (CheckIntersection(R, Node.Bounds))
+                {
+                    if (Node.Count > 0)
+                    {
+                        PrefetchLeaf(Node);
+                        W.Leaf = nodeIndex;
+                    }
+                    else
+                    {
+                        W.Stack[W.StackSize++] = Node.Start;
+                        W.Stack[W.StackSize++] = nodeIndex + 1;
+                        RT_PREFETCH(&Nodes[Node.Start]);
+                        RT_PREFETCH(&Nodes[nodeIndex + 1]);
+                    }
+                }
+            }
+
+            // A finished ray hands its place to the next waiting one, or else the last one
+            if (W.StackSize == 0 && W.Leaf == NoLeaf)
+            {
+                if (NextRay < Count)
+                {
+                    StartWalk(W);
+                    ++w;
+                }
+                else
+                {
+                    W = Walks[--NumWalks];
+                }
+            }
+            else
+            {
+                ++w;
+            }
+        }
+    }
+}
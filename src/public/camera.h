@@ -3,6 +3,7 @@
 #include "luacamera.h"
 #include "algebra.hpp"
 #include "ray.h"
+#include <algorithm>
 #include <iosfwd>
 #include <memory>
 
@@ -13,6 +14,7 @@ struct RenderPlaneParams
     double pixelHeight;
     double halfWidth;
     double halfHeight;
+    double pixelSpread;     // Angle covered by one pixel
 };
 
 // Represents the scene camera
@@ -55,6 +57,7 @@ protected:
 
         m_planeParams.pixelWidth = cameraWidth / (width - 1);
         m_planeParams.pixelHeight = cameraHeight / (height - 1);
+        m_planeParams.pixelSpread = std::max(m_planeParams.pixelWidth, m_planeParams.pixelHeight) / m_luaCamera.FocalDistance;
     }
 
 public:
@@ -62,6 +65,14 @@ public:
     virtual ~Camera() = default;
 
     Ray GetRayThroughPixel(const int x, const int y, const double& xNorm, const double& yNorm) const
+    {
+        return GetRayThroughPixelAs<Camera>(x, y, xNorm, yNorm);
+    }
+
+    // GetRayThroughPixel of a camera known to be a CameraType, whose GetRandomEye is then
+    // called directly and can be inlined
+    template<typename CameraType>
+    Ray GetRayThroughPixelAs(const int x, const int y, const double& xNorm, const double& yNorm) const
     {
         // Determine the location on the render plane to fire the ray through
         // xNorm == 0 && yNorm == 0 -> bottom left of pixel (x,y)
@@ -71,10 +82,12 @@ public:
         Vector3D View = m_luaCamera.FocalDistance * m_luaCamera.view;
         Point3D ViewPlanePoint = m_luaCamera.eye + View + rightComp + upComp;
 
-        Point3D RandomEyePoint = GetRandomEye();
+        Point3D RandomEyePoint = static_cast<const CameraType*>(this)->GetRandomEye();
         Vector3D RayDir = ViewPlanePoint - RandomEyePoint;
         RayDir.normalize();
-        return Ray(RandomEyePoint, RayDir);
+        Ray R(RandomEyePoint, RayDir);
+        R.SetFootprint(0.0, m_planeParams.pixelSpread);
+        return R;
     }
 
     virtual Point3D GetRandomEye() const = 0;
@@ -87,7 +100,7 @@ public:
 };
 
 // Simulated camera with a lense and focal disance
-class LenseCamera : public Camera
+class LenseCamera final : public Camera
 {
 protected:
     explicit LenseCamera(const std::shared_ptr<LuaCamera>& initData,
@@ -110,7 +123,7 @@ public:
 };
 
 // Point camera with no aperture
-class PointCamera : public Camera
+class PointCamera final : public Camera
 {
 protected:
     explicit PointCamera(const std::shared_ptr<LuaCamera>& initData,
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+// Instruction sets the hot kernels are built for, each a superset of the one before
+enum class CpuLevel : uint8_t
+{
+    Generic,    // What the rest of the program is compiled for
+    SSE42,
+    AVX2,       // Also FMA and BMI2
+    AVX512      // F, VL, DQ and BW
+};
+
+// The best level this CPU supports
+CpuLevel DetectCpuLevel();
+
+// The level kernels run at, DetectCpuLevel() unless changed through SetCpuLevel
+extern CpuLevel ActiveCpuLevel;
+
+inline CpuLevel GetCpuLevel()
+{
+    return ActiveCpuLevel;
+}
+
+// Run kernels at the level called name (generic, sse4.2, avx2 or avx512).
+// Returns false, keeping the current level, if name is unknown or this CPU lacks it.
+bool SetCpuLevel(const std::string& name);
+
+const char* GetCpuLevelName(CpuLevel level);
+
+// Compile a function for a level's instructions. Kernels are inline bodies marked
+// RT_KERNEL_INLINE, built once per level through RT_FOR_EACH_CPU_LEVEL and
+// called through DispatchCpu.
+// Builds other than GCC or Clang on x86 only have the generic level.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RT_CPU_DISPATCH 1
+#define RT_TARGET_SSE42 __attribute__((target("sse4.2,popcnt")))
+#define RT_TARGET_AVX2 __attribute__((target("avx2,fma,bmi,bmi2,popcnt")))
+// Full width zmm loops lower the clock more than they gain on short batches, so AVX-512
+// builds keep to 256 bit vectors and use the extra instructions and registers
+#define RT_TARGET_AVX512 __attribute__((target("prefer-vector-width=256,avx512f,avx512vl,avx512dq,avx512bw,avx2,fma,bmi,bmi2,popcnt")))
+#define RT_KERNEL_INLINE inline __attribute__((always_inline))
+// For lambdas inside kernels, which would otherwise be built once for every level
+#define RT_KERNEL_LAMBDA __attribute__((always_inline))
+#else
+#define RT_TARGET_SSE42
+#define RT_TARGET_AVX2
+#define RT_TARGET_AVX512
+#define RT_KERNEL_INLINE inline
+#define RT_KERNEL_LAMBDA
+#endif
+
+// Expands X(level, target attribute) for every CpuLevel
+#define RT_FOR_EACH_CPU_LEVEL(X) \
+    X(CpuLevel::Generic, ) \
+    X(CpuLevel::SSE42, RT_TARGET_SSE42) \
+    X(CpuLevel::AVX2, RT_TARGET_AVX2) \
+    X(CpuLevel::AVX512, RT_TARGET_AVX512)
+
+template<CpuLevel Level>
+using CpuLevelTag = std::integral_constant<CpuLevel, Level>;
+
+// Call Kernel with the CpuLevelTag of the active level, Kernel picks its build for it
+template<typename Kernel>
+inline auto DispatchCpu(Kernel&& kernel)
+{
+    switch (GetCpuLevel())
+    {
+    case CpuLevel::AVX512:
+        return kernel(CpuLevelTag<CpuLevel::AVX512>());
+    case CpuLevel::AVX2:
+        return kernel(CpuLevelTag<CpuLevel::AVX2>());
+    case CpuLevel::SSE42:
+        return kernel(CpuLevelTag<CpuLevel::SSE42>());
+    default:
+        return kernel(CpuLevelTag<CpuLevel::Generic>());
+    }
+}
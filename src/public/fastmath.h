@@ -4,17 +4,26 @@
 #include <cstring>
 #include <iostream>
 #include <cmath>
+#include "simd.h"
 
 #define EPSILON 0.0001
 #define EPSILON2 (EPSILON * EPSILON)
 
+// The type geometry and rays are stored and traced in.
+// Building with RT_SINGLE_PRECISION (make PRECISION=single) traces in float.
+#ifdef RT_SINGLE_PRECISION
+using Scalar = float;
+#else
+using Scalar = double;
+#endif
+
 namespace FastMath
 {
 
 static constexpr double PI = 3.14159265358979323846;
 
 template<typename T>
-inline bool IsNearly(const T& a, const T& comp, T EPS = EPSILON)
+inline bool IsNearly(const T& a, const T& comp, T EPS = T(EPSILON))
 {
     return std::abs(a - comp) < EPS;
 }
@@ -51,26 +60,29 @@ struct MultArrays
         return a[I] * b[I] + MultArrays < Type, N, I + 1 >::eval(a, b);
     }
 };
-// Specialize for 4D, 3D and 2D
-template<> struct MultArrays<double, 4, 4>
+// Terminate at the end of the arrays
+template<class Type, size_t N> struct MultArrays<Type, N, N>
 {
-    static inline double eval(const double (&)[4], const double (&)[4])
+    static inline Type eval(const Type (&)[N], const Type (&)[N])
     {
-        return 0.0;
+        return Type(0);
     }
 };
-template<> struct MultArrays<double, 3, 3>
+
+// MultArrays over the whole arrays, in SIMD lanes for 4 element arrays
+template<class Type, size_t N>
+struct DotArrays
 {
-    static inline double eval(const double (&)[3], const double (&)[3])
+    static inline Type eval(const Type(&a)[N], const Type(&b)[N])
     {
-        return 0.0;
+        return MultArrays<Type, N, 0>::eval(a, b);
     }
 };
-template<> struct MultArrays<double, 2, 2>
+template<class Type> struct DotArrays<Type, 4>
 {
-    static inline double eval(const double (&)[2], const double (&)[2])
+    static inline Type eval(const Type(&a)[4], const Type(&b)[4])
     {
-        return 0.0;
+        return Simd::Lanes4<Type>::Load(a).Dot(Simd::Lanes4<Type>::Load(b));
     }
 };
 
@@ -86,92 +98,123 @@ struct MultArrayScalar
         MultArrayScalar < Type, N, I + 1 >::eval(a, std::forward<decltype(scalar)>(scalar));
     }
 };
-// Specialize for 4D, 3D and 2D
-template<> struct MultArrayScalar<double, 4, 4>
+// Terminate at the end of the array
+template<class Type, size_t N> struct MultArrayScalar<Type, N, N>
 {
-    static inline void eval(const double (&)[4], const double&&) {}
+    static inline void eval(const Type (&)[N], const Type&&) {}
 };
-template<> struct MultArrayScalar<double, 3, 3>
+
+// MultArrayScalar over the whole array, in SIMD lanes for 4 element arrays
+template<class Type, size_t N>
+struct ScaleArray
 {
-    static inline void eval(const double (&)[3], const double&&) {}
+    static inline void eval(Type(&a)[N], const Type& scalar)
+    {
+        MultArrayScalar<Type, N, 0>::eval(a, Type(scalar));
+    }
 };
-template<> struct MultArrayScalar<double, 2, 2>
+template<class Type> struct ScaleArray<Type, 4>
 {
-    static inline void eval(const double (&)[2], const double&&) {}
+    static inline void eval(Type(&a)[4], const Type& scalar)
+    {
+        (Simd::Lanes4<Type>::Load(a) * Simd::Lanes4<Type>::Broadcast(scalar)).Store(a);
+    }
 };
 
 
 
 // Assign one array's contents to anothers
+template<class Type, size_t N, size_t I>
+struct ArrayCopy
+{
+    static inline void eval(Type(&to)[N], const Type(&from)[N])
+    {
+        to[I] = from[I];
+        ArrayCopy < Type, N, I + 1 >::eval(to, from);
+    }
+};
+// Terminate at the end of the arrays
+template<class Type, size_t N> struct ArrayCopy<Type, N, N>
+{
+    static inline void eval(Type(&)[N], const Type(&)[N]) {}
+};
+
 template<class Type, size_t N, size_t I>
 inline void FastArrayCopy(Type(&to)[N], const Type(&from)[N])
 {
     static_assert(N > 0, "Array must have size > 0");
-
-    to[I] = from[I];
-    FastArrayCopy < Type, N, I + 1 > (to, from);
+    ArrayCopy<Type, N, I>::eval(to, from);
 }
-// Specialize for 4D, 3D and 2D
-template<>
-inline void FastArrayCopy<double, 16, 16>(double(&)[16], const double(&)[16]) {}
-
-template<>
-inline void FastArrayCopy<double, 4, 4>(double(&)[4], const double(&)[4]) {}
 
-template<>
-inline void FastArrayCopy<double, 3, 3>(double(&)[3], const double(&)[3]) {}
-
-template<>
-inline void FastArrayCopy<double, 2, 2>(double(&)[2], const double(&)[2]) {}
+// FastArrayCopy of the whole array, a single SIMD load and store for 4 element arrays
+template<class Type, size_t N>
+struct CopyArray
+{
+    static inline void eval(Type(&to)[N], const Type(&from)[N])
+    {
+        FastArrayCopy<Type, N, 0>(to, from);
+    }
+};
+template<class Type> struct CopyArray<Type, 4>
+{
+    static inline void eval(Type(&to)[4], const Type(&from)[4])
+    {
+        Simd::Lanes4<Type>::Load(from).Store(to);
+    }
+};
 
 
 
 // Assign one object with operator[] defined to another
+template<class Type, size_t N, size_t I>
+struct ArrayAssign
+{
+    static inline void eval(Type(&array)[N], const Type&& value)
+    {
+        array[I] = std::forward<decltype(value)>(value);
+        ArrayAssign < Type, N, I + 1 >::eval(array, std::forward<decltype(value)>(value));
+    }
+};
+// Terminate at the end of the array
+template<class Type, size_t N> struct ArrayAssign<Type, N, N>
+{
+    static inline void eval(Type(&)[N], const Type&&) {}
+};
+
 template<class Type, size_t N, size_t I>
 inline void FastArrayAssign(Type(&array)[N], const Type&& value)
 {
     static_assert(N > 0, "Array must have size > 0");
-
-    array[I] = std::forward<decltype(value)>(value);
-    FastArrayAssign < Type, N, I + 1 > (array, std::forward<decltype(value)>(value));
+    ArrayAssign<Type, N, I>::eval(array, std::forward<decltype(value)>(value));
 }
-// Specialize for 4D, 3D and 2D
-template<>
-inline void FastArrayAssign<double, 16, 16>(double(&)[16], const double&&) {}
-
-template<>
-inline void FastArrayAssign<double, 4, 4>(double(&)[4], const double&&) {}
-
-template<>
-inline void FastArrayAssign<double, 3, 3>(double(&)[3], const double&&) {}
-
-template<>
-inline void FastArrayAssign<double, 2, 2>(double(&)[2], const double&&) {}
 
 
 
 // ################################################################
 // ### Points
 // ################################################################
-template<size_t N, class StorageType = double>
+template<size_t N, class StorageType = Scalar>
 class Point
 {
 public:
     using value_type = StorageType;
     using point_type = Point<N, value_type>;
 
+    // Elements stored, 3 component values are padded to 4 SIMD lanes with a 0
+    static constexpr size_t Size = (N == 3) ? 4 : N;
+
     Point()
     {
-        FastArrayAssign<value_type, N, 0>(v_, 0);
+        FastArrayAssign<value_type, Size, 0>(v_, 0);
     }
 
     Point(const point_type& other)
     {
-        FastArrayCopy<value_type, N, 0>(v_, other.v_);
+        CopyArray<value_type, Size>::eval(v_, other.v_);
     }
 
     // Creates a ctor that takes N elements to initialize v_ with
-    // i,e: Point3D(double x, double y, double z){ ... }
+    // i,e: Point3D(Scalar x, Scalar y, Scalar z){ ... }
     // static_asserts are used to enforce the correct number of arguments
     template<typename... Args>
     explicit Point(const value_type& x, Args&& ... args)
@@ -179,6 +222,14 @@ public:
         v_[0] = x;
         ctorHelper(std::forward<decltype(args)>(args)...);
     }
+
+    // Built in a register so SIMD operations on it don't wait on 3 separate stores
+    explicit Point(const value_type& x, const value_type& y, const value_type& z)
+    {
+        static_assert(N == 3, "Wrong number of args passed to Point constructor");
+        Simd::Lanes4<value_type>::Set(x, y, z, value_type(0)).Store(v_);
+    }
+
     template<size_t Idx = 1, typename... Args>
     void ctorHelper(const value_type& x, Args && ... args)
     {
@@ -190,11 +241,24 @@ public:
     void ctorHelper()
     {
         static_assert(Idx == N, "Too few args passed to Point constructor");
+        FastArrayAssign<value_type, Size, N>(v_, 0);
+    }
+
+    explicit Point(const Simd::Lanes4<value_type>& lanes)
+    {
+        static_assert(Size == 4, "Only 4 lane values are made from Simd::Lanes4");
+        lanes.Store(v_);
+    }
+
+    Simd::Lanes4<value_type> lanes() const
+    {
+        static_assert(Size == 4, "Only 4 lane values have Simd::Lanes4");
+        return Simd::Lanes4<value_type>::Load(v_);
     }
 
     point_type& operator=(const point_type& other)
     {
-        FastArrayCopy<value_type, N, 0>(v_, other.v_);
+        CopyArray<value_type, Size>::eval(v_, other.v_);
         return *this;
     }
 
@@ -209,37 +273,40 @@ public:
     }
 
 private:
-    value_type v_[N];
+    value_type v_[Size];
 };
 
-using Point3D = Point<3, double>;
+using Point3D = Point<3, Scalar>;
 
 
 
 // ################################################################
 // ### Vectors
 // ################################################################
-template<size_t N, class StorageType = double>
+template<size_t N, class StorageType = Scalar>
 class Vector
 {
 public:
     using value_type = StorageType;
     using vec_type = Vector<N, value_type>;
 
+    // Elements stored, 3 component values are padded to 4 SIMD lanes with a 0
+    static constexpr size_t Size = (N == 3) ? 4 : N;
+
     static const Vector ZeroVector;
 
     Vector()
     {
-        FastArrayAssign<value_type, N, 0>(v_, 0);
+        FastArrayAssign<value_type, Size, 0>(v_, 0);
     }
 
     Vector(const vec_type& other)
     {
-        FastArrayCopy<value_type, N, 0>(v_, other.v_);
+        CopyArray<value_type, Size>::eval(v_, other.v_);
     }
 
     // Creates a ctor that takes N elements to initialize v_ with
-    // i,e: Vector4D(double x, double y, double z, double w){ ... }
+    // i,e: Vector4D(Scalar x, Scalar y, Scalar z, Scalar w){ ... }
     // static_asserts are used to enforce the correct number of arguments
     template<typename... Args>
     explicit Vector(const value_type& x, Args&& ... args)
@@ -247,6 +314,14 @@ public:
         v_[0] = x;
         ctorHelper(std::forward<decltype(args)>(args)...);
     }
+
+    // Built in a register so SIMD operations on it don't wait on 3 separate stores
+    explicit Vector(const value_type& x, const value_type& y, const value_type& z)
+    {
+        static_assert(N == 3, "Wrong number of args passed to Vector constructor");
+        Simd::Lanes4<value_type>::Set(x, y, z, value_type(0)).Store(v_);
+    }
+
     template<size_t Idx = 1, typename... Args>
     void ctorHelper(const value_type& x, Args && ... args)
     {
@@ -258,11 +333,24 @@ public:
     void ctorHelper()
     {
         static_assert(Idx == N, "Too few args passed to Vector constructor");
+        FastArrayAssign<value_type, Size, N>(v_, 0);
+    }
+
+    explicit Vector(const Simd::Lanes4<value_type>& lanes)
+    {
+        static_assert(Size == 4, "Only 4 lane values are made from Simd::Lanes4");
+        lanes.Store(v_);
+    }
+
+    Simd::Lanes4<value_type> lanes() const
+    {
+        static_assert(Size == 4, "Only 4 lane values have Simd::Lanes4");
+        return Simd::Lanes4<value_type>::Load(v_);
     }
 
     inline vec_type& operator =(const vec_type& other)
     {
-        FastArrayCopy<value_type, N, 0>(v_, other.v_);
+        CopyArray<value_type, Size>::eval(v_, other.v_);
         return *this;
     }
 
@@ -278,12 +366,12 @@ public:
 
     value_type dot(const vec_type& other) const
     {
-        return MultArrays<value_type, N, 0>::eval(v_, other.v_);
+        return DotArrays<value_type, Size>::eval(v_, other.v_);
     }
 
     value_type length2() const
     {
-        return MultArrays<value_type, N, 0>::eval(v_, v_);
+        return DotArrays<value_type, Size>::eval(v_, v_);
     }
 
     value_type length() const
@@ -293,17 +381,17 @@ public:
 
     value_type normalize()
     {
-        if (length2() > 0.0)
+        if (length2() > 0)
         {
-            value_type invlen = 1.0 / length();
-            MultElements < vec_type, N - 1 >::eval(*this, invlen);
+            value_type invlen = value_type(1) / length();
+            ScaleArray<value_type, Size>::eval(v_, invlen);
             return invlen;
         }
-        return 0.0;
+        return 0;
     }
 
 private:
-    value_type v_[N];
+    value_type v_[Size];
 };
 
 template<size_t N, class StorageType>
@@ -323,52 +411,79 @@ template<> struct MultElements < Vector4D, -1 >
     static inline void eval(Vector4D&, const typename Vector4D::value_type&) {}
 };
 
-inline Vector3D operator *(double s, const Vector3D& v)
+// 3D points and vectors work on all 4 lanes, s only scales the first 3 to keep the pad 0
+using Lanes3D = Simd::Lanes4<Scalar>;
+
+inline Vector3D operator *(Scalar s, const Vector3D& v)
 {
-    return Vector3D(s * v[0], s * v[1], s * v[2]);
+    return Vector3D(Lanes3D::Broadcast3(s) * v.lanes());
 }
 
 inline Vector3D operator +(const Vector3D& a, const Vector3D& b)
 {
-    return Vector3D(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+    return Vector3D(a.lanes() + b.lanes());
 }
 
 inline Point3D operator +(const Point3D& a, const Vector3D& b)
 {
-    return Point3D(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+    return Point3D(a.lanes() + b.lanes());
 }
 
 inline Point3D operator +(const Point3D& a, const Point3D& b)
 {
-    return Point3D(a[0] + b[0], a[1] + b[1], a[2] + b[2]);
+    return Point3D(a.lanes() + b.lanes());
 }
 
 inline Vector3D operator -(const Point3D& a, const Point3D& b)
 {
-    return Vector3D(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+    return Vector3D(a.lanes() - b.lanes());
 }
 
 inline Vector3D operator -(const Vector3D& a, const Vector3D& b)
 {
-    return Vector3D(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+    return Vector3D(a.lanes() - b.lanes());
 }
 
 inline Vector3D operator -(const Vector3D& a)
 {
-    return Vector3D(-a[0], -a[1], -a[2]);
+    return Vector3D(Lanes3D::Broadcast3(-1) * a.lanes());
 }
 
 inline Point3D operator -(const Point3D& a, const Vector3D& b)
 {
-    return Point3D(a[0] - b[0], a[1] - b[1], a[2] - b[2]);
+    return Point3D(a.lanes() - b.lanes());
+}
+
+// Accumulate in place rather than through a copy of a + b
+inline Vector3D& operator +=(Vector3D& a, const Vector3D& b)
+{
+    return a = Vector3D(a.lanes() + b.lanes());
+}
+
+inline Vector3D& operator -=(Vector3D& a, const Vector3D& b)
+{
+    return a = Vector3D(a.lanes() - b.lanes());
+}
+
+inline Vector3D& operator *=(Vector3D& a, Scalar s)
+{
+    return a = Vector3D(Lanes3D::Broadcast3(s) * a.lanes());
+}
+
+inline Point3D& operator +=(Point3D& a, const Vector3D& b)
+{
+    return a = Point3D(a.lanes() + b.lanes());
+}
+
+inline Point3D& operator -=(Point3D& a, const Vector3D& b)
+{
+    return a = Point3D(a.lanes() - b.lanes());
 }
 
 // Cross product specific to 3D vectors
 inline Vector3D cross(const Vector3D& a, const Vector3D& b)
 {
-    return Vector3D(a[1] * b[2] - a[2] * b[1],
-                    a[2] * b[0] - a[0] * b[2],
-                    a[0] * b[1] - a[1] * b[0]);
+    return Vector3D(a.lanes().Cross(b.lanes()));
 }
 
 inline bool operator!=(const Vector3D& a, const Vector3D& b)
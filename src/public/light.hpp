@@ -8,6 +8,7 @@
 
 class SceneNode;
 class SceneContainer;
+struct HitInfo;
 
 // Represents a simple point light.
 struct Light {
@@ -19,10 +20,12 @@ struct Light {
     double falloff[3];
 
     // Check if the given point is visible from the provided light position
-    bool IsVisibleFrom(const SceneContainer* Scene, const Point3D& LightLoc, const Point3D& TestLoc, const double& Time);
+    // Footprint is the width of the viewing ray at TestLoc, which picks the detail of other meshes.
+    // The mesh of Source, the hit TestLoc was moved off, is traced at the hit's own level.
+    bool IsVisibleFrom(const SceneContainer* Scene, const Point3D& LightLoc, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source);
 
     // Get the intensity of the light that this is providing to the test location
-    virtual double GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time);
+    virtual double GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source);
 };
 
 // Area shpere light
@@ -37,7 +40,7 @@ struct SphereLight : public Light
     std::default_random_engine generator;
     std::uniform_real_distribution<double> Distribution;
 
-    virtual double GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time) override;
+    virtual double GetIntensity(const SceneContainer* Scene, const Point3D& TestLoc, const double& Time, double Footprint, const HitInfo& Source) override;
 };
 
 std::ostream& operator<<(std::ostream& out, const Light& l);
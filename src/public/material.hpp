@@ -3,6 +3,7 @@
 
 #include "algebra.hpp"
 #include "ray.h"
+#include "cpudispatch.h"
 #include <list>
 #include <memory>
 
@@ -78,6 +79,12 @@ public:
     Colour DoLighting(const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time);
 
 private:
+    // DoLighting's body, built once per CpuLevel by ShadeAt (see cpudispatch.h)
+    Colour Shade(const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time) const;
+
+    template<CpuLevel Level>
+    Colour ShadeAt(const SceneContainer* Scene, const Ray& R, const std::list<std::unique_ptr<Light>>* lights, const HitInfo& Hit, const Colour& ambient, const double& Time) const;
+
     Colour m_kd;
     Colour m_ks;
 
@@ -1,26 +1,191 @@
 #ifndef CS488_MESH_HPP
 #define CS488_MESH_HPP
 
+#include <cstdint>
 #include <vector>
 #include <iosfwd>
+#include <memory>
+#include <string>
 #include "primitive.hpp"
 #include "algebra.hpp"
+#include "cpudispatch.h"
+
+class MeshCache;
+
+// How a mesh stores its vertex positions
+enum class VertexFormat : uint8_t
+{
+    Double,         // 3 doubles
+    Float,          // 3 floats
+    Quantized16     // 3 uint16 relative to the mesh bounds
+};
+
+// Storage options for newly built meshes
+struct MeshStorage
+{
+    VertexFormat Format;
+    bool bWeld;     // Merge vertices that share a (stored) position
+    unsigned int LODLevels;     // Most detail levels to build, including the full mesh
+    bool bReport;   // Print each scene mesh's memory use as it is built
+
+    // Anything but full precision positions and 32-bit indices
+    bool IsCompact() const
+    {
+        return Format != VertexFormat::Double || bWeld;
+    }
+};
+
+// Storage used by every mesh built from here on (set from the command line)
+extern MeshStorage MeshStorageMode;
+
+// A node of a mesh's bounding volume hierarchy.
+// Interior nodes have Count == 0, their first child directly follows them
+// and Start is the index of their second child.
+// Leaves hold Count faces beginning at face Start.
+struct MeshBVHNode
+{
+    BoxF Bounds;
+    uint32_t Start;
+    uint32_t Count;
+};
+
+// Flat read-only views of the buffers a mesh is traced against.
+// They point into the mesh's own storage or into a mapped mesh cache.
+struct MeshBuffers
+{
+    const void* Positions;          // 3 per vertex, stored as PositionFormat
+    VertexFormat PositionFormat;
+    double QuantScale[3];           // Quantized16: P = QuantOffset + q * QuantScale
+    double QuantOffset[3];
+    uint32_t NumVerts;
+    const uint32_t* FaceStarts;     // NumFaces + 1 offsets into Indices, null if all faces are triangles
+    uint32_t NumFaces;
+    const void* Indices;
+    uint32_t IndexSize;             // 2 or 4 bytes
+    uint32_t NumIndices;
+    const MeshBVHNode* Nodes;
+    uint32_t NumNodes;
+    double FeatureSize;             // Largest distance a vertex moved when simplifying, 0 for the full mesh
+};
 
 // A polygonal mesh.
-class Mesh : public Primitive {
+class Mesh final : public Primitive
+{
 public:
-	typedef std::vector<int> Face;
+    typedef std::vector<int> Face;
+
+    // Faces of fewer than three vertices, or of vertices that don't exist, are dropped
+    Mesh(const std::vector<Point3D>& verts,
+         const std::vector<Face>& faces,
+         const MeshStorage& storage = MeshStorageMode);
+
+    // Trace against the buffers of a mapped mesh cache without copying them
+    explicit Mesh(std::shared_ptr<MeshCache> cache);
+
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+
+    // DepthTrace for up to MaxInterleavedRays independent rays at once (more asserts), taking
+    // turns so each ray's cache misses overlap the others' work (see TraceInterleaved).
+    // bHits[i] is whether Rays[i] hit, into *Hits[i].
+    void DepthTraceInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const;
+
+    // PrimID is the face within detail level Level
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
+
+    // Detail levels, level 0 is the full mesh and each further level is coarser
+    const MeshBuffers& GetBuffers(size_t level = 0) const
+    {
+        return m_levels[level];
+    }
+
+    size_t GetNumLevels() const
+    {
+        return m_levels.size();
+    }
 
-  Mesh(const std::vector<Point3D>& verts,
-       const std::vector< Face >& faces);
+    // Bytes used by the mesh buffers
+    size_t GetMemoryUsage() const;
+
+    // Bytes the source vertices and faces took as a vector of Point3D and a vector per face
+    uint64_t GetUncompactedMemoryUsage() const
+    {
+        return m_uncompactedBytes;
+    }
+
+    void PrintMemoryReport(std::ostream& out, const std::string& name) const;
+
+    Point3D GetVert(uint32_t index, size_t level = 0) const;
+    uint32_t GetIndex(uint32_t index, size_t level = 0) const;
 
-  virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
-  
 private:
-	std::vector<Point3D> m_verts;
-	std::vector<Face> m_faces;
+    // Buffers owned by one level
+    struct LevelStorage
+    {
+        std::vector<unsigned char> Positions;
+        std::vector<uint32_t> FaceStarts;
+        std::vector<unsigned char> Indices;
+        std::vector<MeshBVHNode> Nodes;
+    };
+
+    // A copy of every level's buffers in one NUMA node's memory
+    struct Replica
+    {
+        std::vector<LevelStorage> Storage;
+        std::vector<MeshBuffers> Levels;
+    };
+
+    // The coarsest level that still looks the same to R
+    size_t SelectLevel(const Ray& R) const;
+
+    // A level's buffers in the calling thread's NUMA node's copy if there is one
+    const MeshBuffers& GetLocalBuffers(size_t level) const;
+
+    // Copy the levels to every NUMA node when AffinityMode asks for it and the mesh is too
+    // large to stay cached
+    void Replicate();
+
+    // DepthTrace's body, built once per CpuLevel by DepthTraceAt (see cpudispatch.h)
+    bool TraceLevel(Ray& R, HitInfo& Hit) const;
+
+    template<CpuLevel Level>
+    bool DepthTraceAt(Ray& R, HitInfo& Hit) const;
+
+    template<typename VertexReader, typename IndexType>
+    bool TraceTree(const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices, Ray& R, HitInfo& Hit) const;
+
+    // The faces of a leaf against R, rayOrigin and rayDir being R's
+    template<typename VertexReader, typename IndexType>
+    bool TraceLeaf(const MeshBVHNode& Node, const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices,
+                   Ray& R, const Point3D& rayOrigin, const Vector3D& rayDir, HitInfo& Hit) const;
+
+    // DepthTraceInterleaved's body, built once per CpuLevel by DepthTraceInterleavedAt
+    void TraceLevelsInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const;
+
+    template<CpuLevel Level>
+    void DepthTraceInterleavedAt(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const;
+
+    template<typename VertexReader, typename IndexType>
+    bool TraceTreeInterleaved(const MeshBuffers& Buffers, const VertexReader& Verts, const IndexType* Indices,
+                              Ray* Rays[], HitInfo* Hits[], bool bHits[], size_t Count) const;
+
+    // Encode verts and faces into a new level
+    void BuildLevel(const std::vector<Point3D>& verts, const std::vector<Face>& faces, const MeshStorage& storage, double featureSize);
+
+    // Reorders the faces of a level and builds its BVH over them
+    void BuildTree(size_t level, std::vector<uint32_t>& faceStarts, std::vector<uint32_t>& indices);
+
+    // Owned storage, empty when the mesh is backed by a cache
+    std::vector<LevelStorage> m_storage;
+    uint64_t m_uncompactedBytes;
+
+    std::shared_ptr<MeshCache> m_cache;
+    std::vector<MeshBuffers> m_levels;
+    std::vector<Replica> m_replicas;    // One per NUMA node, or none
 
-	friend std::ostream& operator<<(std::ostream& out, const Mesh& mesh);
+    friend std::ostream& operator<<(std::ostream& out, const Mesh& mesh);
 };
 
 #endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "mesh.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Identifies the version of a source mesh file a cache was built from
+struct MeshSourceStamp
+{
+    uint64_t Size;
+    int64_t ModifiedTime;   // Nanoseconds since the epoch
+    uint64_t EndsHash;      // Of the first and last SourceEndBytes, for coarse file times
+};
+
+// Fill in the stamp of the file at path. Returns false if it can't be read.
+bool GetMeshSourceStamp(const std::string& path, MeshSourceStamp& stamp);
+
+// A binary mesh cache mapped read-only into memory.
+// Holds the vertex, index and BVH buffers of a mesh so later runs can trace
+// against them directly instead of parsing and rebuilding the mesh.
+class MeshCache
+{
+public:
+    ~MeshCache();
+
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    // Map the cache at path.
+    // @return null if it is missing, invalid, wasn't built from stamp's source
+    //         or doesn't use storage
+    static std::shared_ptr<MeshCache> Open(const std::string& path, const MeshSourceStamp& stamp, const MeshStorage& storage);
+
+    // Write the buffers of mesh, built with storage, to a cache at path
+    static bool Write(const std::string& path, const MeshSourceStamp& stamp, const Mesh& mesh, const MeshStorage& storage);
+
+    // Buffers of each detail level
+    const std::vector<MeshBuffers>& GetLevels() const
+    {
+        return m_levels;
+    }
+
+    const BoxF& GetBounds() const
+    {
+        return m_bounds;
+    }
+
+    uint64_t GetUncompactedMemoryUsage() const;
+
+private:
+    MeshCache(void* data, size_t size);
+
+    void* m_data;
+    size_t m_size;
+    std::vector<MeshBuffers> m_levels;
+    BoxF m_bounds;
+};
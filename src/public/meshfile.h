@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mesh.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read the vertices and faces of an OBJ file (.obj) or PLY file (.ply)
+// Only vertex positions and polygon faces are read.
+bool ReadMeshFile(const std::string& filename, std::vector<Point3D>& verts, std::vector<Mesh::Face>& faces);
+
+// Load the mesh in filename.
+// A binary cache (filename + ".rtmc") is written on the first load and mapped
+// directly on later loads for as long as the source file is unchanged.
+// @return null if the mesh couldn't be loaded
+std::shared_ptr<Mesh> LoadMeshFile(const std::string& filename);
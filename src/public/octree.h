@@ -2,6 +2,7 @@
 #include "AxisAlignedBox.h"
 #include "array.h"
 #include "ray.h"
+#include "raypacket.h"
 #include <iostream>
 
 class OcTreeObject
@@ -271,29 +272,79 @@ public:
         return;
     }
 
-    // Get the objects that might be hit by the ray
-    bool Trace(Array<OctObjectType*>& returnObjects, const Ray& r) const
+    // Call visit with the objects of each tree that might be hit by the ray, a whole
+    // tree's objects at once so they can be intersected together.
+    // visit may shorten the ray's tMax (r refers to the ray it traces), trees
+    // that start beyond it are then skipped.
+    // visit returns true to end the trace there, Trace then returns true as well.
+    template<typename Visitor>
+    bool Trace(const Ray& r, Visitor&& visit) const
     {
         if ((nodes.Num() > 0 || objects.Num() > 0) && CheckIntersection(r, Bounds))
         {
             // check every subnode
             for (OcTree* T : nodes)
             {
-                T->Trace(returnObjects, r);
+                if (T->Trace(r, visit))
+                {
+                    return true;
+                }
             }
 
-            // Add our objects
-            for (OctObjectType* O : objects)
+            // Visit our objects
+            if (objects.Num() > 0)
             {
-                returnObjects.Add(O);
+                return visit(objects);
             }
-
-            return true;
         }
 
         return false;
     }
 
+    // Trace for the rays of Active in Packet together. The trees are visited in the
+    // same order and each ray is tested against their bounds as Trace would test it.
+    // visit gets a tree's objects and the rays that reach them.
+    template<typename Visitor>
+    void TracePacket(RayPacket& Packet, uint32_t Active, Visitor&& visit) const
+    {
+        if (Active == 0 || (nodes.Num() == 0 && objects.Num() == 0))
+        {
+            return;
+        }
+
+        // Once the rays have split up, a lone ray is cheaper to trace by itself
+        if ((Active & (Active - 1)) == 0)
+        {
+            size_t i = 0;
+            while (!(Active & (uint32_t(1) << i)))
+            {
+                i++;
+            }
+            Trace(Packet[i], [&](const Array<OctObjectType*>& Objects)
+            {
+                visit(Objects, Active);
+                return false;
+            });
+            return;
+        }
+
+        Active = Packet.CheckIntersection(Bounds, Active);
+        if (Active == 0)
+        {
+            return;
+        }
+
+        for (OcTree* T : nodes)
+        {
+            T->TracePacket(Packet, Active, visit);
+        }
+
+        if (objects.Num() > 0)
+        {
+            visit(objects, Active);
+        }
+    }
+
     template<typename T>
     friend std::ostream& operator <<(std::ostream& os, const OcTree<T>& B);
 };
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "cpudispatch.h"
+#include "mesh.hpp"
+#include "primitive.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A set of spheres traced as one primitive, for simulation output with millions of particles.
+// Centres, radii and velocities are stored as structures of float arrays, ordered by the
+// leaves of the set's own BVH (laid out like a mesh's). That is 16 bytes a particle, 28 with
+// velocities, and about 14 more for the tree.
+class Particles final : public Primitive
+{
+public:
+    // Centres and radii packed as x, y, z, r for each particle.
+    // Velocities, packed as x, y, z for each particle in units per second, are optional and
+    // move the particles during the render for motion blur.
+    explicit Particles(const std::vector<float>& Packed, const std::vector<float>& Velocities = std::vector<float>());
+
+    Particles(const Particles&) = delete;
+    Particles& operator=(const Particles&) = delete;
+
+    // Traces the particles where they start
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual bool TimeTrace(Ray& R, HitInfo& Hit, const double& Time) override;
+
+    // TimeTrace of up to MaxInterleavedRays rays (more asserts), interleaved through the BVH when the set
+    // is too large to stay cached (see TraceInterleaved). bHits[i] is whether Rays[i] hit.
+    void TimeTraceInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const;
+
+    // PrimID is the particle, moved to where it was at the hit's Time
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
+
+    // Bounds each node over the sweep of its particles
+    virtual void CacheMotion(double TimeDuration) override;
+
+    size_t GetNumParticles() const
+    {
+        return m_radius.size();
+    }
+
+    bool IsMoving() const
+    {
+        return !m_velocity[0].empty();
+    }
+
+    // Bytes used by the particles and their BVH
+    size_t GetMemoryUsage() const;
+
+private:
+    // TimeTrace's body, built once per CpuLevel by TimeTraceAt (see cpudispatch.h)
+    template<bool bMoving>
+    bool TraceTree(Ray& R, HitInfo& Hit, Scalar Time) const;
+
+    template<CpuLevel Level>
+    bool TimeTraceAt(Ray& R, HitInfo& Hit, Scalar Time) const;
+
+    // The particles of a leaf against R, O and D being R's origin and direction
+    template<bool bMoving>
+    bool TraceLeaf(const MeshBVHNode& Node, Ray& R, const Point3D& O, const Vector3D& D, HitInfo& Hit, Scalar Time) const;
+
+    template<bool bMoving>
+    void TraceTreeInterleaved(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const;
+
+    template<CpuLevel Level>
+    void TimeTraceInterleavedAt(Ray Rays[], HitInfo* Hits[], bool bHits[], size_t Count, Scalar Time) const;
+
+    // Bound every node over its particles from Time 0 to m_duration, children first
+    void Refit();
+
+    std::vector<float> m_center[3];
+    std::vector<float> m_radius;
+    std::vector<float> m_velocity[3];   // Empty if the particles don't move
+    std::vector<MeshBVHNode> m_nodes;   // Leaves hold Count particles from Start
+    double m_duration;                  // Of the render the nodes are bound for
+};
+
+// Load the particles in filename, written as
+//   char[4] "RTPS", uint32 version (1), uint64 count, uint32 flags (bit 0: velocities), uint32 0
+//   count x, y, z, r float32 records, then count x, y, z float32 velocities if flagged
+// in little endian.
+// @return null if the file couldn't be read or isn't a particle file
+std::shared_ptr<Particles> LoadParticleFile(const std::string& filename);
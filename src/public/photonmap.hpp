@@ -25,7 +25,8 @@ private:
     std::uniform_real_distribution<double> PhotonDistribution;
 
 	// Only does caustics, global illumination uses russian roulette
-    void TracePhoton(const Ray& R, const Colour& Power, unsigned int depth, bool bHasRef = false);
+	// Stored photons are added to Out
+    void TracePhoton(const Ray& R, const Colour& Power, unsigned int depth, photon_stg_type& Out, bool bHasRef = false) const;
 
 public:
 	PhotonMap(SceneContainer* Scene, size_type NumToEmit);
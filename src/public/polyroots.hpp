@@ -14,9 +14,21 @@
 #define CS488_POLYROOTS_HPP
 
 size_t quadraticRoots(double A, double B, double C, double roots[2]);
+
+/* Most quadratics the batched quadraticRoots solves per call */
+#define QUADRATIC_BATCH 8
+void quadraticRoots(size_t Count, const double A[], const double B[], const double C[],
+                    double Roots0[], double Roots1[], size_t NumRoots[]);
+void quadraticRoots(size_t Count, const float A[], const float B[], const float C[],
+                    float Roots0[], float Roots1[], size_t NumRoots[]);
 size_t cubicRoots(double A, double B, double C, double roots[3]);
 size_t quarticRoots(double A, double B, double C, double D, double roots[4]);
 
+/* Most quartics the batched quarticRoots solves per call */
+#define QUARTIC_BATCH 8
+void quarticRoots(size_t Count, const double A[], const double B[], const double C[], const double D[],
+                  double Roots0[], double Roots1[], double Roots2[], double Roots3[]);
+
 #endif /* CS488_POLYROOTS_HPP */
 
 /*
@@ -8,6 +8,22 @@ class Primitive
 {
 protected:
     BoxF Bounds;
+
+    // Shorten R to a hit t along it if that is inside R's range and remember the hit
+    bool RecordHit(Ray& R, double t, uint32_t PrimID, HitInfo& Hit) const
+    {
+        if (R.InRange(t))
+        {
+            R.SetTMax(t);
+            Hit.T = t;
+            Hit.RayOrigin = R.GetOrigin();
+            Hit.RayDirection = R.GetDirection();
+            Hit.PrimID = PrimID;
+            return true;
+        }
+        return false;
+    }
+
 public:
     virtual ~Primitive();
     virtual bool SimpleTrace(Ray R)
@@ -15,22 +31,43 @@ public:
         return CheckIntersection(R, Bounds);
     }
 
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M)
+    // Find the closest hit of the object space ray R inside its t range.
+    // A hit shortens R's tMax and is recorded in Hit.
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit)
     {
         (void)R;
-        (void)closestDist;
-        (void)M;
         (void)Hit;
         return false;
     }
 
+    // DepthTrace at Time into the render, for primitives whose parts move on their own.
+    // The node's own motion is already taken out of R.
+    virtual bool TimeTrace(Ray& R, HitInfo& Hit, const double& Time)
+    {
+        (void)Time;
+        return DepthTrace(R, Hit);
+    }
+
+    // Prepare for a render whose time samples span [0, TimeDuration]
+    virtual void CacheMotion(double TimeDuration)
+    {
+        (void)TimeDuration;
+    }
+
+    // Object space location and normal of a hit this primitive recorded
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const
+    {
+        Location = Hit.ObjectLocation();
+        Normal = Vector3D::ZeroVector;
+    }
+
     inline BoxF GetBox() const
     {
         return Bounds;
     }
 };
 
-class Sphere : public Primitive
+class Sphere final : public Primitive
 {
 public:
     Sphere() :
@@ -50,13 +87,25 @@ public:
     virtual ~Sphere();
 
     virtual bool SimpleTrace(Ray R);
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
+
+    const Point3D& GetCenter() const
+    {
+        return m_center;
+    }
+
+    double GetRadius() const
+    {
+        return m_radius;
+    }
+
 private:
     Point3D m_center;
     double m_radius;
 };
 
-class Cube : public Primitive
+class Cube final : public Primitive
 {
 public:
     Cube() :
@@ -66,14 +115,30 @@ public:
         Bounds = BoxF(1.0, 0.0, 1.0, 0.0, 1.0, 0.0);
     }
 
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
 
 private:
     Point3D m_pos;
     double m_size;
 };
 
-class Cylinder : public Primitive
+// The part of a cylinder or cone a hit is on, kept in HitInfo::PrimID
+enum CylinderPart : uint32_t
+{
+    CylinderSide,
+    CylinderTop,
+    CylinderBottom,
+    CylinderTangent     // Grazing the side, no normal
+};
+
+enum ConePart : uint32_t
+{
+    ConeSide,
+    ConeCap
+};
+
+class Cylinder final : public Primitive
 {
 public:
     Cylinder()
@@ -82,10 +147,11 @@ public:
     }
 
     virtual ~Cylinder();
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
 };
 
-class Cone : public Primitive
+class Cone final : public Primitive
 {
 public:
     Cone()
@@ -94,50 +160,88 @@ public:
     }
 
     virtual ~Cone();
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
 };
 
-class NonhierSphere : public Primitive
+// A ring of major radius 1 around the z axis, its tube's radius is the minor radius
+class Torus final : public Primitive
+{
+public:
+    explicit Torus(double MinorRadius) :
+        m_minorRadius(MinorRadius)
+    {
+        const double Outer = 1 + m_minorRadius;
+        Bounds = BoxF(Outer, -Outer, Outer, -Outer, m_minorRadius, -m_minorRadius);
+    }
+
+    virtual ~Torus();
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
+
+    double GetMinorRadius() const
+    {
+        return m_minorRadius;
+    }
+
+    // Monic quartic x^4 + A x^3 + B x^2 + C x + D for the ray O + tD against a torus of
+    // MinorRadius. D need not be unit length, a root x is at t = Shift + x * Scale.
+    // The quartic is solved from where the ray enters the torus' bounding sphere so its
+    // coefficients stay near unit size. Returns false if the ray misses that sphere.
+    static bool GetQuartic(Scalar OX, Scalar OY, Scalar OZ, Scalar DX, Scalar DY, Scalar DZ, double MinorRadius,
+                           double& Shift, double& Scale, double& A, double& B, double& C, double& D);
+
+private:
+    double m_minorRadius;
+};
+
+class NonhierSphere final : public Primitive
 {
 public:
     NonhierSphere(const Point3D& pos, double radius) :
         m_pos(0, 0, 0),
         m_radius(1)
     {
-        m_trans.translate(Vector3D(pos[0], pos[1], pos[2]));
-        m_trans.scale(Vector3D(radius, radius, radius));
+        Matrix4x4 Trans;
+        Trans.translate(Vector3D(pos[0], pos[1], pos[2]));
+        Trans.scale(Vector3D(radius, radius, radius));
+        m_trans = AffineTransform(Trans);
         m_invtrans = m_trans.invert();
+        m_normalMatrix = m_trans.normalMatrix();
         Bounds = BoxF(m_pos[0] + m_radius, m_pos[0] - m_radius, m_pos[1] + m_radius, m_pos[1] - m_radius, m_pos[2] + m_radius, m_pos[2] - m_radius);
-        Bounds.Transform(m_trans);
+        Bounds.Transform(Trans);
     }
     virtual ~NonhierSphere();
 
     virtual bool SimpleTrace(Ray R);
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, const Matrix4x4& M);
+    virtual bool DepthTrace(Ray& R, HitInfo& Hit);
+    virtual void GetSurface(const HitInfo& Hit, Point3D& Location, Vector3D& Normal) const override;
 
-private:
-    Point3D m_pos;
-    double m_radius;
-    Matrix4x4 m_trans;
-    Matrix4x4 m_invtrans;
-};
+    // Hits are recorded against the sphere at GetCenter with GetRadius in this space
+    const AffineTransform& GetToUnit() const
+    {
+        return m_invtrans;
+    }
 
-inline bool clampDist(double& closestDist, const Point3D& WorldRay, const Point3D& WorldHit, const Vector3D& Normal, HitInfo& Hit, const Matrix4x4& M)
-{
-    const double Dist = (WorldHit - WorldRay).length2();
-    if (closestDist > Dist && Dist > EPSILON2)
+    const Point3D& GetCenter() const
     {
-        closestDist = Dist;
-        Hit.Location = WorldHit;
-        Hit.Normal = transNorm(M.invert(), Normal);
-        return true;
+        return m_pos;
     }
-    return false;
-}
 
-bool CheckCloseHit(const Point3D& WorldRay, const Point3D& WorldHit);
+    double GetRadius() const
+    {
+        return m_radius;
+    }
+
+private:
+    Point3D m_pos;
+    double m_radius;
+    AffineTransform m_trans;
+    AffineTransform m_invtrans;
+    AffineTransform m_normalMatrix;
+};
 
-inline double SolveForD(const Point3D& P, const Vector3D& N)
+inline Scalar SolveForD(const Point3D& P, const Vector3D& N)
 {
     return (-P[0] * N[0]) - (P[1] * N[1]) - (P[2] * N[2]);
 }
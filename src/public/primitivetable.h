@@ -0,0 +1,186 @@
+#pragma once
+
+#include "array.h"
+#include "cpudispatch.h"
+#include "mesh.hpp"
+#include "octree.h"
+#include "particles.h"
+#include "primitive.hpp"
+#include "tracequery.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class SceneNode;
+class GeometryNode;
+
+// The batch of a PrimitiveTable an entry is in
+enum class PrimitiveType : uint8_t
+{
+    Sphere,     // Including NonhierSphere
+    Cube,
+    Cylinder,
+    Cone,
+    Torus,
+    Mesh,
+    Particles,
+    Other       // Anything else, traced through its virtual DepthTrace
+};
+
+// One entry of a PrimitiveTable, as the octree sees it
+struct PrimitiveRef : public OcTreeObject
+{
+    PrimitiveType Type;
+    uint32_t Index;     // Into the batch for Type
+    BoxF Bounds;
+
+    virtual BoxF GetBox() override
+    {
+        return Bounds;
+    }
+};
+
+// A flattened scene with its geometry sorted into one contiguous batch per primitive type.
+// Tracing a batch calls that type's intersection directly, so there are no virtual calls
+// per candidate and the kernels can be inlined. Spheres, cylinders and cones are stored
+// as structures of arrays and intersected QUADRATIC_BATCH at a time, tori likewise
+// QUARTIC_BATCH at a time.
+class PrimitiveTable
+{
+public:
+    // Nodes must be flattened and outlive the table
+    explicit PrimitiveTable(const std::vector<std::unique_ptr<SceneNode>>& Nodes);
+
+    PrimitiveTable(const PrimitiveTable&) = delete;
+    PrimitiveTable& operator=(const PrimitiveTable&) = delete;
+
+    // Hit of the world ray R against every entry at Time that Query looks for (see tracequery.h).
+    // R's tMax is shortened to any hit that is found.
+    template<typename Query>
+    bool Trace(Ray& R, HitInfo& Hit, const double& Time) const;
+
+    // Closest hit of the world ray R against one entry at Time
+    bool Trace(const PrimitiveRef& Ref, Ray& R, HitInfo& Hit, const double& Time) const;
+
+    // The same against some entries, such as an octree node's
+    template<typename Query>
+    bool Trace(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const;
+
+    // The closest hits for each ray of Active in Packet, bHits[i] is set if Packet[i] hits.
+    // Meshes and particles are traced for the rays together, interleaved so that their
+    // trees' cache misses overlap (see TraceInterleaved), and the rest a ray at a time.
+    void Trace(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, HitInfo Hits[], bool bHits[], const double& Time) const;
+
+    // An entry per node, for acceleration structures
+    std::vector<PrimitiveRef>& GetRefs()
+    {
+        return m_refs;
+    }
+
+private:
+    // A primitive placed in the world by its node
+    template<typename PrimType>
+    struct Instance
+    {
+        AffineTransform ToLocal;
+        Vector3D Velocity;      // In the primitive's space
+        bool bMoving;
+        PrimType* Prim;
+        const GeometryNode* Node;
+    };
+
+    template<typename PrimType>
+    using Batch = std::vector<Instance<PrimType>>;
+
+    enum class QuadricShape
+    {
+        Sphere,
+        Cylinder,
+        Cone
+    };
+
+    // Instances of one quadric shape or of tori, one array per parameter
+    struct QuadricBatch
+    {
+        std::vector<Scalar> ToLocal[12];    // World to primitive transform, row major
+        std::vector<Scalar> Velocity[3];    // In the primitive's space
+        std::vector<Scalar> Center[3];      // Spheres only
+        std::vector<Scalar> Radius2;        // The minor radius' square for tori
+        std::vector<const GeometryNode*> Nodes;
+    };
+
+    template<typename PrimType>
+    void Add(Batch<PrimType>& Batch, PrimitiveType Type, PrimType* Prim, GeometryNode& Node);
+
+    void Add(QuadricBatch& Batch, PrimitiveType Type, const AffineTransform& ToLocal, const Vector3D& Velocity,
+             const Point3D& Center, Scalar Radius, GeometryNode& Node);
+
+    // The tracing kernels are built once per CpuLevel, the public Trace overloads
+    // run the build for the CPU (see cpudispatch.h)
+    // and per kind of query
+    template<CpuLevel Level, typename Query>
+    bool TraceAt(Ray& R, HitInfo& Hit, const double& Time) const;
+
+    template<CpuLevel Level, typename Query>
+    bool TraceAt(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const;
+
+    template<CpuLevel Level>
+    void TraceAt(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, HitInfo Hits[], bool bHits[], const double& Time) const;
+
+    template<CpuLevel Level, typename Query>
+    bool TraceAll(Ray& R, HitInfo& Hit, const double& Time) const;
+
+    template<CpuLevel Level>
+    void TracePacketRefs(const Array<PrimitiveRef*>& Refs, RayPacket& Packet, uint32_t Active, HitInfo Hits[], bool bHits[],
+                         const double& Time) const;
+
+    // bSkipInterleaved leaves out the meshes and particles
+    template<CpuLevel Level, typename Query, bool bSkipInterleaved = false>
+    bool TraceRefs(const Array<PrimitiveRef*>& Refs, Ray& R, HitInfo& Hit, const double& Time) const;
+
+    template<CpuLevel Level>
+    bool TraceRef(const PrimitiveRef& Ref, Ray& R, HitInfo& Hit, const double& Time) const;
+
+    template<typename PrimType>
+    static bool TraceInstance(const Instance<PrimType>& I, Ray& R, HitInfo& Hit, const double& Time);
+
+    // TraceInstance for each ray of Active in Packet, interleaved
+    template<typename PrimType>
+    static void TraceInstanceInterleaved(const Instance<PrimType>& I, RayPacket& Packet, uint32_t Active, HitInfo Hits[], bool bHits[],
+                                         const double& Time);
+
+    template<typename Query, typename PrimType>
+    static bool TraceBatch(const Batch<PrimType>& Batch, Ray& R, HitInfo& Hit, const double& Time);
+
+    // Trace Count instances of Batch, Indices[i] or First + i if there are no Indices
+    template<QuadricShape Shape>
+    static bool TraceQuadrics(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                              Ray& R, HitInfo& Hit, const double& Time);
+
+    template<QuadricShape Shape, CpuLevel Level>
+    static bool TraceQuadricsAt(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                                Ray& R, HitInfo& Hit, const double& Time);
+
+    // The same for tori
+    static bool TraceTori(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                          Ray& R, HitInfo& Hit, const double& Time);
+
+    template<CpuLevel Level>
+    static bool TraceToriAt(const QuadricBatch& Batch, const uint32_t* Indices, size_t First, size_t Count,
+                            Ray& R, HitInfo& Hit, const double& Time);
+
+    // Instance i's ray in its primitive's space at LocalTime, not normalized so its t is R's
+    static void LocalRay(const QuadricBatch& Batch, size_t i, const Point3D& Origin, const Vector3D& Direction,
+                         Scalar LocalTime, Scalar& OX, Scalar& OY, Scalar& OZ, Scalar& DX, Scalar& DY, Scalar& DZ);
+
+    QuadricBatch m_spheres;
+    Batch<Cube> m_cubes;
+    QuadricBatch m_cylinders;
+    QuadricBatch m_cones;
+    QuadricBatch m_tori;
+    Batch<Mesh> m_meshes;
+    Batch<Particles> m_particles;
+    Batch<Primitive> m_others;
+
+    std::vector<PrimitiveRef> m_refs;
+};
@@ -1,15 +1,64 @@
 #pragma once
 
 #include "algebra.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
 
 class Material;
+class GeometryNode;
+class Primitive;
+
+// How much wider a secondary ray's cone is than its parent's
+constexpr Scalar SecondarySpreadGrowth = 2.0;
+
+// How far spawned rays start off their surface, relative to the hit point's largest coordinate
+#ifdef RT_SINGLE_PRECISION
+constexpr Scalar RayOffsetScale = 1e-4f;
+#else
+constexpr Scalar RayOffsetScale = 1e-7;
+#endif
+
+// Move a hit point off its surface to the side of the unit normal N that Dir leaves through.
+// The offset grows with the point's coordinates so it stays larger than their rounding error,
+// rays started there can't hit the surface again and need no tMin.
+inline Point3D OffsetRayOrigin(const Point3D& P, const Vector3D& N, const Vector3D& Dir)
+{
+    const Scalar Size = std::max({Scalar(1), std::fabs(P[0]), std::fabs(P[1]), std::fabs(P[2])});
+    const Scalar Offset = N.dot(Dir) < 0 ? -RayOffsetScale * Size : RayOffsetScale * Size;
+    return P + Offset * N;
+}
 
+// Traversal only records which node was hit and where along its object space ray.
+// The surface is filled in once for the closest hit by GeometryNode::FinalizeHit.
 struct HitInfo
 {
     HitInfo() :
+        T(0.0),
+        PrimID(0),
+        Level(0),
+        Time(0.0),
+        Node(nullptr),
         Mat(nullptr)
     {}
 
+    // Hit point along the object space ray
+    Point3D ObjectLocation() const
+    {
+        return RayOrigin + T * RayDirection;
+    }
+
+    // Recorded during traversal
+    Scalar T;
+    Point3D RayOrigin;          // Object space ray
+    Vector3D RayDirection;
+    uint32_t PrimID;            // Part of the primitive that was hit, its meaning is up to the primitive
+    uint32_t Level;             // Mesh detail level
+    Scalar Time;                // Of the trace, kept by primitives whose parts move on their own
+    const GeometryNode* Node;
+
+    // Filled in by FinalizeHit
     Point3D Location;
     Vector3D Normal;
     Material* Mat;
@@ -18,42 +67,152 @@ struct HitInfo
 class Ray
 {
 public:
-    Ray()
+    Ray() :
+        m_tMin(0.0),
+        m_tMax(std::numeric_limits<Scalar>::infinity()),
+        m_tScale(1.0),
+        m_tInvScale(1.0),
+        m_footprint(0.0),
+        m_spread(0.0),
+        m_pinnedPrim(nullptr),
+        m_pinnedLevel(0)
     {}
 
     Ray(const Point3D& origin, const Vector3D& direction) :
         m_origin(origin),
-        m_direction(direction)
+        m_direction(direction),
+        m_tMin(0.0),
+        m_tMax(std::numeric_limits<Scalar>::infinity()),
+        m_tScale(1.0),
+        m_tInvScale(1.0),
+        m_footprint(0.0),
+        m_spread(0.0),
+        m_pinnedPrim(nullptr),
+        m_pinnedLevel(0)
     {
         m_AABBDivisors = Vector3D(1.0 / direction[0], 1.0 / direction[1], 1.0 / direction[2]);
     }
 
     void Normalize()
     {
-        m_direction.normalize();
+        const Scalar invlen = m_direction.normalize();
+        if (invlen > 0.0)
+        {
+            // Keep t measuring the same points along the ray
+            m_tScale *= invlen;
+            m_tInvScale /= invlen;
+        }
         m_AABBDivisors = Vector3D(1.0 / m_direction[0], 1.0 / m_direction[1], 1.0 / m_direction[2]);
     }
 
-    void Transform(const Matrix4x4& M)
+    // M is a Matrix4x4 or an AffineTransform
+    template<typename TransformType>
+    void Transform(const TransformType& M)
     {
-        SetDirection(M * m_direction);
+        const Vector3D Direction = M * m_direction;
+        if (m_footprint > 0.0)
+        {
+            // The footprint is a length so it scales with the new space
+            m_footprint *= Direction.length() / m_direction.length();
+        }
+        SetDirection(Direction);
         m_origin = M * m_origin;
     }
 
-    Ray Reflect(const HitInfo& Hit, const double cosi) const
+    Ray Reflect(const HitInfo& Hit, const Scalar cosi) const
     {
-        Ray ReflectedRay(Hit.Location, m_direction + ((2 * cosi)*Hit.Normal));
+        const Vector3D Direction = m_direction + ((2 * cosi) * Hit.Normal);
+        Ray ReflectedRay(OffsetRayOrigin(Hit.Location, Hit.Normal, Direction), Direction);
         ReflectedRay.Normalize();
+        ReflectedRay.InheritFootprint(*this, Hit.Location);
         return ReflectedRay;
     }
 
-    Ray Refract(const double ni, const double nt, const double cosi, const double sin2t, const HitInfo& Hit) const
+    Ray Refract(const Scalar ni, const Scalar nt, const Scalar cosi, const Scalar sin2t, const HitInfo& Hit) const
     {
-        Ray RefractedRay(Hit.Location, (ni / nt) * m_direction + (ni / nt * cosi - sqrt(1 - sin2t)) * Hit.Normal);
+        const Vector3D Direction = (ni / nt) * m_direction + (ni / nt * cosi - sqrt(1 - sin2t)) * Hit.Normal;
+        Ray RefractedRay(OffsetRayOrigin(Hit.Location, Hit.Normal, Direction), Direction);
         RefractedRay.Normalize();
+        RefractedRay.InheritFootprint(*this, Hit.Location);
         return RefractedRay;
     }
 
+    // Hits only count strictly between tMin and tMax.
+    // t is measured in units of the current direction, transforming the ray keeps the
+    // points it names. World rays have unit directions so there t is a distance.
+    Scalar GetTMin() const
+    {
+        return m_tMin * m_tInvScale;
+    }
+
+    Scalar GetTMax() const
+    {
+        return m_tMax * m_tInvScale;
+    }
+
+    void SetTMax(Scalar t)
+    {
+        m_tMax = t * m_tScale;
+    }
+
+    bool InRange(Scalar t) const
+    {
+        return t > GetTMin() && t < GetTMax();
+    }
+
+    // Take the tMax of a transformed copy of this ray
+    void CopyTMax(const Ray& Transformed)
+    {
+        m_tMax = Transformed.m_tMax;
+    }
+
+    // The ray covers a cone footprint wide at its origin that widens by spread per unit distance.
+    // Rays without one (shadow and photon rays) always see full detail.
+    void SetFootprint(Scalar footprint, Scalar spread)
+    {
+        m_footprint = footprint;
+        m_spread = spread;
+    }
+
+    // Continue the cone of Parent from Location, widened for the extra bounce
+    void InheritFootprint(const Ray& Parent, const Point3D& Location)
+    {
+        if (Parent.HasFootprint())
+        {
+            m_footprint = Parent.GetFootprint((Location - Parent.m_origin).length());
+            m_spread = Parent.m_spread * SecondarySpreadGrowth;
+        }
+    }
+
+    // Trace Prim at detail level Level whatever the footprint. Shadow rays pin the level of the
+    // hit they leave, as a coarser copy of the same surface could stand above the hit point.
+    void PinLevel(const Primitive* Prim, uint32_t Level)
+    {
+        m_pinnedPrim = Prim;
+        m_pinnedLevel = Level;
+    }
+
+    const Primitive* GetPinnedPrimitive() const
+    {
+        return m_pinnedPrim;
+    }
+
+    uint32_t GetPinnedLevel() const
+    {
+        return m_pinnedLevel;
+    }
+
+    bool HasFootprint() const
+    {
+        return m_footprint > 0.0 || m_spread > 0.0;
+    }
+
+    // Width of the ray's cone dist along it
+    Scalar GetFootprint(Scalar dist) const
+    {
+        return m_footprint + m_spread * dist;
+    }
+
     void SetOrigin(const Point3D& newOrig)
     {
         m_origin = newOrig;
@@ -84,4 +243,12 @@ private:
     Point3D m_origin;
     Vector3D m_direction;
     Vector3D m_AABBDivisors;  // AABB optimization
+    Scalar m_tMin;          // In units of the direction the ray was created with
+    Scalar m_tMax;
+    Scalar m_tScale;        // Creation units per unit of the current direction
+    Scalar m_tInvScale;
+    Scalar m_footprint;
+    Scalar m_spread;
+    const Primitive* m_pinnedPrim;
+    uint32_t m_pinnedLevel;
 };
\ No newline at end of file
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "AxisAlignedBox.h"
+#include "cpudispatch.h"
+#include "ray.h"
+#include <cstddef>
+#include <cstdint>
+
+// Most rays a RayPacket holds, packets name their rays with a bit each
+constexpr size_t MaxPacketRays = 16;
+
+// Coherent rays, such as the sub-samples of a pixel, traced together through the octree.
+// A node's bounds are fetched once and tested against every ray of the packet at once,
+// from copies of the rays' origins and slopes kept as structures of arrays.
+class RayPacket
+{
+public:
+    RayPacket();
+
+    // At most MaxPacketRays rays, adding more asserts (and drops them without asserts)
+    void Add(const Ray& R);
+
+    size_t Num() const
+    {
+        return m_count;
+    }
+
+    // The mask of every ray in the packet
+    uint32_t AllRays() const
+    {
+        return (uint32_t(1) << m_count) - 1;
+    }
+
+    // Tracing a ray shortens its tMax, later box tests see that
+    Ray& operator[](size_t i)
+    {
+        return m_rays[i];
+    }
+
+    const Ray& operator[](size_t i) const
+    {
+        return m_rays[i];
+    }
+
+    // The rays of Active that CheckIntersection(ray, Box) passes
+    uint32_t CheckIntersection(const BoxF& Box, uint32_t Active) const;
+
+private:
+    // Built once per CpuLevel (see cpudispatch.h)
+    uint32_t TestBox(const BoxF& Box, uint32_t Active) const;
+
+    template<CpuLevel Level>
+    uint32_t CheckIntersectionAt(const BoxF& Box, uint32_t Active) const;
+
+    size_t m_count;
+    Ray m_rays[MaxPacketRays];
+
+    // Of every slot, unused ones hold zeros and are masked out
+    Scalar m_origin[3][MaxPacketRays];
+    Scalar m_aabbDiv[3][MaxPacketRays];
+};
@@ -11,10 +11,17 @@
 #include "RenderData.h"
 #include <random>
 #include <memory>
+#include <vector>
+#include <cstdint>
 
 typedef Array<SceneNode*> NodeList;
 extern size_t numThreads, SuperSamples;
+// Primary rays of neighbouring pixels and sub-samples traced together as a packet, 1 traces
+// them one at a time
+extern size_t PacketSize;
 extern bool bUseOctree, bUseAdaptive;
+// Trace blocks of pixels a bounce at a time instead of a ray at a time
+extern bool bUseWavefront;
 
 class SceneContainer;
 
@@ -44,6 +51,9 @@ void render(// What to render
 
 class Image;
 
+// Traces one ray through the centre of each pixel. Samplers (this and the classes below) are
+// only run as a TypedRenderThread, whose pixel loop is built for the scene's camera and
+// container types.
 class RenderThread : public Thread
 {
 public:
@@ -53,9 +63,16 @@ public:
         RefrDistribution(0.f, 1.f)
     {}
 
-    virtual void Main() override;
+    template<typename CameraType, typename ContainerType>
+    Colour TracePixelAntiAliased(int x, int y, const double& Time);
 
-    virtual Colour TracePixelAntiAliased(int x, int y, const double& Time);
+    // Whether each pixel is a fixed grid of GetSubSamples() squared rays, whose primary rays
+    // can then be traced in packets across neighbouring pixels
+    static constexpr bool bGridSamples = true;
+    int GetSubSamples() const
+    {
+        return 1;
+    }
 
 protected:
     RenderData m_renderData;
@@ -63,7 +80,44 @@ protected:
     std::default_random_engine generator;
     std::uniform_real_distribution<double> RefrDistribution;
 
+    // The render's camera and scene as the types the thread is built for
+    template<typename CameraType>
+    const CameraType& GetCamera() const
+    {
+        return static_cast<const CameraType&>(*m_renderData.m_normCam);
+    }
+
+    template<typename ContainerType>
+    const ContainerType& GetScene() const
+    {
+        return static_cast<const ContainerType&>(*m_renderData.m_scene);
+    }
+
+    // Render the pixels of the queue with Sampler::TracePixelAntiAliased, or with
+    // RenderPixelRuns when packets are on and Sampler has bGridSamples
+    template<typename Sampler, typename CameraType, typename ContainerType>
+    void RenderPixels();
+
+    // Render runs of neighbouring pixels from the queue, tracing the primary rays of a whole
+    // run together so packets span pixels, each of SubSamples squared rays
+    template<typename CameraType, typename ContainerType>
+    void RenderPixelRuns(int SubSamples);
+
+    template<typename ContainerType>
     Colour TraceRay(Ray& R, double powerCoef, unsigned int depth, const double& Time);
+
+    // The rest of TraceRay once R has hit, TraceColour is the light at the hit
+    template<typename ContainerType>
+    Colour ShadeHit(const Ray& R, HitInfo& Hit, const Colour& TraceColour, double powerCoef, unsigned int depth, const double& Time);
+
+    // ShadeHit's reflected and refracted rays are handed to Trace(Ray, powerCoef, depth, Weight),
+    // whose colour is added in Weight times. Returns the hit's colour with theirs.
+    template<typename TraceFn>
+    Colour ScatterHit(const Ray& R, HitInfo& Hit, const Colour& TraceColour, double powerCoef, unsigned int depth, TraceFn&& Trace);
+
+    // TraceRay for each of Count primary rays, PacketSize at a time
+    template<typename ContainerType>
+    void TracePrimaryRays(const Ray Rays[], size_t Count, Colour Out[], const double& Time);
 };
 
 class SuperSampleThread : public RenderThread
@@ -75,7 +129,13 @@ public:
         SuperSamples(SuperSamples)
     {}
 
-    virtual Colour TracePixelAntiAliased(int x, int y, const double& Time) override;
+    template<typename CameraType, typename ContainerType>
+    Colour TracePixelAntiAliased(int x, int y, const double& Time);
+
+    int GetSubSamples() const
+    {
+        return SuperSamples;
+    }
 };
 
 class AdaptiveSampleThread : public RenderThread
@@ -85,8 +145,71 @@ public:
         RenderThread(renderData)
     {}
 
-    virtual Colour TracePixelAntiAliased(int x, int y, const double& Time) override;
+    template<typename CameraType, typename ContainerType>
+    Colour TracePixelAntiAliased(int x, int y, const double& Time);
+
+    // Picks its samples as it goes
+    static constexpr bool bGridSamples = false;
+
+    template<typename CameraType, typename ContainerType>
     Colour AdaptiveSuperSample(const int x, const int y, const double xNormMin, const double xNormMax, const double yNormMin, const double yNormMax, const unsigned int depth, const double& Time);
 };
 
+// Renders blocks of pixels as streams of rays, one bounce at a time. The rays of a bounce are
+// sorted by direction and origin before they are traced and their hits by material before
+// they are shaded, so the deep reflection and refraction paths are traced together.
+class WavefrontThread : public RenderThread
+{
+    int SuperSamples;
+public:
+    WavefrontThread(RenderData renderData, int SuperSamples) :
+        RenderThread(renderData),
+        SuperSamples(SuperSamples)
+    {}
+
+protected:
+    // Replaces RenderThread's pixel loop with the block by block one
+    template<typename Sampler, typename CameraType, typename ContainerType>
+    void RenderPixels();
+
+private:
+    struct QueuedRay
+    {
+        Ray R;
+        double PowerCoef;
+        double Weight;          // Of its colour in its sample's
+        double Time;
+        unsigned int Depth;
+        uint32_t Sample;
+    };
+
+    // Trace Queue and shade its hits, adding their colours to Samples and their rays to Next
+    template<typename ContainerType>
+    void TraceBounce(std::vector<QueuedRay>& Queue, std::vector<QueuedRay>& Next, std::vector<Colour>& Samples);
+
+    // Order Queue by direction octant, then by the Morton code of the origin
+    void SortRays(std::vector<QueuedRay>& Queue);
+
+    // Kept between blocks to save reallocating them
+    std::vector<QueuedRay> m_queue, m_next, m_sorted;
+    std::vector<HitInfo> m_hits;
+    std::vector<uint64_t> m_keys;
+    std::vector<std::pair<uintptr_t, uint32_t>> m_shadeOrder;
+};
+
+// A Sampler thread built for one type of camera and of scene container, render() picks one
+// for the scene. Nothing on the way from a pixel to the hits of its primary rays is then a
+// virtual call, and the camera's part of it is inlined.
+template<typename Sampler, typename CameraType, typename ContainerType>
+class TypedRenderThread final : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    virtual void Main() override
+    {
+        this->template RenderPixels<Sampler, CameraType, ContainerType>();
+    }
+};
+
 #endif
\ No newline at end of file
@@ -16,12 +16,19 @@ public:
     virtual ~SceneNode() = default;
 
     virtual bool SimpleTrace(Ray R);
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M);
-    virtual bool ColourTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M);
-    virtual bool TimeTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M, const double& Time);
+    // Closest hit trace at Time, Time 0 being where the nodes start. R's tMax is shortened
+    // to any hit that is found.
+    // Hits are finalized with the hit node's own transform, so trace flattened scenes.
+    virtual bool TimeTrace(Ray& R, HitInfo& Hit, const double& Time);
 
     virtual void FlattenScene(std::vector<std::unique_ptr<SceneNode>>& List, Matrix4x4 M = Matrix4x4());
 
+    // Prepare a flattened node for a render whose time samples span [0, TimeDuration]
+    virtual void CacheMotion(double TimeDuration)
+    {
+        (void)TimeDuration;
+    }
+
     const Matrix4x4& GetTransform() const
     {
         return m_trans;
@@ -32,16 +39,23 @@ public:
         return m_invtrans;
     }
 
+    const AffineTransform& GetToLocal() const
+    {
+        return m_toLocal;
+    }
+
     void SetTransform(const Matrix4x4& m)
     {
         m_trans = m;
         m_invtrans = m.invert();
+        CacheTransforms();
     }
 
     void SetTransform(const Matrix4x4& m, const Matrix4x4& i)
     {
         m_trans = m;
         m_invtrans = i;
+        CacheTransforms();
     }
 
     void add_child(std::shared_ptr<SceneNode>& child)
@@ -77,6 +91,13 @@ protected:
     Matrix4x4 m_trans;
     Matrix4x4 m_invtrans;
 
+    // m_trans in the forms used while tracing, so rendering never inverts a matrix
+    AffineTransform m_toParent;
+    AffineTransform m_toLocal;
+    AffineTransform m_normalToParent;
+
+    void CacheTransforms();
+
     // Hierarchy
     typedef std::list<std::shared_ptr<SceneNode>> ChildList;
     ChildList m_children;
@@ -112,15 +133,27 @@ public:
     virtual ~GeometryNode() = default;
 
     virtual void FlattenScene(std::vector<std::unique_ptr<SceneNode>>& List, Matrix4x4 M = Matrix4x4());
+    virtual void CacheMotion(double TimeDuration) override;
 
     virtual bool SimpleTrace(Ray R) override;
-    virtual bool DepthTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M) override;
-    virtual bool ColourTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M) override;
-    virtual bool TimeTrace(Ray R, double& closestDist, HitInfo& Hit, Matrix4x4& M, const double& Time) override;
+    virtual bool TimeTrace(Ray& R, HitInfo& Hit, const double& Time) override;
+
+    // Fill in the surface and material of a hit this node recorded at Time
+    void FinalizeHit(HitInfo& Hit, const double& Time) const;
 
     const Material* get_material() const;
     Material* get_material();
 
+    Primitive* GetPrimitive() const
+    {
+        return m_primitive.get();
+    }
+
+    const Vector3D& GetVelocity() const
+    {
+        return Velocity;
+    }
+
     virtual BoxF GetBox() override;
 
     void set_material(std::shared_ptr<Material>& material)
@@ -131,6 +164,8 @@ public:
 protected:
     // Linear veloctiy for motion blur (units/second)
     Vector3D Velocity;
+    bool m_bMoving;
+    Vector3D m_sweep;       // World space distance moved over the render
 
     std::shared_ptr<Material> m_material;
     std::shared_ptr<Primitive> m_primitive;
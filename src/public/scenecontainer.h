@@ -4,7 +4,10 @@
 #include <vector>
 #include <list>
 #include "photonmap.hpp"
+#include "primitivetable.h"
 #include "ray.h"
+#include "raypacket.h"
+#include "tracequery.h"
 
 class SceneNode;
 class Light;
@@ -15,15 +18,20 @@ class SceneContainer
 {
 protected:
 	std::vector<std::unique_ptr<SceneNode>>* Nodes;
+	PrimitiveTable Table;
 	PhotonMap PMap;
-	virtual bool ContainerSpecificTimeTrace(const Ray& R, HitInfo& Hit, const double& Time) const;
-	virtual bool ContainerSpecificColourTrace(const Ray& R, HitInfo& Hit) const;
-	virtual bool ContainerSpecificDepthTrace(const Ray& R, double& dist) const;
+	// The hit of R at Time that Query looks for (see tracequery.h), R's tMax is shortened to it.
+	// There is one of these per kind of query, each a build of the container's Traverse.
+#define RT_CONTAINER_TRACE(Query, ...) \
+	virtual bool ContainerSpecificTrace(Ray& R, HitInfo& Hit, const double& Time, Query) const __VA_ARGS__;
+	RT_FOR_EACH_TRACE_QUERY(RT_CONTAINER_TRACE, )
+	// The closest hit of every ray in Packet, bHits[i] is whether Packet[i] hit anything
+	virtual void ContainerSpecificPacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const;
 
 public:
 	const std::list<std::unique_ptr<Light>>* lights;
 	virtual ~SceneContainer() {}
-	SceneContainer(std::vector<std::unique_ptr<SceneNode>>* Nodes, const std::list<std::unique_ptr<Light>>* lights, unsigned int Photons) : Nodes(Nodes), PMap(this, Photons), lights(lights) 
+	SceneContainer(std::vector<std::unique_ptr<SceneNode>>* Nodes, const std::list<std::unique_ptr<Light>>* lights, unsigned int Photons) : Nodes(Nodes), Table(*Nodes), PMap(this, Photons), lights(lights) 
 	{
 		// Map photons
   		PMap.BuildTree();
@@ -37,21 +45,54 @@ public:
 
 	// Trace types
 	bool TimeRayTrace(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient, const double& Time) const;
+	// The closest hit of R, without its colour
+	bool TimeClosestHit(const Ray& R, HitInfo& Hit, const double& Time) const;
+	// Whether anything is hit within R's range, for shadow rays
+	bool TimeAnyHit(const Ray& R, const double& Time) const;
+	// TimeRayTrace in two steps for coherent rays: the closest hits of a packet of them,
+	// then the colour at each hit
+	void TimePacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const;
+	// TimeClosestHit and TimePacketTrace of a container known to be a ContainerType, whose
+	// traces are then called directly instead of through the vtable
+	template<typename ContainerType>
+	bool TimeClosestHitAs(const Ray& R, HitInfo& Hit, const double& Time) const
+	{
+		Ray Closest(R);
+		return static_cast<const ContainerType*>(this)->ContainerType::ContainerSpecificTrace(Closest, Hit, Time, ClosestHitQuery());
+	}
+	template<typename ContainerType>
+	void TimePacketTraceAs(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const
+	{
+		static_cast<const ContainerType*>(this)->ContainerType::ContainerSpecificPacketTrace(Packet, Hits, bHits, Time);
+	}
+	void LightTimeHit(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient, const double& Time) const;
 	bool RayTrace(Colour& OutCol, const Ray& R, HitInfo& Hit, const Colour& ambient) const;
 	bool PhotonTrace(const Ray& R, HitInfo& Hit) const;
+	// dist is the t of the closest hit along R within its range
 	bool TimeDepthTrace(const Ray& R, double& dist, const double& Time) const;
 	bool DepthTrace(const Ray& R, double& dist) const;
+
+private:
+	template<typename Query>
+	bool Traverse(Ray& R, HitInfo& Hit, const double& Time) const;
 };
 
-class OctreeSceneContainer : public SceneContainer
+class OctreeSceneContainer final : public SceneContainer
 {
-	OcTree<SceneNode> Tree;
+	OcTree<PrimitiveRef> Tree;
+	// For TimeClosestHitAs and TimePacketTraceAs
+	friend class SceneContainer;
 protected:
-	virtual bool ContainerSpecificTimeTrace(const Ray& R, HitInfo& Hit, const double& Time) const override;
-	virtual bool ContainerSpecificColourTrace(const Ray& R, HitInfo& Hit) const override;
-	virtual bool ContainerSpecificDepthTrace(const Ray& R, double& dist) const override;
+	RT_FOR_EACH_TRACE_QUERY(RT_CONTAINER_TRACE, override)
+	virtual void ContainerSpecificPacketTrace(RayPacket& Packet, HitInfo Hits[], bool bHits[], const double& Time) const override;
 
 public:
  	virtual ~OctreeSceneContainer() {}
  	OctreeSceneContainer(std::vector<std::unique_ptr<SceneNode>>* Nodes, const std::list<std::unique_ptr<Light>>* lights, unsigned int Photons);
-};
\ No newline at end of file
+
+private:
+	template<typename Query>
+	bool Traverse(Ray& R, HitInfo& Hit, const double& Time) const;
+};
+
+#undef RT_CONTAINER_TRACE
\ No newline at end of file
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <cmath>
+#include <utility>
+
+// SSE for float, AVX2 or two SSE2 registers for double.
+// Define RT_NO_SIMD to build the portable version instead.
+#if !defined(RT_NO_SIMD) && defined(__SSE2__)
+#define RT_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace FastMath
+{
+namespace Simd
+{
+
+// Four lanes of T, the storage of 3 and 4 component points, vectors and colours.
+// 3 component values keep 0 in their last lane so 4 lane operations don't disturb it.
+template<typename T>
+struct Lanes4
+{
+    T v[4];
+
+    static inline Lanes4 Load(const T* p)
+    {
+        return Lanes4{{p[0], p[1], p[2], p[3]}};
+    }
+
+    static inline Lanes4 Set(T x, T y, T z, T w)
+    {
+        return Lanes4{{x, y, z, w}};
+    }
+
+    static inline Lanes4 Broadcast(T s)
+    {
+        return Lanes4{{s, s, s, s}};
+    }
+
+    // s in the first three lanes, 0 in w
+    static inline Lanes4 Broadcast3(T s)
+    {
+        return Lanes4{{s, s, s, T(0)}};
+    }
+
+    inline void Store(T* p) const
+    {
+        p[0] = v[0];
+        p[1] = v[1];
+        p[2] = v[2];
+        p[3] = v[3];
+    }
+
+    friend inline Lanes4 operator+(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+    }
+
+    friend inline Lanes4 operator-(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+    }
+
+    friend inline Lanes4 operator*(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+    }
+
+    friend inline Lanes4 operator/(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{{a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]}};
+    }
+
+    // Lanes are x, y, z, w
+    inline T Dot(const Lanes4& b) const
+    {
+        return v[0] * b.v[0] + v[1] * b.v[1] + v[2] * b.v[2] + v[3] * b.v[3];
+    }
+
+    // Of the first three lanes, w is 0
+    inline Lanes4 Cross(const Lanes4& b) const
+    {
+        return Lanes4{{v[1] * b.v[2] - v[2] * b.v[1], v[2] * b.v[0] - v[0] * b.v[2], v[0] * b.v[1] - v[1] * b.v[0], T(0)}};
+    }
+
+    // Rows of a 4x4 matrix become its columns
+    static inline void Transpose(Lanes4& a, Lanes4& b, Lanes4& c, Lanes4& d)
+    {
+        std::swap(a.v[1], b.v[0]);
+        std::swap(a.v[2], c.v[0]);
+        std::swap(a.v[3], d.v[0]);
+        std::swap(b.v[2], c.v[1]);
+        std::swap(b.v[3], d.v[1]);
+        std::swap(c.v[3], d.v[2]);
+    }
+};
+
+#ifdef RT_SIMD
+template<>
+struct Lanes4<float>
+{
+    __m128 v;
+
+    static inline Lanes4 Load(const float* p)
+    {
+        return Lanes4{_mm_loadu_ps(p)};
+    }
+
+    static inline Lanes4 Set(float x, float y, float z, float w)
+    {
+        return Lanes4{_mm_setr_ps(x, y, z, w)};
+    }
+
+    static inline Lanes4 Broadcast(float s)
+    {
+        return Lanes4{_mm_set1_ps(s)};
+    }
+
+    static inline Lanes4 Broadcast3(float s)
+    {
+        return Lanes4{_mm_setr_ps(s, s, s, 0.f)};
+    }
+
+    inline void Store(float* p) const
+    {
+        _mm_storeu_ps(p, v);
+    }
+
+    friend inline Lanes4 operator+(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_add_ps(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator-(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_sub_ps(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator*(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_mul_ps(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator/(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_div_ps(a.v, b.v)};
+    }
+
+    inline float Dot(const Lanes4& b) const
+    {
+        const __m128 m = _mm_mul_ps(v, b.v);
+        const __m128 s = _mm_add_ps(m, _mm_movehl_ps(m, m));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+    }
+
+    inline Lanes4 Cross(const Lanes4& b) const
+    {
+        // a.yzx * b.zxy - a.zxy * b.yzx, done as (a * b.yzx - a.yzx * b).yzx
+        const __m128 a_yzx = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+        const __m128 b_yzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+        const __m128 c = _mm_sub_ps(_mm_mul_ps(v, b_yzx), _mm_mul_ps(a_yzx, b.v));
+        return Lanes4{_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1))};
+    }
+
+    static inline void Transpose(Lanes4& a, Lanes4& b, Lanes4& c, Lanes4& d)
+    {
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    }
+};
+
+#ifdef __AVX2__
+template<>
+struct Lanes4<double>
+{
+    __m256d v;
+
+    static inline Lanes4 Load(const double* p)
+    {
+        return Lanes4{_mm256_loadu_pd(p)};
+    }
+
+    static inline Lanes4 Set(double x, double y, double z, double w)
+    {
+        return Lanes4{_mm256_setr_pd(x, y, z, w)};
+    }
+
+    static inline Lanes4 Broadcast(double s)
+    {
+        return Lanes4{_mm256_set1_pd(s)};
+    }
+
+    static inline Lanes4 Broadcast3(double s)
+    {
+        return Lanes4{_mm256_setr_pd(s, s, s, 0.0)};
+    }
+
+    inline void Store(double* p) const
+    {
+        _mm256_storeu_pd(p, v);
+    }
+
+    friend inline Lanes4 operator+(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm256_add_pd(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator-(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm256_sub_pd(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator*(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm256_mul_pd(a.v, b.v)};
+    }
+
+    friend inline Lanes4 operator/(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm256_div_pd(a.v, b.v)};
+    }
+
+    inline double Dot(const Lanes4& b) const
+    {
+        const __m256d m = _mm256_mul_pd(v, b.v);
+        const __m128d s = _mm_add_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    inline Lanes4 Cross(const Lanes4& b) const
+    {
+        // Same shuffles as float, yzx is a lane permute across the two halves
+        const __m256d a_yzx = _mm256_permute4x64_pd(v, _MM_SHUFFLE(3, 0, 2, 1));
+        const __m256d b_yzx = _mm256_permute4x64_pd(b.v, _MM_SHUFFLE(3, 0, 2, 1));
+        const __m256d c = _mm256_sub_pd(_mm256_mul_pd(v, b_yzx), _mm256_mul_pd(a_yzx, b.v));
+        return Lanes4{_mm256_permute4x64_pd(c, _MM_SHUFFLE(3, 0, 2, 1))};
+    }
+
+    static inline void Transpose(Lanes4& a, Lanes4& b, Lanes4& c, Lanes4& d)
+    {
+        const __m256d ab02 = _mm256_unpacklo_pd(a.v, b.v), ab13 = _mm256_unpackhi_pd(a.v, b.v);
+        const __m256d cd02 = _mm256_unpacklo_pd(c.v, d.v), cd13 = _mm256_unpackhi_pd(c.v, d.v);
+        a.v = _mm256_permute2f128_pd(ab02, cd02, 0x20);
+        b.v = _mm256_permute2f128_pd(ab13, cd13, 0x20);
+        c.v = _mm256_permute2f128_pd(ab02, cd02, 0x31);
+        d.v = _mm256_permute2f128_pd(ab13, cd13, 0x31);
+    }
+};
+#else
+template<>
+struct Lanes4<double>
+{
+    __m128d xy;
+    __m128d zw;
+
+    static inline Lanes4 Load(const double* p)
+    {
+        return Lanes4{_mm_loadu_pd(p), _mm_loadu_pd(p + 2)};
+    }
+
+    static inline Lanes4 Set(double x, double y, double z, double w)
+    {
+        return Lanes4{_mm_setr_pd(x, y), _mm_setr_pd(z, w)};
+    }
+
+    static inline Lanes4 Broadcast(double s)
+    {
+        return Lanes4{_mm_set1_pd(s), _mm_set1_pd(s)};
+    }
+
+    static inline Lanes4 Broadcast3(double s)
+    {
+        return Lanes4{_mm_set1_pd(s), _mm_set_sd(s)};
+    }
+
+    inline void Store(double* p) const
+    {
+        _mm_storeu_pd(p, xy);
+        _mm_storeu_pd(p + 2, zw);
+    }
+
+    friend inline Lanes4 operator+(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw)};
+    }
+
+    friend inline Lanes4 operator-(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw)};
+    }
+
+    friend inline Lanes4 operator*(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw)};
+    }
+
+    friend inline Lanes4 operator/(const Lanes4& a, const Lanes4& b)
+    {
+        return Lanes4{_mm_div_pd(a.xy, b.xy), _mm_div_pd(a.zw, b.zw)};
+    }
+
+    inline double Dot(const Lanes4& b) const
+    {
+        const __m128d s = _mm_add_pd(_mm_mul_pd(xy, b.xy), _mm_mul_pd(zw, b.zw));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+
+    inline Lanes4 Cross(const Lanes4& b) const
+    {
+        // yz, zx and xy pairs of each side
+        const __m128d a_yz = _mm_shuffle_pd(xy, zw, 1), a_zx = _mm_shuffle_pd(zw, xy, 0), a_xy = xy;
+        const __m128d b_yz = _mm_shuffle_pd(b.xy, b.zw, 1), b_zx = _mm_shuffle_pd(b.zw, b.xy, 0), b_xy = b.xy;
+
+        // x, y = a.yz * b.zx - a.zx * b.yz; z = a.x * b.y - a.y * b.x
+        const __m128d c_xy = _mm_sub_pd(_mm_mul_pd(a_yz, b_zx), _mm_mul_pd(a_zx, b_yz));
+        const __m128d c_z = _mm_sub_sd(_mm_mul_sd(a_xy, _mm_unpackhi_pd(b_xy, b_xy)), _mm_mul_sd(_mm_unpackhi_pd(a_xy, a_xy), b_xy));
+        return Lanes4{c_xy, _mm_move_sd(_mm_setzero_pd(), c_z)};
+    }
+
+    static inline void Transpose(Lanes4& a, Lanes4& b, Lanes4& c, Lanes4& d)
+    {
+        const Lanes4 a0 = a, b0 = b, c0 = c, d0 = d;
+        a = Lanes4{_mm_unpacklo_pd(a0.xy, b0.xy), _mm_unpacklo_pd(c0.xy, d0.xy)};
+        b = Lanes4{_mm_unpackhi_pd(a0.xy, b0.xy), _mm_unpackhi_pd(c0.xy, d0.xy)};
+        c = Lanes4{_mm_unpacklo_pd(a0.zw, b0.zw), _mm_unpacklo_pd(c0.zw, d0.zw)};
+        d = Lanes4{_mm_unpackhi_pd(a0.zw, b0.zw), _mm_unpackhi_pd(c0.zw, d0.zw)};
+    }
+};
+#endif
+#endif // RT_SIMD
+
+// The row major 4x4 matrix with rows r0..r3 times (x, y, z, w)
+template<typename T>
+inline Lanes4<T> MatVec(const T* r0, const T* r1, const T* r2, const T* r3, T x, T y, T z, T w)
+{
+    Lanes4<T> c0 = Lanes4<T>::Load(r0), c1 = Lanes4<T>::Load(r1), c2 = Lanes4<T>::Load(r2), c3 = Lanes4<T>::Load(r3);
+    Lanes4<T>::Transpose(c0, c1, c2, c3);
+    return c0 * Lanes4<T>::Broadcast(x) + c1 * Lanes4<T>::Broadcast(y) + c2 * Lanes4<T>::Broadcast(z) + c3 * Lanes4<T>::Broadcast(w);
+}
+
+// Columns of the row major affine transform with rows r0..r2 and a bottom row of 0s
+template<typename T>
+inline void AffineColumns(const T* r0, const T* r1, const T* r2, Lanes4<T>& c0, Lanes4<T>& c1, Lanes4<T>& c2, Lanes4<T>& c3)
+{
+    c0 = Lanes4<T>::Load(r0);
+    c1 = Lanes4<T>::Load(r1);
+    c2 = Lanes4<T>::Load(r2);
+    c3 = Lanes4<T>::Broadcast(T(0));
+    Lanes4<T>::Transpose(c0, c1, c2, c3);
+}
+
+// The transform with rows r0..r2 applied to the point (x, y, z), w of the result is 0
+template<typename T>
+inline Lanes4<T> TransformPoint(const T* r0, const T* r1, const T* r2, T x, T y, T z)
+{
+    Lanes4<T> c0, c1, c2, c3;
+    AffineColumns(r0, r1, r2, c0, c1, c2, c3);
+    return c0 * Lanes4<T>::Broadcast(x) + c1 * Lanes4<T>::Broadcast(y) + c2 * Lanes4<T>::Broadcast(z) + c3;
+}
+
+// The transform with rows r0..r2 applied to the vector (x, y, z), w of the result is 0
+template<typename T>
+inline Lanes4<T> TransformVector(const T* r0, const T* r1, const T* r2, T x, T y, T z)
+{
+    Lanes4<T> c0, c1, c2, c3;
+    AffineColumns(r0, r1, r2, c0, c1, c2, c3);
+    return c0 * Lanes4<T>::Broadcast(x) + c1 * Lanes4<T>::Broadcast(y) + c2 * Lanes4<T>::Broadcast(z);
+}
+
+} // namespace Simd
+} // namespace FastMath
@@ -0,0 +1,24 @@
+#pragma once
+
+// What a trace through the scene looks for. The containers and the PrimitiveTable build
+// their traversals once per kind of query, so a trace picks its kind at no run time cost,
+// and a new kind is a policy here added to RT_FOR_EACH_TRACE_QUERY.
+// Traces without a time are queries at Time 0.
+
+// The closest hit, R's tMax is shortened to it
+struct ClosestHitQuery
+{
+    static constexpr bool bAnyHit = false;
+};
+
+// Whether anything is hit within R's range, for shadow rays. The traversal stops at the
+// first hit it finds, which need not be the closest.
+struct AnyHitQuery
+{
+    static constexpr bool bAnyHit = true;
+};
+
+// Expands X(query, ...) for every kind of query
+#define RT_FOR_EACH_TRACE_QUERY(X, ...) \
+    X(ClosestHitQuery, __VA_ARGS__) \
+    X(AnyHitQuery, __VA_ARGS__)
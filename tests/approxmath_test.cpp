@@ -0,0 +1,199 @@
+// Sweeps each approximation in approxmath.h over its documented domain, compares it
+// against libm and fails if the error ever reaches the bound its comment states.
+// Run with make test.
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include "approxmath.h"
+
+using namespace FastMath;
+
+namespace
+{
+
+// Largest error seen for one function, checked against its stated bound
+struct ErrorCheck
+{
+    const char* Name;
+    double Bound;
+    double MaxError = 0;
+    double WorstInput = 0;
+    bool bSawNaN = false;
+
+    ErrorCheck(const char* name, double bound) : Name(name), Bound(bound) {}
+
+    void Add(double input, double error)
+    {
+        // A NaN would be lost to the next larger error, so it is flagged on its own
+        if (std::isnan(error))
+        {
+            if (!bSawNaN)
+            {
+                WorstInput = input;
+            }
+            bSawNaN = true;
+        }
+        else if (error > MaxError)
+        {
+            MaxError = error;
+            WorstInput = input;
+        }
+    }
+
+    bool Report() const
+    {
+        const bool bPassed = !bSawNaN && MaxError < Bound;
+        if (bSawNaN)
+        {
+            std::printf("%-14s NaN at %.17g FAILED\n", Name, WorstInput);
+        }
+        else
+        {
+            std::printf("%-14s max error %.3g at %.17g, bound %.3g %s\n", Name, MaxError, WorstInput, Bound,
+                        bPassed ? "ok" : "FAILED");
+        }
+        return bPassed;
+    }
+};
+
+double RelativeError(double approx, double exact)
+{
+    return std::fabs(approx - exact) / std::fabs(exact);
+}
+
+// Every step'th normal exponent, each with mantissaSteps mantissas in [1, 2)
+template<typename Func>
+void SweepNormals(int step, int mantissaSteps, Func func)
+{
+    for (int exponent = -1022; exponent <= 1023; exponent += step)
+    {
+        for (int i = 0; i < mantissaSteps; ++i)
+        {
+            func(std::ldexp(1 + double(i) / mantissaSteps, exponent));
+        }
+    }
+}
+
+bool TestLog2()
+{
+    ErrorCheck check("Log2Approx", 5e-8);
+    SweepNormals(3, 4096, [&](double x)
+    {
+        check.Add(x, std::fabs(Log2Approx(x) - std::log2(x)));
+    });
+    return check.Report();
+}
+
+bool TestExp2()
+{
+    ErrorCheck check("Exp2Approx", 1e-8);
+    for (double y = -1022; y <= 1023; y += 1.0 / 1024)
+    {
+        check.Add(y, RelativeError(Exp2Approx(y), std::exp2(y)));
+    }
+    return check.Report();
+}
+
+bool TestPow()
+{
+    // Error relative to the bound's growth with |y log2(x)|, over the range where the
+    // result stays inside Exp2Approx's clamp
+    ErrorCheck check("PowApprox", 6e-8);
+    for (double logX = -40; logX <= 40; logX += 1.0 / 64)
+    {
+        const double x = std::exp2(logX);
+        for (double y = -64; y <= 64; y += 1.0 / 16)
+        {
+            const double scale = 1 + std::fabs(y * std::log2(x));
+            if (scale < 1000)
+            {
+                check.Add(x, RelativeError(PowApprox(x, y), std::pow(x, y)) / scale);
+            }
+        }
+    }
+    bool bPassed = check.Report();
+
+    if (PowApprox(0, 0) != 1 || PowApprox(0, 2.5) != 0 || PowApprox(0, 100) != 0)
+    {
+        std::printf("PowApprox      0^0 must be 1 and 0^y for y > 0 must be 0 FAILED\n");
+        bPassed = false;
+    }
+    return bPassed;
+}
+
+bool TestSinCos()
+{
+    ErrorCheck check("SinCosApprox", 2e-9);
+    auto add = [&](double x)
+    {
+        double s, c;
+        SinCosApprox(x, s, c);
+        check.Add(x, std::max(std::fabs(s - std::sin(x)), std::fabs(c - std::cos(x))));
+    };
+    for (double x = -1e5; x <= 1e5; x += 1.0 / 32)
+    {
+        add(x);
+    }
+    // Densely around 0 where the reduction does nothing
+    for (double x = -8; x <= 8; x += 1.0 / 65536)
+    {
+        add(x);
+    }
+    return check.Report();
+}
+
+bool TestAcos()
+{
+    ErrorCheck check("AcosApprox", 3e-8);
+    const int steps = 1 << 22;
+    for (int i = 0; i <= steps; ++i)
+    {
+        const double x = -1 + 2.0 * i / steps;
+        check.Add(x, std::fabs(AcosApprox(x) - std::acos(x)));
+    }
+    return check.Report();
+}
+
+bool TestRsqrt()
+{
+    ErrorCheck check("RsqrtApprox", 4e-11);
+    SweepNormals(3, 4096, [&](double x)
+    {
+        check.Add(x, RelativeError(RsqrtApprox(x), 1 / std::sqrt(x)));
+    });
+    return check.Report();
+}
+
+bool TestNormalize()
+{
+    // Normalize rounds to Scalar, so allow a few of its ulps on top of RsqrtApprox's error
+    bUseApproxMath = true;
+    ErrorCheck check("Normalize", 4e-11 + 8 * std::numeric_limits<Scalar>::epsilon());
+    for (int i = 0; i < 100000; ++i)
+    {
+        const double scale = std::exp2(double(i % 61) - 30);
+        Vector3D v(std::sin(i * 0.37) * scale, std::cos(i * 1.13) * scale, (std::sin(i * 0.071) + 0.5) * scale);
+        if (v.length2() > 0)
+        {
+            Normalize(v);
+            check.Add(i, std::fabs(std::sqrt(double(v.length2())) - 1));
+        }
+    }
+    bUseApproxMath = false;
+    return check.Report();
+}
+
+} // namespace
+
+int main()
+{
+    bool bPassed = TestLog2();
+    bPassed = TestExp2() && bPassed;
+    bPassed = TestPow() && bPassed;
+    bPassed = TestSinCos() && bPassed;
+    bPassed = TestAcos() && bPassed;
+    bPassed = TestRsqrt() && bPassed;
+    bPassed = TestNormalize() && bPassed;
+    return bPassed ? 0 : 1;
+}